@@ -2,6 +2,7 @@
 #include "config.h"
 #include "libk.h"
 #include "panic.h"
+#include "checksum.h"
 
 extern void memmap(void*, void*);
 extern u64 LAPIC_address;
@@ -140,6 +141,13 @@ void ACPI_print_tables(ACPI_SDT_Header* xsdt_header)
     }
 }
 
+// Every byte of a table, checksum field included, adds up to 0
+bool ACPI_table_valid(ACPI_SDT_Header* header)
+{
+    return byte_sum(header, header->length) == 0;
+}
+
+// Tables that fail the checksum are skipped
 ACPI_SDT_Header* ACPI_find_table(ACPI_SDT_Header* xsdt_header, const char* table_signature)
 {
     u32 table_count = (xsdt_header->length - sizeof(ACPI_SDT_Header)) / 8;
@@ -149,7 +157,7 @@ ACPI_SDT_Header* ACPI_find_table(ACPI_SDT_Header* xsdt_header, const char* table
     for (u32 i = 0; i < table_count; i++)
     {
         ACPI_SDT_Header* table_header = (ACPI_SDT_Header*) pointer_table[i];
-        if (memequal(table_header->signature, table_signature, sizeof(table_header->signature)))
+        if (memequal(table_header->signature, table_signature, sizeof(table_header->signature)) && ACPI_table_valid(table_header))
         {
             return table_header;
         }
@@ -215,7 +223,7 @@ void PCI_enumerate_bus(u64 base_address, u64 bus)
 
 void PCI_enumerate(ACPI_MCFG_Header* mcfg_header)
 {
-    new_line();
+    print("\n");
 
     u32 mcfg_entries = (mcfg_header->header.length - sizeof(ACPI_MCFG_Header)) / sizeof(ACPI_DeviceConfig);
     println("MCFG entries: %32u", mcfg_entries);
@@ -235,7 +243,7 @@ void PCI_enumerate(ACPI_MCFG_Header* mcfg_header)
         }
     }
 
-    new_line();
+    print("\n");
 }
 
 void MADT_explore(ACPI_MADT_Header* MADT_header)
@@ -347,19 +355,10 @@ void ACPI_setup(ACPI_RSDPDescriptor2* rsdp)
 
     ACPI_SDT_Header* xsdt_header = (ACPI_SDT_Header*)rsdp->XSDT_address;
 
-    /*u8 sum = 0;*/
-    /*for (u32 i = 0; i < xsdt_header->length; i++)*/
-    /*{*/
-        /*sum += ((char*)xsdt_header)[i];*/
-    /*}*/
-    /*if (sum == 0)*/
-    /*{*/
-        /*println("Valid XSDT checksum");*/
-    /*}*/
-    /*else*/
-    /*{*/
-        /*panic("Invalid XSDT checksum");*/
-    /*}*/
+    if (!ACPI_table_valid(xsdt_header))
+    {
+        panic("Invalid XSDT checksum");
+    }
 
     /*ACPI_print_tables(xsdt_header);*/
 
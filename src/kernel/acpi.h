@@ -32,5 +32,6 @@ typedef struct PACKED ACPI_SDT_Header
     u32 creator_revision;
 } ACPI_SDT_Header;
 
+bool ACPI_table_valid(ACPI_SDT_Header* header);
 ACPI_SDT_Header* ACPI_find_table(ACPI_SDT_Header* xsdt_header, const char* signature);
 void ACPI_setup(ACPI_RSDPDescriptor2* rsdp);
\ No newline at end of file
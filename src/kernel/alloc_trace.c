@@ -0,0 +1,304 @@
+#include "alloc_trace.h"
+
+#if ALLOC_TRACE
+#include "asm.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "arena.h"
+#include "libk.h"
+
+#define ALLOC_TRACE_SITE_COUNT 256
+#define ALLOC_TRACE_LIVE_COUNT 4096
+
+typedef struct AllocTraceSite
+{
+    void* site;
+    u32 kind;
+    u32 reserved;
+    u64 first_tsc;
+    u64 alloc_count;
+    u64 alloc_bytes;
+    u64 free_count;
+    u64 free_bytes;
+} AllocTraceSite;
+
+typedef struct ALIGN(CACHE_LINE_SIZE) AllocTraceCPU
+{
+    AllocTraceSite sites[ALLOC_TRACE_SITE_COUNT];
+    u64 dropped_site_count;
+} AllocTraceCPU;
+
+// Live allocations, so frees can be charged back to the call site that allocated the memory
+typedef struct AllocTraceLive
+{
+    void* ptr;
+    void* site;
+    u32 kind;
+    u32 reserved;
+    u64 bytes;
+} AllocTraceLive;
+
+static bool alloc_trace_enabled = false;
+static AllocTraceCPU alloc_trace_cpus[CPU_MAX_COUNT];
+// Shared by all CPUs, since memory is often freed on a different CPU than the one that allocated it
+static Spinlock alloc_trace_live_lock = SPINLOCK_INIT;
+static AllocTraceLive alloc_trace_live[ALLOC_TRACE_LIVE_COUNT];
+static u64 alloc_trace_untracked_live_count;
+
+static inline u64 alloc_trace_hash(void* ptr)
+{
+    return ((u64)ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+}
+
+static AllocTraceSite* alloc_trace_site_get(AllocTraceCPU* cpu, void* site, AllocTraceKind kind)
+{
+    u64 mask = ALLOC_TRACE_SITE_COUNT - 1;
+    u64 index = (alloc_trace_hash(site) >> 32) & mask;
+
+    for (u64 probe = 0; probe < ALLOC_TRACE_SITE_COUNT; probe++, index = (index + 1) & mask)
+    {
+        AllocTraceSite* entry = &cpu->sites[index];
+        if (entry->site == site && entry->kind == kind)
+        {
+            return entry;
+        }
+
+        if (!entry->site)
+        {
+            entry->site = site;
+            entry->kind = kind;
+            entry->first_tsc = rdtsc();
+            return entry;
+        }
+    }
+
+    cpu->dropped_site_count++;
+    return NULL;
+}
+
+static void alloc_trace_live_insert(void* ptr, void* site, AllocTraceKind kind, u64 bytes)
+{
+    u64 mask = ALLOC_TRACE_LIVE_COUNT - 1;
+    u64 index = (alloc_trace_hash(ptr) >> 32) & mask;
+
+    for (u64 probe = 0; probe < ALLOC_TRACE_LIVE_COUNT; probe++, index = (index + 1) & mask)
+    {
+        if (!alloc_trace_live[index].ptr)
+        {
+            alloc_trace_live[index] = (const AllocTraceLive) { .ptr = ptr, .site = site, .kind = kind, .bytes = bytes };
+            return;
+        }
+    }
+
+    alloc_trace_untracked_live_count++;
+}
+
+static bool alloc_trace_live_remove(void* ptr, AllocTraceLive* out_live)
+{
+    u64 mask = ALLOC_TRACE_LIVE_COUNT - 1;
+    u64 index = (alloc_trace_hash(ptr) >> 32) & mask;
+
+    for (u64 probe = 0; probe < ALLOC_TRACE_LIVE_COUNT; probe++, index = (index + 1) & mask)
+    {
+        if (!alloc_trace_live[index].ptr)
+        {
+            return false;
+        }
+
+        if (alloc_trace_live[index].ptr == ptr)
+        {
+            *out_live = alloc_trace_live[index];
+
+            // Backward shift deletion keeps the linear probing chains intact without tombstones
+            u64 hole = index;
+            for (u64 next = (hole + 1) & mask; alloc_trace_live[next].ptr; next = (next + 1) & mask)
+            {
+                u64 home = (alloc_trace_hash(alloc_trace_live[next].ptr) >> 32) & mask;
+                if (((next - home) & mask) >= ((next - hole) & mask))
+                {
+                    alloc_trace_live[hole] = alloc_trace_live[next];
+                    hole = next;
+                }
+            }
+            alloc_trace_live[hole] = (const AllocTraceLive) {0};
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Called once the per-CPU area is reachable. Allocations done before that are not traced
+void alloc_trace_setup(void)
+{
+    memset(alloc_trace_cpus, 0, sizeof(alloc_trace_cpus));
+    spin_lock_init(&alloc_trace_live_lock);
+    memset(alloc_trace_live, 0, sizeof(alloc_trace_live));
+    alloc_trace_untracked_live_count = 0;
+    alloc_trace_enabled = true;
+}
+
+void alloc_trace_record_alloc(void* site, AllocTraceKind kind, void* ptr, u64 bytes)
+{
+    if (!alloc_trace_enabled || !ptr)
+    {
+        return;
+    }
+
+    u64 flags = interrupts_save_disable();
+
+    AllocTraceSite* entry = alloc_trace_site_get(&alloc_trace_cpus[cpu_get_id()], site, kind);
+    if (entry)
+    {
+        entry->alloc_count++;
+        entry->alloc_bytes += bytes;
+    }
+
+    // Interrupts are already disabled
+    spin_lock(&alloc_trace_live_lock);
+    alloc_trace_live_insert(ptr, site, kind, bytes);
+    spin_unlock(&alloc_trace_live_lock);
+
+    interrupts_restore(flags);
+}
+
+void alloc_trace_record_free(void* ptr)
+{
+    if (!alloc_trace_enabled || !ptr)
+    {
+        return;
+    }
+
+    u64 flags = interrupts_save_disable();
+
+    spin_lock(&alloc_trace_live_lock);
+    AllocTraceLive live;
+    bool found = alloc_trace_live_remove(ptr, &live);
+    spin_unlock(&alloc_trace_live_lock);
+
+    if (found)
+    {
+        // The allocation may have been recorded on another CPU, the per-CPU tables are merged when printed
+        AllocTraceSite* entry = alloc_trace_site_get(&alloc_trace_cpus[cpu_get_id()], live.site, live.kind);
+        if (entry)
+        {
+            entry->free_count++;
+            entry->free_bytes += live.bytes;
+        }
+    }
+
+    interrupts_restore(flags);
+}
+
+static u64 alloc_trace_site_rate(AllocTraceSite* site, u64 now)
+{
+    u64 elapsed = now - site->first_tsc;
+    return site->alloc_count * 1000000 / (elapsed ? elapsed : 1);
+}
+
+static u64 alloc_trace_site_key(AllocTraceSite* site, AllocTraceSortKey key, u64 now)
+{
+    switch (key)
+    {
+        case AllocTraceSortKey_Rate:
+            return alloc_trace_site_rate(site, now);
+        case AllocTraceSortKey_Calls:
+            return site->alloc_count;
+        case AllocTraceSortKey_Live:
+            return site->alloc_bytes - site->free_bytes;
+        case AllocTraceSortKey_Bytes:
+        default:
+            return site->alloc_bytes;
+    }
+}
+
+void alloc_trace_print(Arena* arena, AllocTraceSortKey key, u32 max_site_count)
+{
+    u32 capacity = ALLOC_TRACE_SITE_COUNT * cpu_count;
+    AllocTraceSite* merged = arena_alloc(arena, capacity * sizeof(AllocTraceSite));
+    if (!merged)
+    {
+        println("Not enough memory to merge the allocation trace");
+        return;
+    }
+
+    u32 merged_count = 0;
+    u64 dropped_site_count = 0;
+
+    u64 flags = interrupts_save_disable();
+
+    for (u32 cpu = 0; cpu < cpu_count; cpu++)
+    {
+        dropped_site_count += alloc_trace_cpus[cpu].dropped_site_count;
+
+        for (u32 i = 0; i < ALLOC_TRACE_SITE_COUNT; i++)
+        {
+            AllocTraceSite* site = &alloc_trace_cpus[cpu].sites[i];
+            if (!site->site)
+            {
+                continue;
+            }
+
+            u32 j;
+            for (j = 0; j < merged_count; j++)
+            {
+                if (merged[j].site == site->site && merged[j].kind == site->kind)
+                {
+                    merged[j].alloc_count += site->alloc_count;
+                    merged[j].alloc_bytes += site->alloc_bytes;
+                    merged[j].free_count += site->free_count;
+                    merged[j].free_bytes += site->free_bytes;
+                    // The site allocated first on whichever CPU saw it earliest
+                    if (site->first_tsc < merged[j].first_tsc)
+                    {
+                        merged[j].first_tsc = site->first_tsc;
+                    }
+                    break;
+                }
+            }
+
+            if (j == merged_count)
+            {
+                merged[merged_count++] = *site;
+            }
+        }
+    }
+
+    interrupts_restore(flags);
+    u64 now = rdtsc();
+
+    // Partial selection sort: only the top entries are printed
+    u32 print_count = merged_count < max_site_count ? merged_count : max_site_count;
+    for (u32 i = 0; i < print_count; i++)
+    {
+        u32 best = i;
+        for (u32 j = i + 1; j < merged_count; j++)
+        {
+            if (alloc_trace_site_key(&merged[j], key, now) > alloc_trace_site_key(&merged[best], key, now))
+            {
+                best = j;
+            }
+        }
+
+        AllocTraceSite tmp = merged[i];
+        merged[i] = merged[best];
+        merged[best] = tmp;
+    }
+
+    println("Allocation call sites: %32u", merged_count);
+    for (u32 i = 0; i < print_count; i++)
+    {
+        AllocTraceSite* site = &merged[i];
+        println("%64h %s: %64u calls, %64u bytes, %64u frees, %64u live bytes, %64u calls/Mcycle",
+                (u64)site->site, site->kind == AllocTraceKind_Page ? "page" : "object",
+                site->alloc_count, site->alloc_bytes, site->free_count, site->alloc_bytes - site->free_bytes,
+                alloc_trace_site_rate(site, now));
+    }
+
+    if (dropped_site_count || alloc_trace_untracked_live_count)
+    {
+        println("Dropped: %64u site records, %64u live records", dropped_site_count, alloc_trace_untracked_live_count);
+    }
+}
+#endif
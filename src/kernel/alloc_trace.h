@@ -0,0 +1,36 @@
+#pragma once
+#include "config.h"
+#include "types.h"
+
+typedef enum AllocTraceKind
+{
+    AllocTraceKind_Page = 0,
+    AllocTraceKind_Object = 1,
+} AllocTraceKind;
+
+typedef enum AllocTraceSortKey
+{
+    AllocTraceSortKey_Bytes = 0,
+    AllocTraceSortKey_Calls = 1,
+    AllocTraceSortKey_Live = 2,
+    // Calls per million TSC cycles since the site first allocated
+    AllocTraceSortKey_Rate = 3,
+} AllocTraceSortKey;
+
+// Allocation tracing is compiled in only with ALLOC_TRACE. Otherwise the hooks
+// in the allocators expand to nothing
+#if ALLOC_TRACE
+struct Arena;
+
+void alloc_trace_setup(void);
+void alloc_trace_record_alloc(void* site, AllocTraceKind kind, void* ptr, u64 bytes);
+void alloc_trace_record_free(void* ptr);
+void alloc_trace_print(struct Arena* arena, AllocTraceSortKey key, u32 max_site_count);
+
+// Must be expanded directly in the public allocator entry point, so the return address is the caller's
+#define alloc_trace_alloc(kind, ptr, bytes) alloc_trace_record_alloc(__builtin_return_address(0), (kind), (ptr), (bytes))
+#define alloc_trace_free(ptr) alloc_trace_record_free((ptr))
+#else
+#define alloc_trace_alloc(kind, ptr, bytes) ((void)0)
+#define alloc_trace_free(ptr) ((void)0)
+#endif
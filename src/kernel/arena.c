@@ -0,0 +1,117 @@
+#include "arena.h"
+#include "kmalloc.h"
+#include "libk.h"
+
+#define ARENA_DEFAULT_ALIGNMENT 16
+
+static ArenaChunk* arena_chunk_new(usize size)
+{
+    ArenaChunk* chunk = kmalloc(sizeof(ArenaChunk) + size);
+    if (!chunk)
+    {
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+
+    return chunk;
+}
+
+void arena_init(Arena* arena, usize chunk_size)
+{
+    arena->chunk_size = chunk_size;
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
+void* arena_alloc_aligned(Arena* arena, usize size, usize align)
+{
+    ArenaChunk* chunk = arena->current;
+
+    if (chunk)
+    {
+        u64 base = (u64)(chunk + 1);
+        u64 aligned = (base + chunk->used + align - 1) & ~((u64)align - 1);
+        u64 offset = aligned - base;
+
+        if (offset + size <= chunk->size)
+        {
+            chunk->used = offset + size;
+            return (void*)aligned;
+        }
+    }
+
+    // Slow path: start a new chunk, big enough for allocations larger than the default chunk size
+    usize chunk_size = arena->chunk_size;
+    if (size + align > chunk_size)
+    {
+        chunk_size = size + align;
+    }
+
+    ArenaChunk* new_chunk = arena_chunk_new(chunk_size);
+    if (!new_chunk)
+    {
+        return NULL;
+    }
+
+    if (chunk)
+    {
+        chunk->next = new_chunk;
+    }
+    else
+    {
+        arena->first = new_chunk;
+    }
+    arena->current = new_chunk;
+
+    return arena_alloc_aligned(arena, size, align);
+}
+
+void* arena_alloc(Arena* arena, usize size)
+{
+    return arena_alloc_aligned(arena, size, ARENA_DEFAULT_ALIGNMENT);
+}
+
+char* arena_strndup(Arena* arena, const char* str, usize length)
+{
+    char* result = arena_alloc_aligned(arena, length + 1, 1);
+    if (result)
+    {
+        memcpy(result, str, length);
+        result[length] = 0;
+    }
+
+    return result;
+}
+
+// Keeps the first chunk around so the common case does not touch kmalloc at all
+void arena_reset(Arena* arena)
+{
+    ArenaChunk* first = arena->first;
+    if (!first)
+    {
+        return;
+    }
+
+    ArenaChunk* it = first->next;
+    while (it)
+    {
+        ArenaChunk* next = it->next;
+        kfree(it);
+        it = next;
+    }
+
+    first->next = NULL;
+    first->used = 0;
+    arena->current = first;
+}
+
+void arena_free(Arena* arena)
+{
+    arena_reset(arena);
+    kfree(arena->first);
+    arena->first = NULL;
+    arena->current = NULL;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "types.h"
+
+typedef struct ArenaChunk
+{
+    struct ArenaChunk* next;
+    usize size;
+    usize used;
+} ArenaChunk;
+
+// Bump allocator: allocations are never freed one by one, the whole arena is reset at once
+typedef struct Arena
+{
+    ArenaChunk* first;
+    ArenaChunk* current;
+    usize chunk_size;
+} Arena;
+
+void arena_init(Arena* arena, usize chunk_size);
+void* arena_alloc_aligned(Arena* arena, usize size, usize align);
+void* arena_alloc(Arena* arena, usize size);
+char* arena_strndup(Arena* arena, const char* str, usize length);
+void arena_reset(Arena* arena);
+void arena_free(Arena* arena);
@@ -23,6 +23,24 @@ static inline void hlt(void)
     asm volatile("hlt");
 }
 
+#if LIBK_HOST
+// Host threads (tests/) can outnumber the CPUs or be preempted while they hold a lock, so a waiter
+// that only paused could spin away its whole time slice. host.c pauses and now and then yields
+void host_relax(void);
+
+static inline void cpu_relax(void)
+{
+    host_relax();
+}
+#else
+// Spin-wait hint: lets the sibling hyperthread run and avoids the memory order
+// violation pipeline flush when the awaited cache line finally changes
+static inline void cpu_relax(void)
+{
+    asm volatile("pause" : : : "memory");
+}
+#endif
+
 static inline void loop_forever(void)
 {
     for(;;)
@@ -55,3 +73,48 @@ static inline void interrupts_disable(void)
 {
     asm("cli");
 }
+
+#if LIBK_HOST
+// Host builds (tests/) run in user mode, where cli faults, and have no interrupts to mask
+static inline u64 interrupts_save_disable(void)
+{
+    asm volatile("" : : : "memory");
+    return 0;
+}
+
+static inline void interrupts_restore(u64 flags)
+{
+    asm volatile("" : : : "memory");
+}
+#else
+static inline u64 interrupts_save_disable(void)
+{
+    u64 flags;
+    asm volatile("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void interrupts_restore(u64 flags)
+{
+    asm volatile("pushq %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+#endif
+
+static inline void cpuid(u32 leaf, u32 subleaf, u32* eax, u32* ebx, u32* ecx, u32* edx)
+{
+    asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(subleaf));
+}
+
+static inline u64 xgetbv(u32 index)
+{
+    u32 eax, edx;
+    asm volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return ((u64)edx << 32) | eax;
+}
+
+static inline u64 rdtsc(void)
+{
+    u32 eax, edx;
+    asm volatile("rdtsc" : "=a"(eax), "=d"(edx));
+    return ((u64)edx << 32) | eax;
+}
@@ -0,0 +1,205 @@
+#include "bitset.h"
+#include "cpu.h"
+#include "libk.h"
+
+typedef char VectorBytes16 __attribute__((vector_size(16), may_alias));
+typedef char VectorBytes16_unaligned __attribute__((vector_size(16), aligned(1), may_alias));
+
+void bitset_init(BitSet* bitset, void* buffer, u64 bit_count)
+{
+    bitset->words = buffer;
+    bitset->bit_count = bit_count;
+    memset(buffer, 0, BITSET_BYTES(bit_count));
+}
+
+// Mask of the bits [start % 64, start % 64 + count) inside one word, for count <= 64
+static inline u64 bitset_word_mask(u64 start, u64 count)
+{
+    u64 low = start % BITSET_WORD_BITS;
+    u64 mask = count >= BITSET_WORD_BITS ? ~0ULL : (1ULL << count) - 1;
+    return mask << low;
+}
+
+static void bitset_fill_range(BitSet* bitset, u64 start, u64 count, bool value)
+{
+    if (start >= bitset->bit_count)
+    {
+        return;
+    }
+    if (count > bitset->bit_count - start)
+    {
+        count = bitset->bit_count - start;
+    }
+
+    u64* word = bitset->words + start / BITSET_WORD_BITS;
+
+    // Head: up to the next word boundary
+    u64 head = BITSET_WORD_BITS - start % BITSET_WORD_BITS;
+    if (head > count)
+    {
+        head = count;
+    }
+    if (head)
+    {
+        u64 mask = bitset_word_mask(start, head);
+        *word = value ? *word | mask : *word & ~mask;
+        word++;
+        count -= head;
+    }
+
+    u64 full_words = count / BITSET_WORD_BITS;
+    memset(word, value ? 0xff : 0, full_words * sizeof(u64));
+    word += full_words;
+    count %= BITSET_WORD_BITS;
+
+    if (count)
+    {
+        u64 mask = bitset_word_mask(0, count);
+        *word = value ? *word | mask : *word & ~mask;
+    }
+}
+
+void bitset_set_range(BitSet* bitset, u64 start, u64 count)
+{
+    bitset_fill_range(bitset, start, count, true);
+}
+
+void bitset_clear_range(BitSet* bitset, u64 start, u64 count)
+{
+    bitset_fill_range(bitset, start, count, false);
+}
+
+// Index of the first word at or after word_index that differs from skip_word (all zeros or all ones).
+// Long uniform stretches are skipped 32 bytes per step with SSE2 compares
+static u64 bitset_skip_words(const BitSet* bitset, u64 word_index, u64 skip_word)
+{
+    u64 word_count = BITSET_WORDS(bitset->bit_count);
+    const u64* words = bitset->words;
+
+    // skip_word is all zeros or all ones, i.e. one byte repeated
+    VectorBytes16 skip = (VectorBytes16){0} + (char)skip_word;
+
+    for (; word_index + 4 <= word_count; word_index += 4)
+    {
+        VectorBytes16 a = *(VectorBytes16_unaligned*)(words + word_index);
+        VectorBytes16 b = *(VectorBytes16_unaligned*)(words + word_index + 2);
+        VectorBytes16 equal = (VectorBytes16)((a == skip) & (b == skip));
+        if (__builtin_ia32_pmovmskb128(equal) != 0xffff)
+        {
+            break;
+        }
+    }
+
+    for (; word_index < word_count; word_index++)
+    {
+        if (words[word_index] != skip_word)
+        {
+            return word_index;
+        }
+    }
+
+    return word_count;
+}
+
+static u64 bitset_find(const BitSet* bitset, u64 from, bool value)
+{
+    if (from >= bitset->bit_count)
+    {
+        return bitset->bit_count;
+    }
+
+    u64 invert = value ? 0 : ~0ULL;
+    u64 word_index = from / BITSET_WORD_BITS;
+
+    // Flip the words when looking for zeros so both searches look for a set bit
+    u64 word = (bitset->words[word_index] ^ invert) & (~0ULL << (from % BITSET_WORD_BITS));
+    if (!word)
+    {
+        word_index = bitset_skip_words(bitset, word_index + 1, invert);
+        if (word_index >= BITSET_WORDS(bitset->bit_count))
+        {
+            return bitset->bit_count;
+        }
+        word = bitset->words[word_index] ^ invert;
+    }
+
+    u64 index = word_index * BITSET_WORD_BITS + __builtin_ctzll(word);
+    return index < bitset->bit_count ? index : bitset->bit_count;
+}
+
+u64 bitset_find_first_set(const BitSet* bitset, u64 from)
+{
+    return bitset_find(bitset, from, true);
+}
+
+u64 bitset_find_first_zero(const BitSet* bitset, u64 from)
+{
+    return bitset_find(bitset, from, false);
+}
+
+u64 bitset_find_zero_run(const BitSet* bitset, u64 from, u64 count)
+{
+    u64 start = bitset_find_first_zero(bitset, from);
+
+    while (start < bitset->bit_count)
+    {
+        if (count > bitset->bit_count - start)
+        {
+            break;
+        }
+
+        u64 end = bitset_find_first_set(bitset, start);
+        if (end - start >= count)
+        {
+            return start;
+        }
+
+        start = bitset_find_first_zero(bitset, end);
+    }
+
+    return bitset->bit_count;
+}
+
+static inline u64 popcount_SWAR(u64 word)
+{
+    word = word - ((word >> 1) & 0x5555555555555555ULL);
+    word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+    word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (word * 0x0101010101010101ULL) >> 56;
+}
+
+static inline u64 popcount_instruction(u64 word)
+{
+    u64 result;
+    asm("popcnt %1, %0" : "=r"(result) : "rm"(word));
+    return result;
+}
+
+u64 bitset_count(const BitSet* bitset)
+{
+    u64 full_words = bitset->bit_count / BITSET_WORD_BITS;
+    u64 tail_bits = bitset->bit_count % BITSET_WORD_BITS;
+    u64 total = 0;
+
+    if (cpu_features.POPCNT)
+    {
+        for (u64 i = 0; i < full_words; i++)
+        {
+            total += popcount_instruction(bitset->words[i]);
+        }
+    }
+    else
+    {
+        for (u64 i = 0; i < full_words; i++)
+        {
+            total += popcount_SWAR(bitset->words[i]);
+        }
+    }
+
+    if (tail_bits)
+    {
+        total += popcount_SWAR(bitset->words[full_words] & ((1ULL << tail_bits) - 1));
+    }
+
+    return total;
+}
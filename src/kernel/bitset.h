@@ -0,0 +1,64 @@
+#pragma once
+#include "types.h"
+
+// Bit i lives in word i / 64 at bit i % 64 (LSB first), so whole words can be tested, filled and
+// scanned with single instructions. Search functions return bit_count when nothing is found.
+
+#define BITSET_WORD_BITS 64
+#define BITSET_WORDS(bit_count) (((bit_count) + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS)
+#define BITSET_BYTES(bit_count) (BITSET_WORDS(bit_count) * sizeof(u64))
+
+typedef struct BitSet
+{
+    u64* words;
+    u64 bit_count;
+} BitSet;
+
+// buffer must hold BITSET_BYTES(bit_count) bytes. All bits start cleared
+void bitset_init(BitSet* bitset, void* buffer, u64 bit_count);
+
+static inline bool bitset_test(const BitSet* bitset, u64 index)
+{
+    if (index >= bitset->bit_count)
+    {
+        return false;
+    }
+
+    return (bitset->words[index / BITSET_WORD_BITS] >> (index % BITSET_WORD_BITS)) & 1;
+}
+
+static inline void bitset_set(BitSet* bitset, u64 index)
+{
+    if (index < bitset->bit_count)
+    {
+        bitset->words[index / BITSET_WORD_BITS] |= 1ULL << (index % BITSET_WORD_BITS);
+    }
+}
+
+static inline void bitset_clear(BitSet* bitset, u64 index)
+{
+    if (index < bitset->bit_count)
+    {
+        bitset->words[index / BITSET_WORD_BITS] &= ~(1ULL << (index % BITSET_WORD_BITS));
+    }
+}
+
+static inline void bitset_assign(BitSet* bitset, u64 index, bool value)
+{
+    if (value)
+    {
+        bitset_set(bitset, index);
+    }
+    else
+    {
+        bitset_clear(bitset, index);
+    }
+}
+
+void bitset_set_range(BitSet* bitset, u64 start, u64 count);
+void bitset_clear_range(BitSet* bitset, u64 start, u64 count);
+u64 bitset_find_first_set(const BitSet* bitset, u64 from);
+u64 bitset_find_first_zero(const BitSet* bitset, u64 from);
+// Start of the first run of count cleared bits at or after from
+u64 bitset_find_zero_run(const BitSet* bitset, u64 from, u64 count);
+u64 bitset_count(const BitSet* bitset);
@@ -0,0 +1,160 @@
+#include "blog.h"
+#include "asm.h"
+#include "cpu.h"
+
+// Records are laid out as consecutive words and never wrap around the end of the buffer:
+//     header: bits 0-31 format offset, bits 32-39 argument count, bit 63 padding marker
+//     TSC
+//     arguments
+// A padding header fills the space up to the end of the buffer when a record does not fit there.
+enum
+{
+    BLOG_HEADER_ARG_COUNT_SHIFT = 32,
+    BLOG_HEADER_PADDING = 1ULL << 63,
+    BLOG_RECORD_HEADER_WORDS = 2,
+};
+
+_Static_assert((BLOG_BUFFER_WORDS & (BLOG_BUFFER_WORDS - 1)) == 0, "BLOG_BUFFER_WORDS must be a power of two");
+
+// head and tail are free-running word positions. Only the owning CPU writes them, with interrupts
+// disabled, so a record is never interleaved with one logged from an interrupt handler
+typedef struct ALIGN(CACHE_LINE_SIZE) BLogBuffer
+{
+    u64 head;
+    u64 tail;
+    u64 words[BLOG_BUFFER_WORDS];
+} BLogBuffer;
+
+extern const char _BLogFormatsStart[];
+
+static BLogBuffer blog_buffers[CPU_MAX_COUNT];
+
+static u64 blog_record_words(const BLogBuffer* buffer, u64 position)
+{
+    u64 header = buffer->words[position % BLOG_BUFFER_WORDS];
+
+    if (header & BLOG_HEADER_PADDING)
+    {
+        return BLOG_BUFFER_WORDS - position % BLOG_BUFFER_WORDS;
+    }
+
+    return BLOG_RECORD_HEADER_WORDS + ((header >> BLOG_HEADER_ARG_COUNT_SHIFT) & 0xff);
+}
+
+void blog_write(const char* format, const u64* args, u32 arg_count)
+{
+    u64 header = (u64)(format - _BLogFormatsStart) | ((u64)arg_count << BLOG_HEADER_ARG_COUNT_SHIFT);
+    u64 words = BLOG_RECORD_HEADER_WORDS + arg_count;
+
+    u64 flags = interrupts_save_disable();
+    BLogBuffer* buffer = &blog_buffers[cpu_get_id()];
+
+    u64 offset = buffer->head % BLOG_BUFFER_WORDS;
+    u64 padding = offset + words > BLOG_BUFFER_WORDS ? BLOG_BUFFER_WORDS - offset : 0;
+
+    while (buffer->head + padding + words - buffer->tail > BLOG_BUFFER_WORDS)
+    {
+        buffer->tail += blog_record_words(buffer, buffer->tail);
+    }
+
+    if (padding)
+    {
+        buffer->words[offset] = BLOG_HEADER_PADDING;
+        buffer->head += padding;
+        offset = 0;
+    }
+
+    u64* record = &buffer->words[offset];
+    record[0] = header;
+    record[1] = rdtsc();
+    for (u32 i = 0; i < arg_count; i++)
+    {
+        record[BLOG_RECORD_HEADER_WORDS + i] = args[i];
+    }
+    buffer->head += words;
+
+    interrupts_restore(flags);
+}
+
+// Skips padding and records overwritten since the last call, returns false once the CPU has
+// nothing left past position
+static bool blog_next_record(const BLogBuffer* buffer, u64* position)
+{
+    if (*position < buffer->tail)
+    {
+        *position = buffer->tail;
+    }
+
+    while (*position < buffer->head && (buffer->words[*position % BLOG_BUFFER_WORDS] & BLOG_HEADER_PADDING))
+    {
+        *position += blog_record_words(buffer, *position);
+    }
+
+    return *position < buffer->head;
+}
+
+// One line per record, in TSC order across CPUs:
+//     @blog <cpu> <tsc> <format offset> [arguments...]
+// Interrupts are only disabled while a record is picked and copied, not while it is printed, so
+// the dump can run at serial speed. Records other CPUs overwrite while being copied may come out
+// garbled
+void blog_dump(FormatSink* sink)
+{
+    u64 positions[CPU_MAX_COUNT];
+    for (u32 cpu = 0; cpu < cpu_count; cpu++)
+    {
+        positions[cpu] = 0;
+    }
+
+    u64 record[BLOG_RECORD_HEADER_WORDS + BLOG_MAX_ARGS];
+
+    for (;;)
+    {
+        u64 flags = interrupts_save_disable();
+
+        u32 next_cpu = CPU_MAX_COUNT;
+        u64 next_tsc = 0;
+
+        for (u32 cpu = 0; cpu < cpu_count; cpu++)
+        {
+            const BLogBuffer* buffer = &blog_buffers[cpu];
+            if (blog_next_record(buffer, &positions[cpu]))
+            {
+                u64 tsc = buffer->words[(positions[cpu] + 1) % BLOG_BUFFER_WORDS];
+                if (next_cpu == CPU_MAX_COUNT || tsc < next_tsc)
+                {
+                    next_cpu = cpu;
+                    next_tsc = tsc;
+                }
+            }
+        }
+
+        u32 words = 0;
+        if (next_cpu != CPU_MAX_COUNT)
+        {
+            const BLogBuffer* buffer = &blog_buffers[next_cpu];
+            words = blog_record_words(buffer, positions[next_cpu]);
+            if (words > array_length(record))
+            {
+                words = array_length(record);
+            }
+
+            memcpy(record, &buffer->words[positions[next_cpu] % BLOG_BUFFER_WORDS], words * sizeof(u64));
+            positions[next_cpu] += words;
+        }
+
+        interrupts_restore(flags);
+
+        if (next_cpu == CPU_MAX_COUNT)
+        {
+            break;
+        }
+
+        sink_print(sink, "@blog %32u %64h %32h", next_cpu, record[1], (u32)record[0]);
+        for (u32 i = BLOG_RECORD_HEADER_WORDS; i < words; i++)
+        {
+            sink_print(sink, " %64h", record[i]);
+        }
+        sink->write(sink, "\n", 1);
+    }
+}
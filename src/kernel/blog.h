@@ -0,0 +1,47 @@
+#pragma once
+#include "types.h"
+#include "libk.h"
+#include "typed_print.h"
+
+// Binary log for hot paths. The format string of every call site is placed in the .blog_formats
+// section and identified by its offset there, so a call only records that offset, the TSC and its
+// arguments as raw 64-bit words into a buffer of the current CPU: nothing is formatted at runtime.
+// The blogdump command writes the records to COM1 as "@blog" lines, and tools/blog_decode.py turns
+// them back into text with the format strings read from kernel.elf.
+//
+//     blog("slab: new slab for %s at %64h", cache->name, (u64)slab);
+//
+// Format strings use the vformat() syntax. Arguments are converted to u64, which suits integers,
+// characters, booleans and pointers. %s arguments are decoded from the ELF, so they must point to
+// constant data such as string literals. %f arguments have to be passed through blog_f64().
+// At most BLOG_MAX_ARGS arguments are supported.
+
+#define BLOG_MAX_ARGS 15
+// Per CPU. Full buffers overwrite their oldest records
+#define BLOG_BUFFER_WORDS 8192
+
+static inline u64 blog_f64(f64 value)
+{
+    union { f64 f; u64 u; } bits = { .f = value };
+    return bits.u;
+}
+
+void blog_write(const char* format, const u64* args, u32 arg_count);
+void blog_dump(FormatSink* sink);
+
+#define BLOG_WORD(x) ((u64)(x))
+
+#define BLOG_EMIT(format, args, arg_count) \
+    do \
+    { \
+        static const char blog_format_[] __attribute__((section(".blog_formats"), used)) = format; \
+        blog_write(blog_format_, (args), (arg_count)); \
+    } while (0)
+
+#define BLOG_0(format) BLOG_EMIT(format, NULL, 0)
+#define BLOG_N(format, ...) BLOG_EMIT(format, ((const u64[]) { FORMAT_MAP(BLOG_WORD, __VA_ARGS__) }), \
+    sizeof((const u64[]) { FORMAT_MAP(BLOG_WORD, __VA_ARGS__) }) / sizeof(u64))
+
+#define blog(...) FORMAT_MAP_SELECT(__VA_ARGS__, \
+    BLOG_N, BLOG_N, BLOG_N, BLOG_N, BLOG_N, BLOG_N, BLOG_N, BLOG_N, \
+    BLOG_N, BLOG_N, BLOG_N, BLOG_N, BLOG_N, BLOG_N, BLOG_N, BLOG_0)(__VA_ARGS__)
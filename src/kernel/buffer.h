@@ -0,0 +1,128 @@
+#pragma once
+#include "types.h"
+#include "kmalloc.h"
+#include "libk.h"
+
+#define BUFFER_MIN_CAPACITY 8
+
+// Generates the dynamic buffer API for a struct declared with one of the GEN_BUFFER_STRUCT macros
+// (or with the same ptr/len/cap layout, like SB). Storage comes from kmalloc and grows geometrically
+#define GEN_BUFFER_FUNCTIONS(name, type) \
+    static inline bool name##_reserve(name* buffer, u32 capacity) \
+    { \
+        if (capacity <= buffer->cap) \
+        { \
+            return true; \
+        } \
+        u64 new_capacity = buffer->cap ? buffer->cap : BUFFER_MIN_CAPACITY; \
+        while (new_capacity < capacity) \
+        { \
+            new_capacity *= 2; \
+        } \
+        /* Clamped to what both len and kmalloc can represent */ \
+        u64 max_capacity = KMALLOC_MAX_SIZE / sizeof(type); \
+        if (max_capacity > UINT32_MAX) \
+        { \
+            max_capacity = UINT32_MAX; \
+        } \
+        if (capacity > max_capacity) \
+        { \
+            return false; \
+        } \
+        if (new_capacity > max_capacity) \
+        { \
+            new_capacity = max_capacity; \
+        } \
+        type* ptr = krealloc(buffer->ptr, new_capacity * sizeof(type)); \
+        if (!ptr) \
+        { \
+            return false; \
+        } \
+        buffer->ptr = ptr; \
+        buffer->cap = (u32)new_capacity; \
+        return true; \
+    } \
+    \
+    static inline bool name##_push(name* buffer, type value) \
+    { \
+        if (buffer->len == UINT32_MAX) \
+        { \
+            return false; \
+        } \
+        if (buffer->len == buffer->cap && !name##_reserve(buffer, buffer->len + 1)) \
+        { \
+            return false; \
+        } \
+        buffer->ptr[buffer->len++] = value; \
+        return true; \
+    } \
+    \
+    static inline bool name##_append(name* buffer, const type* items, u32 count) \
+    { \
+        if (count > UINT32_MAX - buffer->len) \
+        { \
+            return false; \
+        } \
+        if (!name##_reserve(buffer, buffer->len + count)) \
+        { \
+            return false; \
+        } \
+        memcpy(buffer->ptr + buffer->len, items, count * sizeof(type)); \
+        buffer->len += count; \
+        return true; \
+    } \
+    \
+    static inline void name##_clear(name* buffer) \
+    { \
+        buffer->len = 0; \
+    } \
+    \
+    static inline void name##_free(name* buffer) \
+    { \
+        kfree(buffer->ptr); \
+        buffer->ptr = NULL; \
+        buffer->len = 0; \
+        buffer->cap = 0; \
+    } \
+    \
+    static inline bool name##_shrink(name* buffer) \
+    { \
+        if (buffer->len == 0) \
+        { \
+            name##_free(buffer); \
+            return true; \
+        } \
+        type* ptr = krealloc(buffer->ptr, buffer->len * sizeof(type)); \
+        if (!ptr) \
+        { \
+            return false; \
+        } \
+        buffer->ptr = ptr; \
+        buffer->cap = buffer->len; \
+        return true; \
+    }
+
+GEN_BUFFER_FUNCTIONS(SB, char)
+
+static inline bool SB_append_string(SB* sb, const char* str)
+{
+    usize length = strlen(str);
+    if (length > UINT32_MAX)
+    {
+        return false;
+    }
+
+    return SB_append(sb, str, length);
+}
+
+// Null-terminates the contents without counting the terminator in len
+static inline const char* SB_c_str(SB* sb)
+{
+    if (sb->len == UINT32_MAX || !SB_reserve(sb, sb->len + 1))
+    {
+        return NULL;
+    }
+
+    sb->ptr[sb->len] = 0;
+    return sb->ptr;
+}
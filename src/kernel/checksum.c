@@ -0,0 +1,208 @@
+#include "checksum.h"
+#include "cpu.h"
+
+typedef u32 u32_unaligned __attribute__((aligned(1), may_alias));
+typedef u64 u64_unaligned __attribute__((aligned(1), may_alias));
+typedef char VectorBytes16 __attribute__((vector_size(16)));
+typedef char VectorBytes16_unaligned __attribute__((vector_size(16), aligned(1), may_alias));
+typedef long long Vector16 __attribute__((vector_size(16)));
+
+u8 byte_sum(const void* data, usize bytes)
+{
+    const u8* it = data;
+    const u8* end = it + bytes;
+    VectorBytes16 zero = {0};
+    Vector16 sums = {0};
+
+    // psadbw against zero adds up each 8-byte half into a 64-bit lane
+    for (; end - it >= 16; it += 16)
+    {
+        sums += (Vector16)__builtin_ia32_psadbw128(*(VectorBytes16_unaligned*)it, zero);
+    }
+
+    u64 sum = (u64)sums[0] + (u64)sums[1];
+    for (; it < end; it++)
+    {
+        sum += *it;
+    }
+
+    return (u8)sum;
+}
+
+#define CRC32C_POLYNOMIAL 0x82f63b78 // Reflected
+
+// crc32c_table[k][b] is the CRC of byte b followed by k zero bytes, so eight bytes can be folded with
+// eight independent lookups
+static u32 crc32c_table[8][256];
+
+static void crc32c_table_setup(void)
+{
+    for (u32 b = 0; b < 256; b++)
+    {
+        u32 crc = b;
+        for (u32 bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0 - (crc & 1)));
+        }
+        crc32c_table[0][b] = crc;
+    }
+
+    for (u32 b = 0; b < 256; b++)
+    {
+        for (u32 k = 1; k < 8; k++)
+        {
+            u32 previous = crc32c_table[k - 1][b];
+            crc32c_table[k][b] = (previous >> 8) ^ crc32c_table[0][previous & 0xff];
+        }
+    }
+}
+
+static u32 crc32c_slicing_by_8(u32 crc, const u8* it, usize bytes)
+{
+    for (; bytes && ((u64)it & 7); bytes--, it++)
+    {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *it) & 0xff];
+    }
+
+    for (; bytes >= 8; bytes -= 8, it += 8)
+    {
+        u32 low = *(u32*)it ^ crc;
+        u32 high = *(u32*)(it + 4);
+        crc = crc32c_table[7][low & 0xff] ^ crc32c_table[6][(low >> 8) & 0xff] ^
+              crc32c_table[5][(low >> 16) & 0xff] ^ crc32c_table[4][low >> 24] ^
+              crc32c_table[3][high & 0xff] ^ crc32c_table[2][(high >> 8) & 0xff] ^
+              crc32c_table[1][(high >> 16) & 0xff] ^ crc32c_table[0][high >> 24];
+    }
+
+    for (; bytes; bytes--, it++)
+    {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *it) & 0xff];
+    }
+
+    return crc;
+}
+
+// The SSE4.2 crc32 instruction implements exactly the Castagnoli polynomial
+static u32 crc32c_SSE4_2(u32 crc, const u8* it, usize bytes)
+{
+    u64 crc64 = crc;
+
+    for (; bytes >= 8; bytes -= 8, it += 8)
+    {
+        asm("crc32q %1, %0" : "+r"(crc64) : "rm"(*(u64_unaligned*)it));
+    }
+
+    u32 crc32 = (u32)crc64;
+    for (; bytes; bytes--, it++)
+    {
+        asm("crc32b %1, %0" : "+r"(crc32) : "rm"(*it));
+    }
+
+    return crc32;
+}
+
+typedef u32 Crc32cFn(u32 crc, const u8* it, usize bytes);
+static Crc32cFn* crc32c_kernel = crc32c_slicing_by_8;
+
+u32 crc32c(u32 crc, const void* data, usize bytes)
+{
+    return ~crc32c_kernel(~crc, data, bytes);
+}
+
+#define XXH_PRIME64_1 0x9e3779b185ebca87ULL
+#define XXH_PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define XXH_PRIME64_3 0x165667b19e3779f9ULL
+#define XXH_PRIME64_4 0x85ebca77c2b2ae63ULL
+#define XXH_PRIME64_5 0x27d4eb2f165667c5ULL
+
+static inline u64 rotate_left(u64 value, u32 bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline u64 xxhash64_round(u64 accumulator, u64 input)
+{
+    accumulator += input * XXH_PRIME64_2;
+    accumulator = rotate_left(accumulator, 31);
+    return accumulator * XXH_PRIME64_1;
+}
+
+static inline u64 xxhash64_merge_round(u64 accumulator, u64 value)
+{
+    accumulator ^= xxhash64_round(0, value);
+    return accumulator * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+u64 xxhash64(const void* data, usize bytes, u64 seed)
+{
+    const u8* it = data;
+    const u8* end = it + bytes;
+    u64 hash;
+
+    if (bytes >= 32)
+    {
+        // Four independent lanes keep several multiplies in flight
+        u64 v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        u64 v2 = seed + XXH_PRIME64_2;
+        u64 v3 = seed;
+        u64 v4 = seed - XXH_PRIME64_1;
+
+        for (; end - it >= 32; it += 32)
+        {
+            v1 = xxhash64_round(v1, *(u64_unaligned*)(it + 0));
+            v2 = xxhash64_round(v2, *(u64_unaligned*)(it + 8));
+            v3 = xxhash64_round(v3, *(u64_unaligned*)(it + 16));
+            v4 = xxhash64_round(v4, *(u64_unaligned*)(it + 24));
+        }
+
+        hash = rotate_left(v1, 1) + rotate_left(v2, 7) + rotate_left(v3, 12) + rotate_left(v4, 18);
+        hash = xxhash64_merge_round(hash, v1);
+        hash = xxhash64_merge_round(hash, v2);
+        hash = xxhash64_merge_round(hash, v3);
+        hash = xxhash64_merge_round(hash, v4);
+    }
+    else
+    {
+        hash = seed + XXH_PRIME64_5;
+    }
+
+    hash += bytes;
+
+    for (; end - it >= 8; it += 8)
+    {
+        hash ^= xxhash64_round(0, *(u64_unaligned*)it);
+        hash = rotate_left(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+
+    if (end - it >= 4)
+    {
+        hash ^= (u64)*(u32_unaligned*)it * XXH_PRIME64_1;
+        hash = rotate_left(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        it += 4;
+    }
+
+    for (; it < end; it++)
+    {
+        hash ^= *it * XXH_PRIME64_5;
+        hash = rotate_left(hash, 11) * XXH_PRIME64_1;
+    }
+
+    // Avalanche
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+void checksum_setup(void)
+{
+    crc32c_table_setup();
+
+    if (cpu_features.SSE4_2)
+    {
+        crc32c_kernel = crc32c_SSE4_2;
+    }
+}
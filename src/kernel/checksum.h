@@ -0,0 +1,13 @@
+#pragma once
+#include "types.h"
+
+void checksum_setup(void);
+
+// Sum of all bytes modulo 256, as used by ACPI and other firmware tables (valid tables sum to 0)
+u8 byte_sum(const void* data, usize bytes);
+
+// CRC-32C (Castagnoli). Pass 0 to start and the previous result to continue over more data
+u32 crc32c(u32 crc, const void* data, usize bytes);
+
+// Non-cryptographic 64-bit hash for hash tables
+u64 xxhash64(const void* data, usize bytes, u64 seed);
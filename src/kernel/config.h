@@ -1,2 +1,7 @@
 #pragma once
-#define APIC 1
\ No newline at end of file
+#define APIC 1
+// The host build (tests/) compiles the allocators both ways, so it may come from the command line
+#ifndef ALLOC_TRACE
+#define ALLOC_TRACE 0
+#endif
+#define SERIAL_BAUD 115200
@@ -0,0 +1,50 @@
+#include "cpu.h"
+#include "asm.h"
+
+enum
+{
+    IA32_GS_BASE = 0xC0000101,
+};
+
+CPU cpus[CPU_MAX_COUNT];
+u32 cpu_count = 0;
+CPUFeatures cpu_features;
+
+static void CPU_detect_features(void)
+{
+    u32 eax, ebx, ecx, edx;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    u32 max_leaf = eax;
+
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    cpu_features.SSE4_2 = (ecx >> 20) & 1;
+    cpu_features.POPCNT = (ecx >> 23) & 1;
+    cpu_features.OSXSAVE = (ecx >> 27) & 1;
+
+    // AVX is only usable if the firmware enabled the YMM state in XCR0
+    bool AVX_supported = (ecx >> 28) & 1;
+    bool YMM_enabled = cpu_features.OSXSAVE && (xgetbv(0) & 0b110) == 0b110;
+    cpu_features.AVX = AVX_supported && YMM_enabled;
+
+    if (max_leaf >= 7)
+    {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        cpu_features.AVX2 = cpu_features.AVX && ((ebx >> 5) & 1);
+        cpu_features.ERMS = (ebx >> 9) & 1;
+        cpu_features.FSRM = (edx >> 4) & 1;
+    }
+}
+
+// Must be called after GDT_setup, since reloading the GS selector clears the GS base
+void CPU_setup(void)
+{
+    CPU* bsp = &cpus[cpu_count];
+    bsp->self = bsp;
+    bsp->id = cpu_count++;
+
+#if !LIBK_HOST
+    wrmsr(IA32_GS_BASE, (u64)bsp);
+#endif
+
+    CPU_detect_features();
+}
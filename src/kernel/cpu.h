@@ -0,0 +1,58 @@
+#pragma once
+#include "types.h"
+
+// @Info: only the bootstrap processor is brought up for now, but every per-CPU
+// structure is already sized for this many
+#define CPU_MAX_COUNT 8
+#define CACHE_LINE_SIZE 64
+
+typedef struct CPU
+{
+    struct CPU* self;
+    u32 id;
+} CPU;
+
+typedef struct CPUFeatures
+{
+    bool SSE4_2;
+    bool POPCNT;
+    bool OSXSAVE;
+    bool AVX;
+    bool AVX2;
+    bool ERMS;
+    bool FSRM;
+} CPUFeatures;
+
+extern CPU cpus[CPU_MAX_COUNT];
+extern u32 cpu_count;
+extern CPUFeatures cpu_features;
+
+#if LIBK_HOST
+// Host builds (tests/) are single threaded and leave the GS base to the C library
+static inline CPU* cpu_get(void)
+{
+    return &cpus[0];
+}
+
+static inline u32 cpu_get_id(void)
+{
+    return 0;
+}
+#else
+// The GS base of every CPU points to its own CPU struct
+static inline CPU* cpu_get(void)
+{
+    CPU* cpu;
+    asm volatile("movq %%gs:%c1, %0" : "=r"(cpu) : "i"(offsetof(CPU, self)));
+    return cpu;
+}
+
+static inline u32 cpu_get_id(void)
+{
+    u32 id;
+    asm volatile("movl %%gs:%c1, %0" : "=r"(id) : "i"(offsetof(CPU, id)));
+    return id;
+}
+#endif
+
+void CPU_setup(void);
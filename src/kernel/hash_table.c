@@ -0,0 +1,206 @@
+#include "hash_table.h"
+#include "kmalloc.h"
+#include "libk.h"
+
+#define HASH_TABLE_MIN_CAPACITY 16
+#define HASH_TABLE_MAX_DISTANCE 255
+
+// Grows at 7/8 occupancy
+static inline bool hash_table_over_load(u32 count, u32 capacity)
+{
+    return (u64)count * 8 > (u64)capacity * 7;
+}
+
+void hash_table_init(HashTable* table, u32 expected_count)
+{
+    u32 capacity = HASH_TABLE_MIN_CAPACITY;
+    while (hash_table_over_load(expected_count, capacity))
+    {
+        capacity *= 2;
+    }
+
+    *table = (HashTable) { .capacity = capacity };
+}
+
+static bool hash_table_allocate(HashTable* table, u32 capacity)
+{
+    // One block: entries first, then the distance bytes
+    u8* block = kzalloc(capacity * (sizeof(HashTableEntry) + sizeof(u8)));
+    if (!block)
+    {
+        return false;
+    }
+
+    table->entries = (HashTableEntry*)block;
+    table->distances = block + capacity * sizeof(HashTableEntry);
+    table->capacity = capacity;
+    table->count = 0;
+    return true;
+}
+
+static bool hash_table_resize(HashTable* table, u32 capacity)
+{
+    HashTable old = *table;
+
+    if (!hash_table_allocate(table, capacity))
+    {
+        *table = old;
+        return false;
+    }
+
+    if (old.entries)
+    {
+        for (u32 i = 0; i < old.capacity; i++)
+        {
+            if (old.distances[i])
+            {
+                hash_table_insert(table, old.entries[i].key, old.entries[i].value);
+            }
+        }
+
+        kfree(old.entries);
+    }
+
+    return true;
+}
+
+bool hash_table_insert(HashTable* table, u64 key, u64 value)
+{
+    if (!table->entries || hash_table_over_load(table->count + 1, table->capacity))
+    {
+        u32 capacity = table->entries ? table->capacity * 2 : table->capacity;
+        if (!hash_table_resize(table, capacity ? capacity : HASH_TABLE_MIN_CAPACITY))
+        {
+            return false;
+        }
+    }
+
+    u32 mask = table->capacity - 1;
+    u32 index = hash_u64(key) & mask;
+    HashTableEntry entry = { .key = key, .value = value };
+    u32 distance = 1;
+    bool displaced = false;
+
+    for (;;)
+    {
+        u8 slot_distance = table->distances[index];
+
+        if (slot_distance == 0)
+        {
+            table->entries[index] = entry;
+            table->distances[index] = distance;
+            table->count++;
+            return true;
+        }
+
+        // Once an entry has been displaced, the one being carried cannot already be in the table
+        if (!displaced && slot_distance == distance && table->entries[index].key == key)
+        {
+            table->entries[index].value = value;
+            return true;
+        }
+
+        if (slot_distance < distance)
+        {
+            HashTableEntry tmp_entry = table->entries[index];
+            table->entries[index] = entry;
+            table->distances[index] = distance;
+            entry = tmp_entry;
+            distance = slot_distance;
+            displaced = true;
+        }
+
+        index = (index + 1) & mask;
+        distance++;
+
+        if (distance == HASH_TABLE_MAX_DISTANCE)
+        {
+            // Pathological clustering. The table is consistent at this point, so grow and place the
+            // entry that is still being carried
+            if (!hash_table_resize(table, table->capacity * 2))
+            {
+                return false;
+            }
+            return hash_table_insert(table, entry.key, entry.value);
+        }
+    }
+}
+
+static s64 hash_table_find_index(const HashTable* table, u64 key)
+{
+    if (!table->entries)
+    {
+        return -1;
+    }
+
+    u32 mask = table->capacity - 1;
+    u32 index = hash_u64(key) & mask;
+
+    // Any entry of this key would sit at most as far from home as the entries around it
+    for (u32 distance = 1; table->distances[index] >= distance; distance++)
+    {
+        if (table->distances[index] == distance && table->entries[index].key == key)
+        {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+
+    return -1;
+}
+
+bool hash_table_find(const HashTable* table, u64 key, u64* out_value)
+{
+    s64 index = hash_table_find_index(table, key);
+    if (index < 0)
+    {
+        return false;
+    }
+
+    if (out_value)
+    {
+        *out_value = table->entries[index].value;
+    }
+    return true;
+}
+
+bool hash_table_remove(HashTable* table, u64 key)
+{
+    s64 found = hash_table_find_index(table, key);
+    if (found < 0)
+    {
+        return false;
+    }
+
+    u32 mask = table->capacity - 1;
+    u32 index = (u32)found;
+    u32 next = (index + 1) & mask;
+
+    // Backward shift: pull displaced followers one slot closer to home
+    while (table->distances[next] > 1)
+    {
+        table->entries[index] = table->entries[next];
+        table->distances[index] = table->distances[next] - 1;
+        index = next;
+        next = (next + 1) & mask;
+    }
+
+    table->distances[index] = 0;
+    table->count--;
+    return true;
+}
+
+void hash_table_clear(HashTable* table)
+{
+    if (table->entries)
+    {
+        memset(table->distances, 0, table->capacity);
+        table->count = 0;
+    }
+}
+
+void hash_table_free(HashTable* table)
+{
+    kfree(table->entries);
+    *table = (HashTable) { .capacity = HASH_TABLE_MIN_CAPACITY };
+}
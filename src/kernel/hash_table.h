@@ -0,0 +1,45 @@
+#pragma once
+#include "types.h"
+
+// Open-addressing u64 -> u64 map with Robin Hood probing: an insert takes the slot of any entry that
+// sits closer to its home slot than the new one would, which keeps probe lengths short and uniform
+// and lets lookups stop early. Probe distances are kept in a separate byte array, so a probe
+// sequence usually touches one cache line of metadata. Removal shifts the following entries back
+// instead of leaving tombstones.
+//
+// String or structure keys should be hashed with xxhash64() (checksum.h) and stored by hash.
+
+typedef struct HashTableEntry
+{
+    u64 key;
+    u64 value;
+} HashTableEntry;
+
+typedef struct HashTable
+{
+    HashTableEntry* entries;
+    // 0 for an empty slot, otherwise the distance from the entry's home slot plus one
+    u8* distances;
+    u32 capacity;
+    u32 count;
+} HashTable;
+
+// Finalizer from MurmurHash3: spreads every key bit over the whole word
+static inline u64 hash_u64(u64 key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// Storage is allocated on the first insert, sized so that expected_count entries fit without growing
+void hash_table_init(HashTable* table, u32 expected_count);
+// Inserts or updates. Fails only if the table cannot grow
+bool hash_table_insert(HashTable* table, u64 key, u64 value);
+bool hash_table_find(const HashTable* table, u64 key, u64* out_value);
+bool hash_table_remove(HashTable* table, u64 key);
+void hash_table_clear(HashTable* table);
+void hash_table_free(HashTable* table);
@@ -3,6 +3,11 @@
 #include "asm.h"
 #include "libk.h"
 #include "panic.h"
+#include "bitset.h"
+#include "queue.h"
+#include "rcu.h"
+#include "spinlock.h"
+#include "serial.h"
 
 extern void clear_char(void);
 extern void* request_page(void);
@@ -103,13 +108,18 @@ enum
     IDT_TA_TrapGate = 0b10001111,
 };
 
-typedef void InterruptHandler(InterruptStack* is);
+// Read by the assembly stubs with a single load, which makes every dispatch an RCU reader:
+// handlers run with interrupts disabled and are over before the CPU reaches its idle loop again.
+// Only change entries through interrupt_handler_set
 InterruptHandler* ISR[256];
+// Serializes updates of ISR
+static Spinlock ISR_lock = SPINLOCK_INIT;
 void ISR_double_fault_handler(InterruptStack* stack);
 void ISR_general_protection_fault_handler(InterruptStack* stack);
 void ISR_page_fault_handler(InterruptStack* stack);
 void ISR_keyboard_handler(InterruptStack* stack);
 void ISR_mouse_handler(InterruptStack* stack);
+void ISR_serial_handler(InterruptStack* stack);
 
 static volatile const u64 IA32_APIC_base = 0x1b;
 u64 LAPIC_address = 0;
@@ -170,38 +180,9 @@ void PIC_end_master(void);
 void PIC_end_slave(void);
 void PIC_remap(void);
 
-typedef struct KeyboardBitmap
-{
-    u64 values;
-} KeyboardBitmap;
-
-static KeyboardBitmap keymap = {0};
-
-static inline bool KeyboardBitmap_get_value(KeyboardBitmap keymap, u64 index)
-{
-    if (index < 64)
-    {
-        return (keymap.values & index) >> index;
-    }
-
-    println("Wrong value for key: %64u", index);
-    loop_forever();
-    return false;
-}
-
-static inline void KeyboardBitmap_set_value(KeyboardBitmap* keymap, u64 index, bool enabled)
-{
-    if (index < 64)
-    {
-        u64 bit_mask = (u64)1 << index;
-        keymap->values &= ~bit_mask;
-        keymap->values |= bit_mask * enabled;
-    }
-
-    /*print("Wrong value for key: ");*/
-    /*println(unsigned_to_string(index));*/
-    /*loop_forever();*/
-}
+// One bit per scancode. Only the inline accessors are used here, which need no SSE
+static u64 keymap_words[BITSET_WORDS(256)];
+static BitSet keymap = { .words = keymap_words, .bit_count = 256 };
 
 void ISR_page_fault_handler(struct InterruptStack* stack)
 {
@@ -230,28 +211,30 @@ static void key_release(u8 scancode);
 static void key_press(u8 scancode);
 
 
-KeyboardBuffer kb_buffer;
-u16 kb_event_count;
-bool overflow = false;
+// The keyboard ISR is the only producer and kb_input_process() the only consumer. Zero-initialized
+// storage is a valid empty queue
+GEN_SPSC_QUEUE(KeyboardQueue, u8, 256)
+static KeyboardQueue kb_queue;
+static volatile bool kb_overflow = false;
 
-bool kb_get_buffer(KeyboardBuffer* out_kb_buffer, u16* out_kb_event_count)
+bool kb_pop_scancode(u8* out_scancode)
 {
-    *out_kb_buffer = kb_buffer;
-    *out_kb_event_count = kb_event_count;
-    kb_buffer = (const KeyboardBuffer){0};
-    kb_event_count = 0;
-    return overflow;
+    return KeyboardQueue_pop(&kb_queue, out_scancode);
+}
+
+bool kb_overflowed(void)
+{
+    return kb_overflow;
 }
 
 void ISR_keyboard_handler(struct InterruptStack* stack)
 {
     u8 scancode = inb(PS2_KEYBOARD_PORT);
 
-    if (kb_event_count == UINT8_MAX)
+    if (!KeyboardQueue_push(&kb_queue, scancode))
     {
-        overflow = true;
+        kb_overflow = true;
     }
-    kb_buffer.messages[kb_event_count++] = scancode;
 
     PIC_end_master();
 }
@@ -290,6 +273,13 @@ void PS2_mouse_handle(u8 data)
     }
 }
 
+void ISR_serial_handler(struct InterruptStack* stack)
+{
+    serial_interrupt();
+
+    PIC_end_master();
+}
+
 void ISR_mouse_handler(struct InterruptStack* stack)
 {
     u8 mouse_data = inb(0x60);
@@ -312,17 +302,17 @@ char translate_scancode(u8 scancode, bool uppercase)
 
 static void key_press(u8 scancode)
 {
-    KeyboardBitmap_set_value(&keymap, scancode, true);
+    bitset_set(&keymap, scancode);
 }
 
 static void key_release(u8 scancode)
 {
-    KeyboardBitmap_set_value(&keymap, scancode, false);
+    bitset_clear(&keymap, scancode);
 }
 
 bool is_key_pressed(u8 scancode)
 {
-    return KeyboardBitmap_get_value(keymap, scancode);
+    return bitset_test(&keymap, scancode);
 }
 
 void PIC_end_master(void)
@@ -336,9 +326,10 @@ void PIC_end_slave(void)
     outb(PIC1_COMMAND, PIC_EOI);
 }
 
+// Leaves the keyboard (IRQ 1), the cascade (IRQ 2) and COM1 (IRQ 4) unmasked
 void PIC_mask(void)
 {
-    outb(PIC1_DATA, 0xf9);
+    outb(PIC1_DATA, 0xe9);
     outb(PIC2_DATA, 0xff);
 }
 
@@ -604,13 +595,15 @@ void interrupts_setup(void)
     IDT_gate_new(13, IDT_TA_TrapGate, isr13); // GP fault
     IDT_gate_new(14, IDT_TA_TrapGate, isr14); // page fault
     IDT_gate_new(33, IDT_TA_InterruptGate, isr33); // keyboard interrupt
+    IDT_gate_new(36, IDT_TA_InterruptGate, isr36); // COM1 interrupt
     //IDT_gate_new(44, IDT_TA_InterruptGate, isr44); // mouse interrupt
 
-    ISR[8] = ISR_double_fault_handler;
-    ISR[13] = ISR_general_protection_fault_handler;
-    ISR[14] = ISR_page_fault_handler;
-    ISR[33] = ISR_keyboard_handler;
-    //ISR[44] = ISR_mouse_handler;
+    interrupt_handler_set(8, ISR_double_fault_handler);
+    interrupt_handler_set(13, ISR_general_protection_fault_handler);
+    interrupt_handler_set(14, ISR_page_fault_handler);
+    interrupt_handler_set(33, ISR_keyboard_handler);
+    interrupt_handler_set(36, ISR_serial_handler);
+    //interrupt_handler_set(44, ISR_mouse_handler);
 
 #if APIC == 0
     PIC_remap();
@@ -620,6 +613,23 @@ void interrupts_setup(void)
     interrupts_enable();
 }
 
+// Returns the previous handler once no CPU can be running it anymore, so the caller may tear down
+// whatever it used. Must not be called from an interrupt handler
+InterruptHandler* interrupt_handler_set(u8 vector, InterruptHandler* handler)
+{
+    u64 flags = spin_lock_irqsave(&ISR_lock);
+    InterruptHandler* old_handler = ISR[vector];
+    rcu_assign_pointer(ISR[vector], handler);
+    spin_unlock_irqrestore(&ISR_lock, flags);
+
+    if (old_handler)
+    {
+        synchronize_rcu();
+    }
+
+    return old_handler;
+}
+
 void PIC_mask_IRQ(u8 IRQ)
 {
     u16 port;
@@ -81,22 +81,21 @@ typedef enum QWERTY_ES_ASCII_Table_Index
     Key_Space = 57,
 } QWERTY_ES_ASCII_Table_Index;
 
-typedef struct KeyboardBuffer
-{
-    u8 messages[256];
-} KeyboardBuffer;
-
 struct InterruptFrame;
+typedef struct InterruptStack InterruptStack;
+typedef void InterruptHandler(InterruptStack* stack);
 extern u8 mouse_cycle;
 extern u8 mouse_packet[4];
 extern bool mouse_packet_ready;
 
 void PIC_remap(void);
 void PS2_mouse_init(void);
-bool kb_get_buffer(KeyboardBuffer* out_kb_buffer, u16* out_kb_event_count);
+bool kb_pop_scancode(u8* out_scancode);
+bool kb_overflowed(void);
 char translate_scancode(u8 scancode, bool uppercase);
 
 void interrupts_setup(void);
+InterruptHandler* interrupt_handler_set(u8 vector, InterruptHandler* handler);
 void PS2_mouse_init(void);
 void GDT_setup(void);
 void APIC_setup(void);
\ No newline at end of file
@@ -7,6 +7,23 @@
 #include "interrupts.h"
 #include "keyboard.h"
 #include "mouse.h"
+#include "memory_internal.h"
+#include "cpu.h"
+#include "slab.h"
+#include "kmalloc.h"
+#include "arena.h"
+#include "alloc_trace.h"
+#include "serial.h"
+#include "typed_print.h"
+#include "checksum.h"
+#include "radix_tree.h"
+#include "bitset.h"
+#include "spinlock.h"
+#include "rcu.h"
+#include "percpu_counter.h"
+#include "klog.h"
+#include "blog.h"
+#include "panic.h"
 
 bool allow_keyboard_input = true;
 
@@ -71,12 +88,6 @@ const char* EFI_memory_type_strings[] =
     "EfiPalCode",
 };
 
-typedef struct BitMap
-{
-    usize size;
-    u8* buffer;
-} BitMap;
-
 typedef enum PDEBit
 {
     PDEBit_Present = 0,
@@ -113,12 +124,13 @@ typedef struct PACKED TerminalCommandBuffer
     s16 char_count;
 } TerminalCommandBuffer;
 
-typedef char CommandArg[96];
-
+// Everything a command points to lives in the command arena, which is reset after every command
 typedef struct Command
 {
-    CommandArg name;
-    CommandArg args[9];
+    char* name;
+    char** args;
+    u32 arg_count;
+    Arena* arena;
 } Command;
 
 
@@ -132,6 +144,15 @@ typedef struct KernelCommand
     u8 max_args;
 } KernelCommand;
 
+// Published through kernel_command_table and never modified afterwards: registering a command
+// builds a new copy and the old one is freed once no dispatch can still be walking it
+typedef struct KernelCommandTable
+{
+    RCUHead rcu;
+    u32 count;
+    KernelCommand commands[];
+} KernelCommandTable;
+
 
 extern u64 _KernelStart;
 extern u64 _KernelEnd;
@@ -143,20 +164,30 @@ static u64 kernel_page_count;
 
 
 static PageTable* PML4; 
-static BitMap page_map;
-static u64 free_memory;
-static u64 reserved_memory;
-static u64 used_memory;
+static BitSet page_map;
+// Guards page_map and last_page_map_index. Frames are released from interrupt context too
+// (slab frees), so it is always taken with interrupts disabled
+static Spinlock page_map_lock = SPINLOCK_INIT;
+// Statistics only, so they are kept per CPU and read without taking page_map_lock
+static PerCPUCounter free_memory;
+static PerCPUCounter reserved_memory;
+static PerCPUCounter used_memory;
 static u64 last_page_map_index = 0;
 
 
 static TerminalCommandBuffer cmd_buffer[8];
 static u8 current_command = 0;
+static Arena command_arena;
 
 
 void cmd_memdump(Command* cmd);
 void cmd_ls(Command* cmd);
-static const KernelCommand kernel_commands[] =
+void cmd_slabinfo(Command* cmd);
+void cmd_allocstat(Command* cmd);
+void cmd_membench(Command* cmd);
+void cmd_dmesg(Command* cmd);
+void cmd_blogdump(Command* cmd);
+static const KernelCommand builtin_commands[] =
 {
     [0] =
     {
@@ -172,7 +203,44 @@ static const KernelCommand kernel_commands[] =
         .min_args = 0,
         .max_args = 255,
     },
+    [2] =
+    {
+        .name = "slabinfo",
+        .dispatcher = cmd_slabinfo,
+        .min_args = 0,
+        .max_args = 0,
+    },
+    [3] =
+    {
+        .name = "allocstat",
+        .dispatcher = cmd_allocstat,
+        .min_args = 0,
+        .max_args = 1,
+    },
+    [4] =
+    {
+        .name = "membench",
+        .dispatcher = cmd_membench,
+        .min_args = 0,
+        .max_args = 0,
+    },
+    [5] =
+    {
+        .name = "dmesg",
+        .dispatcher = cmd_dmesg,
+        .min_args = 0,
+        .max_args = 0,
+    },
+    [6] =
+    {
+        .name = "blogdump",
+        .dispatcher = cmd_blogdump,
+        .min_args = 0,
+        .max_args = 0,
+    },
 };
+static KernelCommandTable* kernel_command_table;
+static Spinlock kernel_command_lock = SPINLOCK_INIT;
 
 
 
@@ -210,40 +278,6 @@ void PDE_set_address(PageDirectoryEntry* PDE, u64 address)
     *PDE |= address << 12;
 }
 
-u8 get_bit(BitMap bm, u64 index)
-{
-    if (index > bm.size * 8)
-    {
-        return 0;
-    }
-
-    u64 byte_index = index / 8;
-    u8 bit_index = index % 8;
-    u8 bit_indexer = 0b10000000 >> bit_index;
-    
-    return (bm.buffer[byte_index] & bit_indexer) > 0;
-}
-
-bool set_bit(BitMap bm, u64 index, bool value)
-{
-    if (index > bm.size * 8)
-    {
-        return false;
-    }
-
-    u64 byte_index = index / 8;
-    u8 bit_index = index % 8;
-    u8 bit_indexer = 0b10000000 >> bit_index;
-
-    bm.buffer[byte_index] &= ~bit_indexer;
-    if (value)
-    {
-        bm.buffer[byte_index] |= bit_indexer;
-    }
-
-    return true;
-}
-
 static inline EfiMemoryDescriptor* get_descriptor(EFIMmap mmap, u64 index)
 {
     EfiMemoryDescriptor* descriptor = (EfiMemoryDescriptor*)((u64)mmap.handle + (index * mmap.descriptor_size));
@@ -269,132 +303,216 @@ u64 get_memory_size(EFIMmap mmap)
     return memory_size_bytes;
 }
 
-void BitMap_init(usize bitmap_size, void* buffer_address)
-{
-    page_map.size = bitmap_size;
-    page_map.buffer = (u8*)buffer_address;
-    memset(page_map.buffer, 0, bitmap_size);
-}
-
-void free_page(void* address)
+static void page_release(void* address)
 {
     u64 index = (u64)address / 4096;
 
-    if (get_bit(page_map, index))
+    if (bitset_test(&page_map, index))
     {
-        if (set_bit(page_map, index, false))
+        bitset_clear(&page_map, index);
+        percpu_counter_add(&free_memory, 4096);
+        percpu_counter_sub(&used_memory, 4096);
+        if (last_page_map_index > index)
         {
-            free_memory += 4096;
-            used_memory -= 4096;
-            if (last_page_map_index > index)
-            {
-                last_page_map_index = index;
-            }
+            last_page_map_index = index;
         }
     }
 }
 
-void free_pages(void* address, u64 page_count)
+void free_page_internal(void* address)
+{
+    u64 flags = spin_lock_irqsave(&page_map_lock);
+    page_release(address);
+    spin_unlock_irqrestore(&page_map_lock, flags);
+}
+
+void free_pages_internal(void* address, u64 page_count)
 {
+    u64 flags = spin_lock_irqsave(&page_map_lock);
     for (u64 i = 0; i < page_count; i++)
     {
         void* page = (void*) ((u64)address + (i * 4096));
-        free_page(page);
+        page_release(page);
     }
+    spin_unlock_irqrestore(&page_map_lock, flags);
 }
 
-void lock_page(void* address)
+void free_page(void* address)
+{
+    alloc_trace_free(address);
+    free_page_internal(address);
+}
+
+void free_pages(void* address, u64 page_count)
+{
+    alloc_trace_free(address);
+    free_pages_internal(address, page_count);
+}
+
+static void page_acquire(void* address)
 {
     u64 index = (u64)address / 4096;
 
-    if (!get_bit(page_map, index))
+    if (index < page_map.bit_count && !bitset_test(&page_map, index))
     {
-        if (set_bit(page_map, index, true))
-        {
-            free_memory -= 4096;
-            used_memory += 4096;
-        }
+        bitset_set(&page_map, index);
+        percpu_counter_sub(&free_memory, 4096);
+        percpu_counter_add(&used_memory, 4096);
     }
 }
 
-void lock_pages(void* address, u64 page_count)
+static void page_run_acquire(void* address, u64 page_count)
 {
     for (u64 i = 0; i < page_count; i++)
     {
         void* page = (void*) ((u64)address + (i * 4096));
-        lock_page(page);
+        page_acquire(page);
     }
 }
 
-void reserve_page(void* address)
+void lock_page(void* address)
+{
+    u64 flags = spin_lock_irqsave(&page_map_lock);
+    page_acquire(address);
+    spin_unlock_irqrestore(&page_map_lock, flags);
+}
+
+void lock_pages(void* address, u64 page_count)
+{
+    u64 flags = spin_lock_irqsave(&page_map_lock);
+    page_run_acquire(address, page_count);
+    spin_unlock_irqrestore(&page_map_lock, flags);
+}
+
+static void page_reserve(void* address)
 {
     u64 index = (u64)address / 4096;
 
-    if (!get_bit(page_map, index))
+    if (index < page_map.bit_count && !bitset_test(&page_map, index))
     {
-        if (set_bit(page_map, index, true))
-        {
-            free_memory -= 4096;
-            reserved_memory += 4096;
-        }
+        bitset_set(&page_map, index);
+        percpu_counter_sub(&free_memory, 4096);
+        percpu_counter_add(&reserved_memory, 4096);
     }
 }
 
+void reserve_page(void* address)
+{
+    u64 flags = spin_lock_irqsave(&page_map_lock);
+    page_reserve(address);
+    spin_unlock_irqrestore(&page_map_lock, flags);
+}
+
 void reserve_pages(void* address, u64 page_count)
 {
+    u64 flags = spin_lock_irqsave(&page_map_lock);
     for (u64 i = 0; i < page_count; i++)
     {
         void* page = (void*) ((u64)address + (i * 4096));
-        reserve_page(page);
+        page_reserve(page);
     }
+    spin_unlock_irqrestore(&page_map_lock, flags);
 }
 
-void unreserve_page(void* address)
+static void page_unreserve(void* address)
 {
     u64 index = (u64)address / 4096;
 
-    if (get_bit(page_map, index))
+    if (bitset_test(&page_map, index))
     {
-        if (set_bit(page_map, index, false))
+        bitset_clear(&page_map, index);
+        percpu_counter_add(&free_memory, 4096);
+        percpu_counter_sub(&reserved_memory, 4096);
+        if (last_page_map_index > index)
         {
-            free_memory += 4096;
-            reserved_memory -= 4096;
-            if (last_page_map_index > index)
-            {
-                last_page_map_index = index;
-            }
+            last_page_map_index = index;
         }
     }
 }
 
+void unreserve_page(void* address)
+{
+    u64 flags = spin_lock_irqsave(&page_map_lock);
+    page_unreserve(address);
+    spin_unlock_irqrestore(&page_map_lock, flags);
+}
+
 void unreserve_pages(void* address, u64 page_count)
 {
+    u64 flags = spin_lock_irqsave(&page_map_lock);
     for (u64 i = 0; i < page_count; i++)
     {
         void* page = (void*) ((u64)address + (i * 4096));
-        unreserve_page(page);
+        page_unreserve(page);
     }
+    spin_unlock_irqrestore(&page_map_lock, flags);
 }
 
-void* request_page(void)
+static void* page_find(void)
 {
-    u64 count = page_map.size * 8;
+    last_page_map_index = bitset_find_first_zero(&page_map, last_page_map_index);
 
-    while (last_page_map_index < count)
+    if (last_page_map_index < page_map.bit_count)
     {
-        if (!get_bit(page_map, last_page_map_index))
-        {
-            void* page = (void*)(last_page_map_index * 4096);
-            lock_page(page);
-            return page;
-        }
-        last_page_map_index++;
+        void* page = (void*)(last_page_map_index * 4096);
+        page_acquire(page);
+        return page;
     }
 
     // @TODO: page frame swap to file
     return NULL;
 }
 
+// Physically contiguous pages. Everything is identity mapped, so the run is contiguous in virtual memory too
+static void* page_run_find(u64 page_count)
+{
+    if (page_count == 1)
+    {
+        return page_find();
+    }
+
+    u64 run_start = bitset_find_zero_run(&page_map, last_page_map_index, page_count);
+
+    if (run_start < page_map.bit_count)
+    {
+        void* pages = (void*)(run_start * 4096);
+        page_run_acquire(pages, page_count);
+        return pages;
+    }
+
+    return NULL;
+}
+
+void* request_page_internal(void)
+{
+    u64 flags = spin_lock_irqsave(&page_map_lock);
+    void* page = page_find();
+    spin_unlock_irqrestore(&page_map_lock, flags);
+    return page;
+}
+
+void* request_pages_internal(u64 page_count)
+{
+    u64 flags = spin_lock_irqsave(&page_map_lock);
+    void* pages = page_run_find(page_count);
+    spin_unlock_irqrestore(&page_map_lock, flags);
+    return pages;
+}
+
+void* request_page(void)
+{
+    void* page = request_page_internal();
+    alloc_trace_alloc(AllocTraceKind_Page, page, 4096);
+    return page;
+}
+
+void* request_pages(u64 page_count)
+{
+    void* pages = request_pages_internal(page_count);
+    alloc_trace_alloc(AllocTraceKind_Page, pages, page_count * 4096);
+    return pages;
+}
+
 void read_EFI_mmap(EFIMmap mmap)
 {
     u64 mmap_entries = mmap.size / mmap.descriptor_size;
@@ -416,13 +534,15 @@ void read_EFI_mmap(EFIMmap mmap)
     }
 
     u64 memory_size = get_memory_size(mmap);
-    free_memory = memory_size;
+    percpu_counter_init(&free_memory, memory_size);
+    percpu_counter_init(&used_memory, 0);
+    percpu_counter_init(&reserved_memory, 0);
 
-    u64 bitmap_size = memory_size / 4096 / 8 + 1;
+    u64 page_count = memory_size / 4096;
 
-    BitMap_init(bitmap_size, largest_free_memory_segment);
+    bitset_init(&page_map, largest_free_memory_segment, page_count);
 
-    lock_pages(page_map.buffer, page_map.size / 4096 + 1);
+    lock_pages(page_map.words, BITSET_BYTES(page_count) / 4096 + 1);
 
     for (u32 i = 0; i < mmap_entries; i++)
     {
@@ -436,25 +556,25 @@ void read_EFI_mmap(EFIMmap mmap)
 
 u64 get_free_RAM(void)
 {
-    return free_memory;
+    return percpu_counter_sum(&free_memory);
 }
 u64 get_used_RAM(void)
 {
-    return used_memory;
+    return percpu_counter_sum(&used_memory);
 }
 u64 get_reserved_RAM(void)
 {
-    return reserved_memory;
+    return percpu_counter_sum(&reserved_memory);
 }
 
 void print_memory_usage(void)
 {
-    println("Free RAM: %64u KB", get_free_RAM() / 1024);
-    println("Used RAM: %64u KB", get_used_RAM() / 1024);
-    println("Reserved RAM: %64u KB", get_reserved_RAM() / 1024);
-    println("Kernel start address: %64h", _KernelStart);
-    println("Kernel end address:   %64h", _KernelEnd);
-    println("Kernel size: %64u KB", kernel_size / 1024);
+    tprintln("Free RAM: ", get_free_RAM() / 1024, " KB");
+    tprintln("Used RAM: ", get_used_RAM() / 1024, " KB");
+    tprintln("Reserved RAM: ", get_reserved_RAM() / 1024, " KB");
+    tprintln("Kernel start address: ", fmt_hex(_KernelStart));
+    tprintln("Kernel end address:   ", fmt_hex(_KernelEnd));
+    tprintln("Kernel size: ", kernel_size / 1024, " KB");
 }
 
 void memmap(void* virtual_memory, void* physical_memory)
@@ -563,6 +683,7 @@ void memory_setup(BootInfo boot_info)
 }
 
 void reset_terminal(void);
+void kernel_commands_setup(void);
 
 void kernel_init(BootInfo boot_info)
 {
@@ -575,10 +696,29 @@ void kernel_init(BootInfo boot_info)
         .cursor_position = { .x = 0, .y = 0, },
     };
 
+    // The page allocator keeps per-CPU statistics, so the GS base must be set up before memory_setup
+    GDT_setup();
+    CPU_setup();
+    // Log records go to the ring of the current CPU, so this needs the GS base too
+    klog_setup();
+
     memory_setup(boot_info);
+    // Needs the page allocator for the back buffer
+    renderer_setup();
     fb_clear();
 
-    GDT_setup();
+    libk_setup(&cpu_features);
+    checksum_setup();
+    serial_setup();
+    klog_sink_register(&serial_sink);
+#if ALLOC_TRACE
+    alloc_trace_setup();
+#endif
+    slab_setup();
+    kmalloc_setup();
+    radix_tree_setup();
+    arena_init(&command_arena, KILOBYTE(16));
+    kernel_commands_setup();
     interrupts_setup();
 
 #if APIC
@@ -592,6 +732,10 @@ void kernel_init(BootInfo boot_info)
     print_memory_usage();
 
     reset_terminal();
+
+    // Everything logged during setup reaches the screen now, not only once the idle loop first runs
+    klog_flush();
+    renderer_flush();
 }
 
 void reset_terminal(void)
@@ -611,37 +755,96 @@ void reset_terminal(void)
         cmd_buffer[current_command].char_count = 0;
     }
 
-    new_line();
+    print("\n");
     allow_keyboard_input = true;
     print("> ");
 }
 
-Command parse_command(char* raw_buffer)
+static bool command_is_blank(const char* raw_buffer, usize length)
 {
-    Command cmd = {0};
-    char* it = raw_buffer;
-
-    while (*it && *it != ' ')
+    for (usize i = 0; i < length; i++)
     {
-        cmd.name[it - raw_buffer] = *it;
-        it++;
+        if (raw_buffer[i] != ' ')
+        {
+            return false;
+        }
     }
-    cmd.name[it - raw_buffer] = 0;
 
-    for (u32 i = 0; *it; i++)
+    return true;
+}
+
+// Returns NULL for a blank line, and when the arena cannot hold the parsed command
+Command* parse_command(Arena* arena, const char* raw_buffer, usize length)
+{
+    const char* end = raw_buffer + length;
+    u32 token_count = 0;
+
+    for (const char* it = raw_buffer; it < end; token_count++)
     {
         // Skip spaces
-        while (*it && *it == ' ')
+        while (it < end && *it == ' ')
         {
             it++;
         }
 
-        u32 c;
-        for (c = 0; *it && *it != ' '; c++, it++)
+        if (it == end)
+        {
+            break;
+        }
+
+        while (it < end && *it != ' ')
         {
-            cmd.args[i][c] = *it;
+            it++;
+        }
+    }
+
+    if (token_count == 0)
+    {
+        return NULL;
+    }
+
+    Command* cmd = arena_alloc(arena, sizeof(Command));
+    if (!cmd)
+    {
+        return NULL;
+    }
+
+    *cmd = (const Command) { .arena = arena };
+    cmd->args = arena_alloc(arena, token_count * sizeof(char*));
+    if (!cmd->args)
+    {
+        return NULL;
+    }
+
+    const char* it = raw_buffer;
+
+    for (u32 i = 0; i < token_count; i++)
+    {
+        while (*it == ' ')
+        {
+            it++;
+        }
+
+        const char* token = it;
+        while (it < end && *it != ' ')
+        {
+            it++;
+        }
+
+        char* token_copy = arena_strndup(arena, token, it - token);
+        if (!token_copy)
+        {
+            return NULL;
+        }
+
+        if (i == 0)
+        {
+            cmd->name = token_copy;
+        }
+        else
+        {
+            cmd->args[cmd->arg_count++] = token_copy;
         }
-        cmd.args[i][c] = 0;
     }
 
     return cmd;
@@ -654,6 +857,103 @@ void cmd_ls(Command* cmd)
     println("Filesystem is not implemented yet");
 }
 
+void cmd_slabinfo(Command* cmd)
+{
+    kmem_cache_print_stats();
+}
+
+// allocstat [bytes|calls|rate|live]
+void cmd_allocstat(Command* cmd)
+{
+#if ALLOC_TRACE
+    AllocTraceSortKey key = AllocTraceSortKey_Bytes;
+    if (cmd->arg_count)
+    {
+        if (string_eq(cmd->args[0], "calls"))
+        {
+            key = AllocTraceSortKey_Calls;
+        }
+        else if (string_eq(cmd->args[0], "rate"))
+        {
+            key = AllocTraceSortKey_Rate;
+        }
+        else if (string_eq(cmd->args[0], "live"))
+        {
+            key = AllocTraceSortKey_Live;
+        }
+        else if (!string_eq(cmd->args[0], "bytes"))
+        {
+            println("Wrong usage");
+            return;
+        }
+    }
+
+    alloc_trace_print(cmd->arena, key, 16);
+#else
+    println("Allocation tracing is disabled. Set ALLOC_TRACE in config.h to enable it");
+#endif
+}
+
+// Prints the bytes per TSC cycle of memcpy and memset from 8 B to 8 MiB
+void cmd_membench(Command* cmd)
+{
+    usize max_size = MEGABYTE(8);
+    u8* src = kmalloc(max_size);
+    u8* dst = kmalloc(max_size);
+    if (!src || !dst)
+    {
+        println("Not enough memory to run the benchmark");
+        kfree(src);
+        kfree(dst);
+        return;
+    }
+
+    memset(src, 0xab, max_size);
+    memset(dst, 0, max_size);
+
+    println("Vector kernels: %s. ERMS: %b. FSRM: %b", cpu_features.AVX2 ? "AVX2" : "SSE2", cpu_features.ERMS, cpu_features.FSRM);
+    println("Size (bytes) | memcpy (bytes/cycle) | memset (bytes/cycle)");
+
+    for (usize size = 8; size <= max_size; size *= 2)
+    {
+        u64 iteration_count = MEGABYTE(16) / size;
+
+        u64 start = rdtsc();
+        for (u64 i = 0; i < iteration_count; i++)
+        {
+            memcpy(dst, src, size);
+        }
+        u64 memcpy_cycles = rdtsc() - start;
+
+        start = rdtsc();
+        for (u64 i = 0; i < iteration_count; i++)
+        {
+            memset(dst, (u8)i, size);
+        }
+        u64 memset_cycles = rdtsc() - start;
+
+        f64 total_bytes = (f64)(size * iteration_count);
+        tprintln(size, " | ", fmt_precision(total_bytes / memcpy_cycles, 2), " | ", fmt_precision(total_bytes / memset_cycles, 2));
+    }
+
+    kfree(src);
+    kfree(dst);
+}
+
+void cmd_dmesg(Command* cmd)
+{
+    // Written straight to the framebuffer: going through the log would append to what is being replayed
+    klog_flush();
+    klog_replay(&framebuffer_sink);
+}
+
+// The records only make sense together with kernel.elf, so they go to COM1 for tools/blog_decode.py
+void cmd_blogdump(Command* cmd)
+{
+    blog_dump(&serial_sink);
+    println("Binary log written to COM1");
+}
+
 void cmd_memdump(Command* cmd)
 {
     u64 mem = string_to_unsigned(cmd->args[0]);
@@ -672,33 +972,121 @@ void cmd_memdump(Command* cmd)
     {
         u8* ptr = it + i;
 
-        print("%64h: %8h", (u64)ptr, *ptr);
+        tprint(fmt_hex((u64)ptr), ": ", fmt_hex(*ptr));
 
         bool end_of_line = ((i > 0 && i % divide_every == 0) || i == bytes - 1);
         if (end_of_line)
         {
-            new_line();
+            print("\n");
         }
         else
         {
-            print(" | ");
+            tprint(" | ");
         }
     }
 }
 
-void process_command(void)
+static void kernel_command_table_free(RCUHead* head)
 {
-    Command cmd = parse_command(cmd_buffer[current_command].characters);
-    for (u32 i = 0; i < array_length(kernel_commands); i++)
+    kfree(container_of(head, KernelCommandTable, rcu));
+}
+
+// Adds a command or replaces the one with the same name
+bool kernel_command_register(const KernelCommand* command)
+{
+    u64 flags = spin_lock_irqsave(&kernel_command_lock);
+
+    KernelCommandTable* old_table = kernel_command_table;
+    u32 old_count = old_table ? old_table->count : 0;
+
+    KernelCommandTable* table = kmalloc(sizeof(KernelCommandTable) + (old_count + 1) * sizeof(KernelCommand));
+    if (!table)
     {
-        if (string_eq(kernel_commands[i].name, cmd.name))
+        spin_unlock_irqrestore(&kernel_command_lock, flags);
+        return false;
+    }
+
+    table->count = 0;
+    for (u32 i = 0; i < old_count; i++)
+    {
+        if (!string_eq(old_table->commands[i].name, command->name))
         {
-            kernel_commands[i].dispatcher(&cmd);
-            return;
+            table->commands[table->count++] = old_table->commands[i];
         }
     }
+    table->commands[table->count++] = *command;
+
+    rcu_assign_pointer(kernel_command_table, table);
+
+    spin_unlock_irqrestore(&kernel_command_lock, flags);
+
+    if (old_table)
+    {
+        call_rcu(&old_table->rcu, kernel_command_table_free);
+    }
 
-    println("Unknown command");
+    return true;
+}
+
+void kernel_commands_setup(void)
+{
+    for (u32 i = 0; i < array_length(builtin_commands); i++)
+    {
+        if (!kernel_command_register(&builtin_commands[i]))
+        {
+            panic("Failed to register command %s", builtin_commands[i].name);
+        }
+    }
+}
+
+void dispatch_command(Command* cmd)
+{
+    // The entry is copied out so the command itself runs outside of the read-side section
+    // and is free to wait for a grace period
+    KernelCommand kernel_command = {0};
+
+    rcu_read_lock();
+    KernelCommandTable* table = rcu_dereference(kernel_command_table);
+    for (u32 i = 0; table && i < table->count; i++)
+    {
+        if (string_eq(table->commands[i].name, cmd->name))
+        {
+            kernel_command = table->commands[i];
+            break;
+        }
+    }
+    rcu_read_unlock();
+
+    if (!kernel_command.dispatcher)
+    {
+        println("Unknown command");
+        return;
+    }
+
+    if (cmd->arg_count < kernel_command.min_args || cmd->arg_count > kernel_command.max_args)
+    {
+        println("Wrong usage");
+        return;
+    }
+
+    kernel_command.dispatcher(cmd);
+}
+
+void process_command(void)
+{
+    TerminalCommandBuffer* buffer = &cmd_buffer[current_command];
+    Command* cmd = parse_command(&command_arena, buffer->characters, buffer->char_count);
+    if (cmd)
+    {
+        dispatch_command(cmd);
+    }
+    else if (!command_is_blank(buffer->characters, buffer->char_count))
+    {
+        println("Command too long: out of command arena memory");
+    }
+
+    // Everything the command allocated goes away at once
+    arena_reset(&command_arena);
 }
 
 
@@ -711,23 +1099,68 @@ void kb_backspace_action(void)
     }
 }
 
+static void terminal_insert_char(char ch)
+{
+    putc(ch);
+
+    bool overflow = cmd_buffer[current_command].char_count + 1 > array_length(cmd_buffer[current_command].characters);
+    if (overflow)
+    {
+        println("Command buffer overflow");
+        reset_terminal();
+        return;
+    }
+
+    cmd_buffer[current_command].characters[cmd_buffer[current_command].char_count++] = ch;
+}
+
 void kb_print_ch(u8 scancode)
 {
 
     char ch = translate_scancode(scancode, left_shift_pressed || right_shift_pressed);
     if (ch)
     {
-        putc(ch);
+        terminal_insert_char(ch);
+    }
+}
+
+// Commands typed on COM1 go into the same command line as the keyboard. Bytes are taken one at a
+// time so that whatever follows a line end stays in the RX ring until the command has run
+static void serial_input_process(void)
+{
+    // A line may end in CR, LF or CR LF; the LF of a CR LF must not enter a second, empty line
+    static bool after_carriage_return = false;
+    char ch;
 
-        bool overflow = cmd_buffer[current_command].char_count + 1 > array_length(cmd_buffer[current_command].characters);
-        if (overflow)
+    while (allow_keyboard_input && serial_read(&ch, 1))
+    {
+        bool line_feed_after_carriage_return = ch == '\n' && after_carriage_return;
+        after_carriage_return = ch == '\r';
+        if (line_feed_after_carriage_return)
         {
-            println("Command buffer overflow");
-            reset_terminal();
-            return;
+            continue;
         }
 
-        cmd_buffer[current_command].characters[cmd_buffer[current_command].char_count++] = ch;
+        switch (ch)
+        {
+            case '\r':
+            case '\n':
+                new_line();
+                allow_keyboard_input = false;
+                break;
+            // Terminals send DEL for the backspace key, some BS
+            case 0x7f:
+            case '\b':
+                kb_backspace_action();
+                break;
+            default:
+                // Escape sequences and other control characters are not understood
+                if (ch >= ' ' && ch <= '~')
+                {
+                    terminal_insert_char(ch);
+                }
+                break;
+        }
     }
 }
 
@@ -739,6 +1172,7 @@ void KernelMain(BootInfo* boot_info)
     {
         //PS2_mouse_process_packet();
         kb_input_process();
+        serial_input_process();
         // This means we should process a command
         if (!allow_keyboard_input)
         {
@@ -746,6 +1180,13 @@ void KernelMain(BootInfo* boot_info)
             reset_terminal();
         }
 
+        // Nothing is being read under RCU at this point, and deferred frees get to run
+        rcu_quiescent_state();
+        // Rendering of everything printed since the last iteration happens here, off the paths that logged it
+        klog_flush();
+        // Then what was drawn reaches the screen, once per iteration
+        renderer_flush();
+        serial_poll();
         hlt();
     }
 }
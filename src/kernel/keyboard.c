@@ -1,6 +1,7 @@
 #include "keyboard.h"
 #include "interrupts.h"
 #include "libk.h"
+#include "panic.h"
 
 bool left_shift_pressed = false;
 bool right_shift_pressed = false;
@@ -10,24 +11,24 @@ extern void kb_print_ch(u8 scancode);
 
 void kb_input_process(void)
 {
-    KeyboardBuffer kb_buffer;
-    u16 kb_event_count;
-    // This cleans kb interrupt buffer
-    bool overflow = kb_get_buffer(&kb_buffer, &kb_event_count);
-    if (overflow)
+    if (kb_overflowed())
     {
-        println("KEYBOARD BUFFER OVERFLOW");
+        // panic shows its report right away; a println would wait in the log for a flush that never comes
+        panic("Keyboard buffer overflow");
         while(1);
     }
 
+    u8 scancode;
+
     if (!allow_keyboard_input)
     {
+        // Keys typed while a command runs are dropped
+        while (kb_pop_scancode(&scancode));
         return;
     }
 
-    for (u16 i = 0; i < kb_event_count; i++)
+    while (kb_pop_scancode(&scancode))
     {
-        u8 scancode = kb_buffer.messages[i];
         switch (scancode)
         {
             case Key_LeftShift:
@@ -0,0 +1,317 @@
+#include "klog.h"
+#include "asm.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "typed_print.h"
+#include <stdatomic.h>
+
+// A message longer than one record continues in the following ones, and a print without a
+// trailing newline simply leaves the line open for the next record
+typedef struct ALIGN(CACHE_LINE_SIZE) KLogRecord
+{
+    // 2 * sequence + 1 while the record is being written, 2 * sequence + 2 once it is complete.
+    // Readers compare it against the sequence they expect to tell unwritten, torn and
+    // overwritten records apart
+    _Atomic u64 state;
+    u64 timestamp;
+    u16 length;
+    u16 reserved;
+    char text[KLOG_RECORD_SIZE - 2 * sizeof(u64) - 4];
+} KLogRecord;
+
+_Static_assert(sizeof(KLogRecord) == KLOG_RECORD_SIZE, "KLogRecord size mismatch");
+_Static_assert((KLOG_RECORD_COUNT & (KLOG_RECORD_COUNT - 1)) == 0, "KLOG_RECORD_COUNT must be a power of two");
+
+typedef enum KLogReadResult
+{
+    KLogRead_Ok,
+    KLogRead_NotReady,
+    KLogRead_Lost,
+} KLogReadResult;
+
+// Only written by its own CPU. The head is still claimed atomically because interrupt handlers
+// on the same CPU may log in the middle of another message
+typedef struct ALIGN(CACHE_LINE_SIZE) KLogCPU
+{
+    _Atomic u64 head;
+    KLogRecord records[KLOG_RECORD_COUNT];
+} KLogCPU;
+
+// Walks the rings of all CPUs at once, returning records in TSC order. Each ring is already in
+// TSC order, except for messages logged by an interrupt handler that preempted another log call
+typedef struct KLogMerge
+{
+    u64 positions[CPU_MAX_COUNT];
+    u64 ends[CPU_MAX_COUNT];
+    bool loaded[CPU_MAX_COUNT];
+    KLogRecord records[CPU_MAX_COUNT];
+    u64 lost;
+} KLogMerge;
+
+static KLogCPU klog_cpus[CPU_MAX_COUNT];
+
+// Consumer side, only touched with klog_flush_lock held
+static Spinlock klog_flush_lock = SPINLOCK_INIT;
+static u64 klog_flushed[CPU_MAX_COUNT];
+static u32 klog_flush_line_cpu;
+static bool klog_flush_line_open;
+static FormatSink* klog_sinks[KLOG_MAX_SINKS];
+static u32 klog_sink_count;
+
+void klog_write(const char* text, usize length)
+{
+    u64 timestamp = rdtsc();
+    KLogCPU* cpu = &klog_cpus[cpu_get_id()];
+
+    while (length)
+    {
+        u64 sequence = atomic_fetch_add_explicit(&cpu->head, 1, memory_order_relaxed);
+        KLogRecord* record = &cpu->records[sequence & (KLOG_RECORD_COUNT - 1)];
+
+        atomic_store_explicit(&record->state, 2 * sequence + 1, memory_order_relaxed);
+        // The odd state must be visible before any of the text is overwritten
+        atomic_thread_fence(memory_order_release);
+
+        u16 chunk = length < sizeof(record->text) ? length : sizeof(record->text);
+        record->timestamp = timestamp;
+        record->length = chunk;
+        memcpy(record->text, text, chunk);
+
+        atomic_store_explicit(&record->state, 2 * sequence + 2, memory_order_release);
+
+        text += chunk;
+        length -= chunk;
+    }
+}
+
+static void klog_sink_write(FormatSink* sink, const char* data, usize length)
+{
+    klog_write(data, length);
+}
+
+FormatSink klog_sink = { .write = klog_sink_write };
+
+static KLogReadResult klog_read(const KLogCPU* cpu, u64 sequence, KLogRecord* out_record)
+{
+    const KLogRecord* record = &cpu->records[sequence & (KLOG_RECORD_COUNT - 1)];
+    u64 expected = 2 * sequence + 2;
+
+    u64 state = atomic_load_explicit(&record->state, memory_order_acquire);
+    if (state < expected)
+    {
+        return KLogRead_NotReady;
+    }
+    if (state > expected)
+    {
+        return KLogRead_Lost;
+    }
+
+    out_record->timestamp = record->timestamp;
+    out_record->length = record->length <= sizeof(record->text) ? record->length : sizeof(record->text);
+    memcpy(out_record->text, record->text, out_record->length);
+
+    // A writer that lapped the ring while the text was being copied changed the state
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&record->state, memory_order_relaxed) != state)
+    {
+        return KLogRead_Lost;
+    }
+
+    return KLogRead_Ok;
+}
+
+// Starts at the given per-CPU sequences and ends at the heads as they are now. Records that were
+// overwritten in the meantime are counted as lost
+static void klog_merge_init(KLogMerge* merge, const u64* positions)
+{
+    merge->lost = 0;
+
+    for (u32 i = 0; i < cpu_count; i++)
+    {
+        u64 head = atomic_load_explicit(&klog_cpus[i].head, memory_order_acquire);
+        u64 oldest = head > KLOG_RECORD_COUNT ? head - KLOG_RECORD_COUNT : 0;
+
+        merge->positions[i] = positions[i];
+        if (merge->positions[i] < oldest)
+        {
+            merge->lost += oldest - merge->positions[i];
+            merge->positions[i] = oldest;
+        }
+
+        merge->ends[i] = head;
+        merge->loaded[i] = false;
+    }
+}
+
+// Returns the oldest pending record, or NULL once every ring is exhausted. A ring whose next record
+// is still being written stops there, leaving its position on that record for the next merge
+static const KLogRecord* klog_merge_next(KLogMerge* merge, u32* out_cpu)
+{
+    u32 next_cpu = CPU_MAX_COUNT;
+
+    for (u32 i = 0; i < cpu_count; i++)
+    {
+        while (!merge->loaded[i] && merge->positions[i] < merge->ends[i])
+        {
+            KLogReadResult result = klog_read(&klog_cpus[i], merge->positions[i], &merge->records[i]);
+            if (result == KLogRead_NotReady)
+            {
+                merge->ends[i] = merge->positions[i];
+                break;
+            }
+
+            merge->positions[i]++;
+            if (result == KLogRead_Lost)
+            {
+                merge->lost++;
+            }
+            else
+            {
+                merge->loaded[i] = true;
+            }
+        }
+
+        if (merge->loaded[i] && (next_cpu == CPU_MAX_COUNT || merge->records[i].timestamp < merge->records[next_cpu].timestamp))
+        {
+            next_cpu = i;
+        }
+    }
+
+    if (next_cpu == CPU_MAX_COUNT)
+    {
+        return NULL;
+    }
+
+    merge->loaded[next_cpu] = false;
+    *out_cpu = next_cpu;
+    return &merge->records[next_cpu];
+}
+
+void klog_setup(void)
+{
+    klog_sink_register(&framebuffer_sink);
+    console_sink = &klog_sink;
+}
+
+// Sinks registered later only see what is flushed from then on
+bool klog_sink_register(FormatSink* sink)
+{
+    u64 flags = spin_lock_irqsave(&klog_flush_lock);
+
+    bool registered = klog_sink_count < KLOG_MAX_SINKS;
+    if (registered)
+    {
+        klog_sinks[klog_sink_count++] = sink;
+    }
+
+    spin_unlock_irqrestore(&klog_flush_lock, flags);
+
+    return registered;
+}
+
+static void klog_emit(const char* text, usize length)
+{
+    for (u32 i = 0; i < klog_sink_count; i++)
+    {
+        klog_sinks[i]->write(klog_sinks[i], text, length);
+    }
+}
+
+// Forwards every complete record that has not been flushed yet. A no-op if another CPU is already
+// flushing
+void klog_flush(void)
+{
+    if (!spin_trylock(&klog_flush_lock))
+    {
+        return;
+    }
+
+    KLogMerge merge;
+    klog_merge_init(&merge, klog_flushed);
+
+    const KLogRecord* record;
+    u32 cpu;
+    while ((record = klog_merge_next(&merge, &cpu)))
+    {
+        // A line left open by one CPU is not continued with the text of another
+        if (klog_flush_line_open && cpu != klog_flush_line_cpu)
+        {
+            klog_emit("\n", 1);
+        }
+
+        if (merge.lost)
+        {
+            char note[64];
+            s32 written = snprintf(note, sizeof(note), "[klog: %64u records lost]\n", merge.lost);
+            usize length = written > 0 ? (usize)written : 0;
+            klog_emit(note, length < sizeof(note) ? length : sizeof(note) - 1);
+            merge.lost = 0;
+        }
+
+        klog_emit(record->text, record->length);
+        klog_flush_line_cpu = cpu;
+        klog_flush_line_open = record->length && record->text[record->length - 1] != '\n';
+    }
+
+    for (u32 i = 0; i < cpu_count; i++)
+    {
+        klog_flushed[i] = merge.positions[i];
+    }
+
+    spin_unlock(&klog_flush_lock);
+}
+
+// Writes every record still in the rings to sink in TSC order, prefixing each line with the TSC
+// value and the CPU it was logged on. Does not go through the log itself
+void klog_replay(FormatSink* sink)
+{
+    u64 start[CPU_MAX_COUNT] = {0};
+    KLogMerge merge;
+    klog_merge_init(&merge, start);
+
+    bool line_start = true;
+    u32 line_cpu = 0;
+
+    const KLogRecord* record;
+    u32 cpu;
+    while ((record = klog_merge_next(&merge, &cpu)))
+    {
+        if (!line_start && cpu != line_cpu)
+        {
+            sink->write(sink, "\n", 1);
+            line_start = true;
+        }
+
+        const char* it = record->text;
+        const char* end = record->text + record->length;
+        while (it < end)
+        {
+            if (line_start)
+            {
+                sink_tprint(sink, "[", fmt_width(record->timestamp, 16), " ", cpu, "] ");
+                line_start = false;
+                line_cpu = cpu;
+            }
+
+            const char* line_end = it;
+            while (line_end < end && *line_end != '\n')
+            {
+                line_end++;
+            }
+
+            if (line_end < end)
+            {
+                line_end++;
+                line_start = true;
+            }
+
+            sink->write(sink, it, line_end - it);
+            it = line_end;
+        }
+    }
+
+    if (!line_start)
+    {
+        sink->write(sink, "\n", 1);
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "types.h"
+#include "libk.h"
+
+// Kernel log. print/println/tprint append to a ring of fixed-size timestamped records instead of
+// rendering, and klog_flush, run from the idle loop, forwards new records to the registered sinks
+// (the framebuffer console by default). Every CPU has its own ring, so writers never block, take a
+// lock or share a cache line with another CPU; readers merge the rings by TSC. A full ring
+// overwrites its oldest records, and readers notice and report the loss.
+
+// Per CPU
+#define KLOG_RECORD_COUNT 512
+#define KLOG_RECORD_SIZE 128
+#define KLOG_MAX_SINKS 4
+
+extern FormatSink klog_sink;
+
+void klog_setup(void);
+void klog_write(const char* text, usize length);
+bool klog_sink_register(FormatSink* sink);
+void klog_flush(void);
+void klog_replay(FormatSink* sink);
@@ -0,0 +1,222 @@
+#include "kmalloc.h"
+#include "slab.h"
+#include "libk.h"
+#include "memory_internal.h"
+#include "panic.h"
+#include "alloc_trace.h"
+
+#define KMALLOC_LARGE_MAGIC 0x454752414c4d4b4cULL
+
+// Size classes: steps of 16 up to 128 bytes, then four classes per power of two
+// (each at most 1.25x the previous one) up to the largest size a slab can hold.
+// Anything bigger goes straight to a page run
+enum
+{
+    KMALLOC_SMALL_CLASS_COUNT = 8,
+    KMALLOC_SMALL_CLASS_MAX = 128,
+    KMALLOC_CLASS_COUNT = 23,
+    KMALLOC_SLAB_MAX = 1792,
+};
+
+static const char* kmalloc_cache_names[KMALLOC_CLASS_COUNT] =
+{
+    "kmalloc-16", "kmalloc-32", "kmalloc-48", "kmalloc-64",
+    "kmalloc-80", "kmalloc-96", "kmalloc-112", "kmalloc-128",
+    "kmalloc-160", "kmalloc-192", "kmalloc-224", "kmalloc-256",
+    "kmalloc-320", "kmalloc-384", "kmalloc-448", "kmalloc-512",
+    "kmalloc-640", "kmalloc-768", "kmalloc-896", "kmalloc-1024",
+    "kmalloc-1280", "kmalloc-1536", "kmalloc-1792",
+};
+
+static SlabCache* kmalloc_caches[KMALLOC_CLASS_COUNT];
+
+// Header at the beginning of the first page of a large allocation. Slab pages carry their own
+// header in the same place, so kfree tells them apart just by masking the pointer
+typedef struct ALIGN(CACHE_LINE_SIZE) KmallocLargeHeader
+{
+    u64 magic;
+    u64 page_count;
+} KmallocLargeHeader;
+
+static inline u32 size_to_class(usize size)
+{
+    if (size <= KMALLOC_SMALL_CLASS_MAX)
+    {
+        return size <= 16 ? 0 : (u32)((size + 15) / 16 - 1);
+    }
+
+    // size is in (2^k, 2^(k + 1)], pick the quarter it falls into
+    u32 k = 63 - __builtin_clzll(size - 1);
+    u32 quarter = ((size - 1) >> (k - 2)) & 3;
+
+    return KMALLOC_SMALL_CLASS_COUNT + (k - 7) * 4 + quarter;
+}
+
+static inline usize class_to_size(u32 index)
+{
+    if (index < KMALLOC_SMALL_CLASS_COUNT)
+    {
+        return (index + 1) * 16;
+    }
+
+    u32 k = 7 + (index - KMALLOC_SMALL_CLASS_COUNT) / 4;
+    u32 quarter = (index - KMALLOC_SMALL_CLASS_COUNT) % 4;
+
+    return ((usize)1 << k) + (quarter + 1) * ((usize)1 << (k - 2));
+}
+
+void kmalloc_setup(void)
+{
+    for (u32 i = 0; i < KMALLOC_CLASS_COUNT; i++)
+    {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_cache_names[i], class_to_size(i), 16);
+        if (!kmalloc_caches[i])
+        {
+            panic("Failed to create %s", kmalloc_cache_names[i]);
+        }
+    }
+}
+
+static void* kmalloc_large(usize size)
+{
+    if (size > KMALLOC_MAX_SIZE)
+    {
+        return NULL;
+    }
+
+    u64 page_count = (size + sizeof(KmallocLargeHeader) + PAGE_SIZE - 1) / PAGE_SIZE;
+    KmallocLargeHeader* header = request_pages_internal(page_count);
+    if (!header)
+    {
+        return NULL;
+    }
+
+    header->magic = KMALLOC_LARGE_MAGIC;
+    header->page_count = page_count;
+
+    return header + 1;
+}
+
+static void* kmalloc_internal(usize size)
+{
+    if (size == 0)
+    {
+        return NULL;
+    }
+
+    if (size > KMALLOC_SLAB_MAX)
+    {
+        return kmalloc_large(size);
+    }
+
+    return slab_alloc(kmalloc_caches[size_to_class(size)]);
+}
+
+void* kmalloc(usize size)
+{
+    void* result = kmalloc_internal(size);
+    alloc_trace_alloc(AllocTraceKind_Object, result, size);
+    return result;
+}
+
+void* kzalloc(usize size)
+{
+    void* result = kmalloc_internal(size);
+    if (result)
+    {
+        memset(result, 0, size);
+    }
+
+    alloc_trace_alloc(AllocTraceKind_Object, result, size);
+    return result;
+}
+
+usize ksize(void* ptr)
+{
+    if (!ptr)
+    {
+        return 0;
+    }
+
+    Slab* slab = slab_from_object(ptr);
+    if (slab)
+    {
+        return slab->cache->object_size;
+    }
+
+    KmallocLargeHeader* header = (KmallocLargeHeader*)((u64)ptr & ~((u64)PAGE_SIZE - 1));
+    if (header->magic != KMALLOC_LARGE_MAGIC)
+    {
+        panic("ksize: %64h was not returned by kmalloc", (u64)ptr);
+        return 0;
+    }
+
+    return header->page_count * PAGE_SIZE - sizeof(KmallocLargeHeader);
+}
+
+static void kfree_internal(void* ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    // Both paths are O(1): the owner is found by masking the pointer down to its page
+    Slab* slab = slab_from_object(ptr);
+    if (slab)
+    {
+        slab_free(slab->cache, ptr);
+        return;
+    }
+
+    KmallocLargeHeader* header = (KmallocLargeHeader*)((u64)ptr & ~((u64)PAGE_SIZE - 1));
+    if (header->magic != KMALLOC_LARGE_MAGIC)
+    {
+        panic("kfree: %64h was not returned by kmalloc", (u64)ptr);
+        return;
+    }
+
+    header->magic = 0;
+    free_pages_internal(header, header->page_count);
+}
+
+void kfree(void* ptr)
+{
+    alloc_trace_free(ptr);
+    kfree_internal(ptr);
+}
+
+void* krealloc(void* ptr, usize size)
+{
+    if (!ptr)
+    {
+        void* result = kmalloc_internal(size);
+        alloc_trace_alloc(AllocTraceKind_Object, result, size);
+        return result;
+    }
+
+    if (size == 0)
+    {
+        alloc_trace_free(ptr);
+        kfree_internal(ptr);
+        return NULL;
+    }
+
+    // Shrink in place unless at least half of the block would be wasted
+    usize old_size = ksize(ptr);
+    if (size <= old_size && size >= old_size / 2)
+    {
+        return ptr;
+    }
+
+    void* result = kmalloc_internal(size);
+    if (result)
+    {
+        memcpy(result, ptr, old_size < size ? old_size : size);
+        alloc_trace_free(ptr);
+        kfree_internal(ptr);
+        alloc_trace_alloc(AllocTraceKind_Object, result, size);
+    }
+
+    return result;
+}
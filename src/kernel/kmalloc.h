@@ -0,0 +1,14 @@
+#pragma once
+#include "types.h"
+
+// Largest request kmalloc accepts. Far more than a page run will ever find, but it keeps the
+// page count arithmetic of large allocations from overflowing
+#define KMALLOC_MAX_SIZE GIGABYTE(4)
+
+void kmalloc_setup(void);
+
+void* kmalloc(usize size);
+void* kzalloc(usize size);
+void* krealloc(void* ptr, usize size);
+void kfree(void* ptr);
+usize ksize(void* ptr);
@@ -1,4 +1,7 @@
 #include "libk.h"
+#include "panic.h"
+#include "cpu.h"
+#include "typed_print.h"
 
 typedef enum FormatLookupTableIndex
 {
@@ -7,184 +10,791 @@ typedef enum FormatLookupTableIndex
     HEXADECIMAL = 2,
 } FormatLookupTableIndex;
 
+typedef u16 u16_unaligned __attribute__((aligned(1), may_alias));
+typedef u32 u32_unaligned __attribute__((aligned(1), may_alias));
+typedef u64 u64_unaligned __attribute__((aligned(1), may_alias));
+typedef long long Vector16 __attribute__((vector_size(16), may_alias));
+typedef long long Vector16_unaligned __attribute__((vector_size(16), aligned(1), may_alias));
+typedef long long Vector16_builtin __attribute__((vector_size(16)));
+typedef char VectorBytes16 __attribute__((vector_size(16), may_alias));
+typedef char VectorBytes16_unaligned __attribute__((vector_size(16), aligned(1), may_alias));
+typedef long long Vector32 __attribute__((vector_size(32), may_alias));
+typedef long long Vector32_unaligned __attribute__((vector_size(32), aligned(1), may_alias));
+
+// Bit i is set if byte i of the vector has its top bit set (pmovmskb)
+static inline u32 byte_mask(VectorBytes16 v)
+{
+    return (u32)__builtin_ia32_pmovmskb128(v);
+}
+
+static inline bool crosses_page(const void* ptr, usize bytes)
+{
+    return ((u64)ptr & 0xfff) > 0x1000 - bytes;
+}
+
 bool memequal(const void* a, const void* b, usize bytes)
 {
-    u8* a1 = (u8*)a;
-    u8* b1 = (u8*)b;
-    for (usize i = 0; i < bytes; i++)
+    const u8* a1 = a;
+    const u8* b1 = b;
+
+    // Every load stays inside [0, bytes): the last one overlaps the previous instead of reading past the end
+    if (bytes >= 16)
     {
-        if (a1[i] != b1[i])
+        for (usize i = 0; i + 16 < bytes; i += 16)
         {
-            return false;
+            VectorBytes16 diff = (VectorBytes16)(*(VectorBytes16_unaligned*)(a1 + i) != *(VectorBytes16_unaligned*)(b1 + i));
+            if (byte_mask(diff))
+            {
+                return false;
+            }
         }
+
+        VectorBytes16 diff = (VectorBytes16)(*(VectorBytes16_unaligned*)(a1 + bytes - 16) != *(VectorBytes16_unaligned*)(b1 + bytes - 16));
+        return byte_mask(diff) == 0;
     }
-    return true;
+
+    if (bytes >= 8)
+    {
+        u64 diff = (*(u64_unaligned*)a1 ^ *(u64_unaligned*)b1) | (*(u64_unaligned*)(a1 + bytes - 8) ^ *(u64_unaligned*)(b1 + bytes - 8));
+        return diff == 0;
+    }
+
+    if (bytes >= 4)
+    {
+        u32 diff = (*(u32_unaligned*)a1 ^ *(u32_unaligned*)b1) | (*(u32_unaligned*)(a1 + bytes - 4) ^ *(u32_unaligned*)(b1 + bytes - 4));
+        return diff == 0;
+    }
+
+    if (bytes >= 2)
+    {
+        u16 diff = (*(u16_unaligned*)a1 ^ *(u16_unaligned*)b1) | (*(u16_unaligned*)(a1 + bytes - 2) ^ *(u16_unaligned*)(b1 + bytes - 2));
+        return diff == 0;
+    }
+
+    return bytes == 0 || *a1 == *b1;
 }
 
-void* memcpy(void* dst, const void* src, usize bytes)
+typedef void* MemcpyFn(void* dst, const void* src, usize bytes);
+typedef void MemsetFn(void* dst, u64 pattern, usize bytes);
+
+// Copies up to 16 bytes with two possibly overlapping loads and stores. Every load
+// happens before the first store, so this is also correct for overlapping buffers
+static inline void memcpy_small(u8* dst, const u8* src, usize bytes)
+{
+    if (bytes >= 8)
+    {
+        u64 head = *(u64_unaligned*)src;
+        u64 tail = *(u64_unaligned*)(src + bytes - 8);
+        *(u64_unaligned*)dst = head;
+        *(u64_unaligned*)(dst + bytes - 8) = tail;
+    }
+    else if (bytes >= 4)
+    {
+        u32 head = *(u32_unaligned*)src;
+        u32 tail = *(u32_unaligned*)(src + bytes - 4);
+        *(u32_unaligned*)dst = head;
+        *(u32_unaligned*)(dst + bytes - 4) = tail;
+    }
+    else if (bytes >= 2)
+    {
+        u16 head = *(u16_unaligned*)src;
+        u16 tail = *(u16_unaligned*)(src + bytes - 2);
+        *(u16_unaligned*)dst = head;
+        *(u16_unaligned*)(dst + bytes - 2) = tail;
+    }
+    else if (bytes)
+    {
+        *dst = *src;
+    }
+}
+
+static inline void memset_small(u8* dst, u64 pattern, usize bytes)
+{
+    if (bytes >= 8)
+    {
+        *(u64_unaligned*)dst = pattern;
+        *(u64_unaligned*)(dst + bytes - 8) = pattern;
+    }
+    else if (bytes >= 4)
+    {
+        *(u32_unaligned*)dst = (u32)pattern;
+        *(u32_unaligned*)(dst + bytes - 4) = (u32)pattern;
+    }
+    else if (bytes >= 2)
+    {
+        *(u16_unaligned*)dst = (u16)pattern;
+        *(u16_unaligned*)(dst + bytes - 2) = (u16)pattern;
+    }
+    else if (bytes)
+    {
+        *dst = (u8)pattern;
+    }
+}
+
+// The vector kernels store an unaligned head and tail and aligned blocks in between. They require bytes > 16 (SSE2) or bytes > 32 (AVX2)
+static void* memcpy_SSE2(void* dst, const void* src, usize bytes)
 {
-    u8* writer = dst;
-    u8* reader = (u8*)src;
-    for (u64 i = 0; i < bytes; i++)
+    u8* d = dst;
+    const u8* s = src;
+    Vector16 head = *(Vector16_unaligned*)s;
+    Vector16 tail = *(Vector16_unaligned*)(s + bytes - 16);
+
+    u8* d_end = d + bytes;
+    usize skew = 16 - ((u64)d & 15);
+    u8* it = d + skew;
+    s += skew;
+
+    for (; it + 64 <= d_end; it += 64, s += 64)
+    {
+        Vector16 a = *(Vector16_unaligned*)(s + 0);
+        Vector16 b = *(Vector16_unaligned*)(s + 16);
+        Vector16 c = *(Vector16_unaligned*)(s + 32);
+        Vector16 e = *(Vector16_unaligned*)(s + 48);
+        *(Vector16*)(it + 0) = a;
+        *(Vector16*)(it + 16) = b;
+        *(Vector16*)(it + 32) = c;
+        *(Vector16*)(it + 48) = e;
+    }
+
+    for (; it + 16 <= d_end; it += 16, s += 16)
     {
-        *writer++ = *reader++;
+        *(Vector16*)it = *(Vector16_unaligned*)s;
     }
 
+    *(Vector16_unaligned*)d = head;
+    *(Vector16_unaligned*)(d_end - 16) = tail;
+
     return dst;
 }
 
-void unsigned_to_string_vprintf(u64 value, char* buffer)
+__attribute__((target("avx2")))
+static void* memcpy_AVX2(void* dst, const void* src, usize bytes)
 {
-    u8 digit_count = 0;
-    u64 it = value;
-    
-    while (it / 10 > 0)
+    u8* d = dst;
+    const u8* s = src;
+    Vector32 head = *(Vector32_unaligned*)s;
+    Vector32 tail = *(Vector32_unaligned*)(s + bytes - 32);
+
+    u8* d_end = d + bytes;
+    usize skew = 32 - ((u64)d & 31);
+    u8* it = d + skew;
+    s += skew;
+
+    for (; it + 128 <= d_end; it += 128, s += 128)
+    {
+        Vector32 a = *(Vector32_unaligned*)(s + 0);
+        Vector32 b = *(Vector32_unaligned*)(s + 32);
+        Vector32 c = *(Vector32_unaligned*)(s + 64);
+        Vector32 e = *(Vector32_unaligned*)(s + 96);
+        *(Vector32*)(it + 0) = a;
+        *(Vector32*)(it + 32) = b;
+        *(Vector32*)(it + 64) = c;
+        *(Vector32*)(it + 96) = e;
+    }
+
+    for (; it + 32 <= d_end; it += 32, s += 32)
     {
-        it /= 10;
-        digit_count++;
+        *(Vector32*)it = *(Vector32_unaligned*)s;
     }
 
-    u8 index = 0;
+    *(Vector32_unaligned*)d = head;
+    *(Vector32_unaligned*)(d_end - 32) = tail;
+
+    return dst;
+}
+
+static void memset_SSE2(void* dst, u64 pattern, usize bytes)
+{
+    u8* d = dst;
+    Vector16 value = { (s64)pattern, (s64)pattern };
+    u8* d_end = d + bytes;
+    u8* it = d + 16 - ((u64)d & 15);
+
+    for (; it + 64 <= d_end; it += 64)
+    {
+        *(Vector16*)(it + 0) = value;
+        *(Vector16*)(it + 16) = value;
+        *(Vector16*)(it + 32) = value;
+        *(Vector16*)(it + 48) = value;
+    }
 
-    while (value / 10 > 0)
+    for (; it + 16 <= d_end; it += 16)
     {
-        u8 remainder = value % 10;
-        value /= 10;
-        buffer[digit_count - index] = remainder + '0';
-        index++;
+        *(Vector16*)it = value;
     }
 
-    u8 remainder = value % 10;
-    buffer[digit_count - index] = remainder + '0';
-    buffer[digit_count + 1] = 0;
+    *(Vector16_unaligned*)d = value;
+    *(Vector16_unaligned*)(d_end - 16) = value;
 }
 
-void signed_to_string_vprintf(s64 value, char* buffer)
+__attribute__((target("avx2")))
+static void memset_AVX2(void* dst, u64 pattern, usize bytes)
 {
-    u8 is_negative = value < 0;
-    if (is_negative)
+    u8* d = dst;
+    Vector32 value = { (s64)pattern, (s64)pattern, (s64)pattern, (s64)pattern };
+    u8* d_end = d + bytes;
+    u8* it = d + 32 - ((u64)d & 31);
+
+    for (; it + 128 <= d_end; it += 128)
+    {
+        *(Vector32*)(it + 0) = value;
+        *(Vector32*)(it + 32) = value;
+        *(Vector32*)(it + 64) = value;
+        *(Vector32*)(it + 96) = value;
+    }
+
+    for (; it + 32 <= d_end; it += 32)
     {
-        value *= is_negative ? -1 : 1;
-        buffer[0] = '-';
+        *(Vector32*)it = value;
     }
 
-    u8 digit_count = 0;
-    u64 it = value;
-    
-    while (it / 10 > 0)
+    *(Vector32_unaligned*)d = value;
+    *(Vector32_unaligned*)(d_end - 32) = value;
+}
+
+static inline void rep_movsb(void* dst, const void* src, usize bytes)
+{
+    asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(bytes) : : "memory");
+}
+
+static inline void rep_stosb(void* dst, u8 value, usize bytes)
+{
+    asm volatile("rep stosb" : "+D"(dst), "+c"(bytes) : "a"(value) : "memory");
+}
+
+// Until libk_setup runs, everything goes through the SSE2 kernels, which every x86_64 CPU has
+static MemcpyFn* memcpy_vector = memcpy_SSE2;
+static MemsetFn* memset_vector = memset_SSE2;
+static usize memcpy_vector_min = 16;
+// Sizes from which rep movsb/stosb beat the vector loops. Left at the maximum when the CPU lacks ERMS
+static usize rep_string_threshold = UINT64_MAX;
+
+// Every choice is made from features alone, so calling it again with fewer features goes back to
+// the SSE2 kernels (the host benchmarks compare the kernels that way)
+void libk_setup(const CPUFeatures* features)
+{
+    memcpy_vector = memcpy_SSE2;
+    memset_vector = memset_SSE2;
+    memcpy_vector_min = 16;
+    rep_string_threshold = UINT64_MAX;
+
+    if (features->AVX2)
     {
-        it /= 10;
-        digit_count++;
+        memcpy_vector = memcpy_AVX2;
+        memset_vector = memset_AVX2;
+        memcpy_vector_min = 32;
     }
 
-    u8 index = 0;
+    if (features->ERMS)
+    {
+        // Fast short rep movsb makes the microcode startup cost small enough to use it much earlier
+        rep_string_threshold = features->FSRM ? 256 : 2048;
+    }
+}
 
-    while (value / 10 > 0)
+void* memcpy(void* dst, const void* src, usize bytes)
+{
+    if (bytes <= 16)
+    {
+        memcpy_small(dst, src, bytes);
+    }
+    else if (bytes >= rep_string_threshold)
+    {
+        rep_movsb(dst, src, bytes);
+    }
+    else if (bytes > memcpy_vector_min)
     {
-        u8 remainder = value % 10;
-        value /= 10;
-        buffer[is_negative + digit_count - index] = remainder + '0';
-        index++;
+        memcpy_vector(dst, src, bytes);
+    }
+    else
+    {
+        memcpy_SSE2(dst, src, bytes);
     }
 
-    u8 remainder = value % 10;
-    buffer[is_negative + digit_count - index] = remainder + '0';
-    buffer[is_negative + digit_count + 1] = 0;
+    return dst;
 }
 
-void hex_to_string_bytes_vprintf(u64 value, u8 bytes_to_print, char* buffer)
+static const char decimal_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char hex_digits[16] = "0123456789ABCDEF";
+
+// Binary spelling of every nibble, so four bits are emitted with a single store
+static const char binary_nibbles[16][4] =
+{
+    "0000", "0001", "0010", "0011", "0100", "0101", "0110", "0111",
+    "1000", "1001", "1010", "1011", "1100", "1101", "1110", "1111",
+};
+
+// powers_of_10[0] is 0 rather than 1 so that zero is counted as one digit
+static const u64 powers_of_10[20] =
+{
+    0, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+    10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+    1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL,
+};
+
+// log10 is approximated from the bit length (1233 / 4096 ~= log10(2)) and corrected with one comparison
+static inline u32 decimal_digit_count(u64 value)
 {
-    char aux_buffer[256];
+    u32 bit_count = 64 - __builtin_clzll(value | 1);
+    u32 guess = (bit_count * 1233) >> 12;
+    return guess + 1 - (value < powers_of_10[guess]);
+}
 
-    u32 digit_count = 0;
+// Writes the digits of value right to left, two per step. The buffer must hold digit_count bytes
+static inline void write_decimal_digits(u64 value, char* buffer, u32 digit_count)
+{
+    char* it = buffer + digit_count;
 
-    if (value)
+    while (value >= 100)
     {
-        while (value)
-        {
-            u64 remainder = value % 16;
+        u32 pair = (u32)(value % 100) * 2;
+        value /= 100;
+        it -= 2;
+        *(u16_unaligned*)it = *(u16_unaligned*)(decimal_digit_pairs + pair);
+    }
 
-            aux_buffer[digit_count++] = remainder + 48 + (7 * (remainder > 10));
-            value /= 16;
-        }
+    if (value >= 10)
+    {
+        it -= 2;
+        *(u16_unaligned*)it = *(u16_unaligned*)(decimal_digit_pairs + value * 2);
     }
     else
     {
-        aux_buffer[digit_count++] = '0';
+        *--it = (char)('0' + value);
     }
+}
+
+u32 unsigned_to_string_vprintf(u64 value, char* buffer)
+{
+    u32 digit_count = decimal_digit_count(value);
+    write_decimal_digits(value, buffer, digit_count);
+    buffer[digit_count] = 0;
+    return digit_count;
+}
+
+u32 signed_to_string_vprintf(s64 value, char* buffer)
+{
+    u32 is_negative = value < 0;
+    // Negating in unsigned arithmetic keeps INT64_MIN representable
+    u64 magnitude = is_negative ? 0 - (u64)value : (u64)value;
+
+    buffer[0] = '-';
+    return is_negative + unsigned_to_string_vprintf(magnitude, buffer + is_negative);
+}
 
-    u32 prefix = 0;
-    buffer[prefix++] = '0';
-    buffer[prefix++] = 'x';
-    u8 digits_demanded = bytes_to_print * 2;
-    u8 zero_to_write_count = digits_demanded - digit_count;
+u32 hex_to_string_bytes_vprintf(u64 value, u8 bytes_to_print, char* buffer)
+{
+    u32 digit_count = bytes_to_print * 2;
+    char* it = buffer + 2 + digit_count;
+
+    buffer[0] = '0';
+    buffer[1] = 'x';
+    *it = 0;
 
-    for (u32 i = 0; i < zero_to_write_count; i++)
+    for (u32 i = 0; i < bytes_to_print; i++)
     {
-        buffer[prefix++] = '0';
+        it -= 2;
+        it[0] = hex_digits[(value >> 4) & 0xf];
+        it[1] = hex_digits[value & 0xf];
+        value >>= 8;
     }
 
-    char* ptr = buffer + prefix;
+    return 2 + digit_count;
+}
+
+u32 binary_to_string_bytes_vprintf(u64 value, u8 bytes_to_print, char* buffer)
+{
+    u32 digit_count = bytes_to_print * 8;
+    char* it = buffer + 2 + digit_count;
+
+    buffer[0] = '0';
+    buffer[1] = 'b';
+    *it = 0;
 
-    for (s32 i = digit_count - 1, real_i = 0; i >= 0; i--, real_i++)
+    for (u32 i = 0; i < bytes_to_print * 2; i++)
     {
-        ptr[real_i] = aux_buffer[i];
+        it -= 4;
+        *(u32_unaligned*)it = *(u32_unaligned*)binary_nibbles[value & 0xf];
+        value >>= 4;
     }
-    ptr[digit_count] = 0;
+
+    return 2 + digit_count;
 }
 
-void hex_to_string_u8_vprintf(u8 value, char* buffer)
+u32 hex_to_string_u8_vprintf(u8 value, char* buffer)
 {
     return hex_to_string_bytes_vprintf(value, sizeof(u8), buffer);
 }
-void hex_to_string_u16_vprintf(u16 value, char* buffer)
+u32 hex_to_string_u16_vprintf(u16 value, char* buffer)
 {
     return hex_to_string_bytes_vprintf(value, sizeof(u16), buffer);
 }
-void hex_to_string_u32_vprintf(u32 value, char* buffer)
+u32 hex_to_string_u32_vprintf(u32 value, char* buffer)
 {
     return hex_to_string_bytes_vprintf(value, sizeof(u32), buffer);
 }
-void hex_to_string_u64_vprintf(u64 value, char* buffer)
+u32 hex_to_string_u64_vprintf(u64 value, char* buffer)
 {
     return hex_to_string_bytes_vprintf(value, sizeof(u64), buffer);
 }
 
-void float_to_string_vprintf(f64 value, u8 decimal_digits, char* buffer)
+// Shortest round-trip float formatting, after Grisu2 (Loitsch, "Printing Floating-Point Numbers
+// Quickly and Accurately with Integers"). A double is scaled by a cached power of ten into a 64-bit
+// fixed-point window and digits are generated until they identify the value uniquely.
+
+typedef struct DiyFp
+{
+    u64 f;
+    s32 e;
+} DiyFp;
+
+#define DOUBLE_SIGNIFICAND_MASK 0x000fffffffffffffULL
+#define DOUBLE_HIDDEN_BIT       0x0010000000000000ULL
+#define DOUBLE_EXPONENT_BIAS    1075
+
+// Through a union rather than a pointer cast, which breaks strict aliasing
+static inline u64 f64_to_bits(f64 value)
+{
+    union { f64 f; u64 u; } bits = { .f = value };
+    return bits.u;
+}
+
+// Normalized 10^k for k = -348, -340, ..., 340, with their binary exponents
+static const u64 cached_powers_f[87] =
+{
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL, 0xcf42894a5dce35eaULL,
+    0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL, 0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL,
+    0xbe5691ef416bd60cULL, 0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL, 0xc21094364dfb5637ULL,
+    0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL, 0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL,
+    0xb23867fb2a35b28eULL, 0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL, 0xb5b5ada8aaff80b8ULL,
+    0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL, 0x964e858c91ba2655ULL, 0xdff9772470297ebdULL,
+    0xa6dfbd9fb8e5b88fULL, 0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL, 0xaa242499697392d3ULL,
+    0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL, 0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL,
+    0x9c40000000000000ULL, 0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL, 0x9f4f2726179a2245ULL,
+    0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL, 0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL,
+    0x924d692ca61be758ULL, 0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL, 0x952ab45cfa97a0b3ULL,
+    0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL, 0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL,
+    0x88fcf317f22241e2ULL, 0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL, 0x8bab8eefb6409c1aULL,
+    0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL, 0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL,
+    0x80444b5e7aa7cf85ULL, 0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+
+static const s16 cached_powers_e[87] =
+{
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066,
+};
+
+static inline DiyFp diy_fp_multiply(DiyFp a, DiyFp b)
+{
+    const u64 M32 = 0xffffffffULL;
+    u64 ah = a.f >> 32, al = a.f & M32;
+    u64 bh = b.f >> 32, bl = b.f & M32;
+    u64 hh = ah * bh, hl = ah * bl, lh = al * bh, ll = al * bl;
+    // Rounds the discarded low 64 bits
+    u64 middle = (ll >> 32) + (hl & M32) + (lh & M32) + (1ULL << 31);
+    return (DiyFp) { .f = hh + (hl >> 32) + (lh >> 32) + (middle >> 32), .e = a.e + b.e + 64 };
+}
+
+static inline DiyFp diy_fp_normalize(DiyFp v)
+{
+    s32 shift = __builtin_clzll(v.f);
+    return (DiyFp) { .f = v.f << shift, .e = v.e - shift };
+}
+
+static DiyFp cached_power(s32 e, s32* decimal_exponent)
+{
+    // ceil((-61 - e) * log10(2)) picks a power that moves the product's exponent into [-60, -32]
+    f64 dk = (-61 - e) * 0.30102999566398114 + 347;
+    s32 k = (s32)dk;
+    k += dk - k > 0;
+
+    u32 index = (u32)((k >> 3) + 1);
+    *decimal_exponent = -(-348 + (s32)index * 8);
+    return (DiyFp) { .f = cached_powers_f[index], .e = cached_powers_e[index] };
+}
+
+static inline void grisu_round(char* digits, u32 length, u64 delta, u64 rest, u64 ten_kappa, u64 wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa && (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        digits[length - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static void grisu_digit_gen(DiyFp w, DiyFp mp, u64 delta, char* digits, u32* length, s32* k)
+{
+    DiyFp one = { .f = 1ULL << -mp.e, .e = mp.e };
+    u64 wp_w = mp.f - w.f;
+    u32 p1 = (u32)(mp.f >> -one.e);
+    u64 p2 = mp.f & (one.f - 1);
+    s32 kappa = decimal_digit_count(p1);
+    *length = 0;
+
+    while (kappa > 0)
+    {
+        u32 power = (u32)powers_of_10[kappa - 1];
+        u32 d = kappa == 1 ? p1 : p1 / power;
+        p1 = kappa == 1 ? 0 : p1 % power;
+
+        if (d || *length)
+        {
+            digits[(*length)++] = (char)('0' + d);
+        }
+        kappa--;
+
+        u64 rest = ((u64)p1 << -one.e) + p2;
+        if (rest <= delta)
+        {
+            *k += kappa;
+            u64 ten_kappa = kappa ? powers_of_10[kappa] : 1;
+            grisu_round(digits, *length, delta, rest, ten_kappa << -one.e, wp_w);
+            return;
+        }
+    }
+
+    for (;;)
+    {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || *length)
+        {
+            digits[(*length)++] = (char)('0' + d);
+        }
+        p2 &= one.f - 1;
+        kappa--;
+
+        if (p2 < delta)
+        {
+            *k += kappa;
+            s32 index = -kappa;
+            grisu_round(digits, *length, delta, p2, one.f, wp_w * (index < 20 ? powers_of_10[index] : 0));
+            return;
+        }
+    }
+}
+
+// Writes the shortest digit string that round-trips to value (a positive, finite double) and returns
+// its length. The value equals digits * 10^decimal_exponent
+static u32 grisu2(f64 value, char* digits, s32* decimal_exponent)
+{
+    u64 bits = f64_to_bits(value);
+    u32 biased_exponent = (bits >> 52) & 0x7ff;
+    DiyFp v;
+    if (biased_exponent)
+    {
+        v = (DiyFp) { .f = (bits & DOUBLE_SIGNIFICAND_MASK) + DOUBLE_HIDDEN_BIT, .e = (s32)biased_exponent - DOUBLE_EXPONENT_BIAS };
+    }
+    else
+    {
+        v = (DiyFp) { .f = bits & DOUBLE_SIGNIFICAND_MASK, .e = 1 - DOUBLE_EXPONENT_BIAS };
+    }
+
+    // Boundaries halfway to the neighbouring doubles, sharing the exponent of the normalized upper one
+    DiyFp plus = diy_fp_normalize((DiyFp) { .f = (v.f << 1) + 1, .e = v.e - 1 });
+    DiyFp minus = v.f == DOUBLE_HIDDEN_BIT ? (DiyFp) { .f = (v.f << 2) - 1, .e = v.e - 2 } : (DiyFp) { .f = (v.f << 1) - 1, .e = v.e - 1 };
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    DiyFp c_mk = cached_power(plus.e, decimal_exponent);
+    DiyFp w = diy_fp_multiply(diy_fp_normalize(v), c_mk);
+    DiyFp wp = diy_fp_multiply(plus, c_mk);
+    DiyFp wm = diy_fp_multiply(minus, c_mk);
+    wm.f++;
+    wp.f--;
+
+    u32 length;
+    grisu_digit_gen(w, wp, wp.f - wm.f, digits, &length, decimal_exponent);
+    return length;
+}
+
+// Rounds digits (half up) so that at most keep digits remain. point is the position of the decimal point
+// relative to the first digit and moves when the rounding carries out, e.g. 999 -> 1000
+static u32 round_digits(char* digits, u32 length, s32 keep, s32* point)
+{
+    if (keep >= (s32)length)
+    {
+        return length;
+    }
+
+    if (keep < 0)
+    {
+        return 0;
+    }
+
+    bool round_up = digits[keep] >= '5';
+    length = keep;
+
+    if (round_up)
+    {
+        s32 i = (s32)length - 1;
+        for (; i >= 0 && digits[i] == '9'; i--)
+        {
+            length--;
+        }
+
+        if (i >= 0)
+        {
+            digits[i]++;
+        }
+        else
+        {
+            digits[0] = '1';
+            length = 1;
+            (*point)++;
+        }
+    }
+
+    return length;
+}
+
+static char* write_exponent(char* it, s32 exponent)
+{
+    *it++ = 'e';
+    if (exponent < 0)
+    {
+        *it++ = '-';
+        exponent = -exponent;
+    }
+    else
+    {
+        *it++ = '+';
+    }
+
+    return it + unsigned_to_string_vprintf(exponent, it);
+}
+
+enum
+{
+    FLOAT_MAX_PRECISION = 64,
+    // Values at or above 10^21 switch to exponent notation, which bounds the output at about 90 characters
+    FLOAT_MAX_FIXED_EXPONENT = 21,
+    FLOAT_MIN_FIXED_EXPONENT = -6,
+};
+
+// With a negative precision the shortest representation that reads back as the same double is written,
+// otherwise exactly precision decimals. Returns the length of the string
+u32 float_to_string_vprintf(f64 value, s32 precision, char* buffer)
 {
-    if (decimal_digits > 20)
+    char* it = buffer;
+    u64 bits = f64_to_bits(value);
+    bool shortest = precision < 0;
+
+    if (precision > FLOAT_MAX_PRECISION)
+    {
+        precision = FLOAT_MAX_PRECISION;
+    }
+
+    if (bits >> 63)
+    {
+        *it++ = '-';
+    }
+
+    if (((bits >> 52) & 0x7ff) == 0x7ff)
     {
-        decimal_digits = 20;
+        const char* special = (bits & DOUBLE_SIGNIFICAND_MASK) ? "nan" : "inf";
+        memcpy(it, special, 4);
+        return (u32)(it - buffer) + 3;
     }
 
-    char signed_buffer[128];
-    signed_to_string_vprintf((s64)value, signed_buffer);
+    char digits[24];
+    u32 length = 1;
+    s32 point = 1;
+    digits[0] = '0';
 
-    if (value < 0)
+    if (bits << 1)
     {
-        value *= -1;
+        s32 decimal_exponent;
+        length = grisu2(value < 0 ? -value : value, digits, &decimal_exponent);
+        point = (s32)length + decimal_exponent;
     }
 
-    char* int_ptr = signed_buffer;
-    char* float_ptr = buffer;
+    bool exponent_notation = point > FLOAT_MAX_FIXED_EXPONENT || (shortest && point <= FLOAT_MIN_FIXED_EXPONENT);
 
-    while (*int_ptr)
+    if (exponent_notation)
     {
-        *float_ptr++ = *int_ptr++;
+        // d.ddd followed by the exponent of the first digit
+        if (!shortest)
+        {
+            length = round_digits(digits, length, precision + 1, &point);
+        }
+
+        *it++ = digits[0];
+        u32 decimals = shortest ? length - 1 : (u32)precision;
+        if (decimals)
+        {
+            *it++ = '.';
+            for (u32 i = 1; i <= decimals; i++)
+            {
+                *it++ = i < length ? digits[i] : '0';
+            }
+        }
+
+        it = write_exponent(it, point - 1);
+        return it - buffer;
     }
 
-    *float_ptr++ = '.';
+    if (!shortest)
+    {
+        length = round_digits(digits, length, point + precision, &point);
+        if (length == 0)
+        {
+            point = 1;
+        }
+    }
 
-    f64 new_value = value - (s64)value;
+    if (point <= 0)
+    {
+        *it++ = '0';
+    }
+    else
+    {
+        for (s32 i = 0; i < point; i++)
+        {
+            *it++ = i < (s32)length ? digits[i] : '0';
+        }
+    }
 
-    for (u8 i = 0; i < decimal_digits; i++)
+    s32 decimals = shortest ? ((s32)length - point > 0 ? (s32)length - point : 1) : precision;
+    if (decimals)
     {
-        new_value *= 10;
-        *float_ptr++ = (s64)new_value + '0';
-        new_value -= (s64)new_value;
+        *it++ = '.';
+        for (s32 i = 0; i < decimals; i++)
+        {
+            s32 index = point + i;
+            *it++ = index >= 0 && index < (s32)length ? digits[index] : '0';
+        }
     }
 
-    *float_ptr = 0;
+    *it = 0;
+    return it - buffer;
 }
 
 typedef enum FormattingMode
@@ -332,7 +942,6 @@ FormattingMode find_formatting_mode(const char *str, u32 i)
 }
 
 
-void panic(const char*, ...);
 s32 println(const char*, ...);
 s32 print(const char*, ...);
 s32 vprint(const char*, va_list list);
@@ -345,217 +954,757 @@ void _assert(bool condition, const char* condition_name)
     }
 }
 
-// @TODO: this is just 8-bit memset
-void memset(void* address, u8 value, u64 bytes)
+// Copies backwards, for overlapping buffers where dst is above src. Requires bytes > 16
+static void memmove_backward_SSE2(void* dst, const void* src, usize bytes)
 {
-    u8* it = (u8*)address;
-    for (u64 i = 0; i < bytes; i++)
+    u8* d = dst;
+    const u8* s = src;
+    Vector16 head = *(Vector16_unaligned*)s;
+    Vector16 tail = *(Vector16_unaligned*)(s + bytes - 16);
+
+    u8* d_end = d + bytes;
+    usize skew = (u64)d_end & 15;
+    u8* it = d_end - skew;
+    const u8* s_it = s + bytes - skew;
+
+    for (; (u64)(it - d) >= 64; )
+    {
+        it -= 64;
+        s_it -= 64;
+        Vector16 a = *(Vector16_unaligned*)(s_it + 48);
+        Vector16 b = *(Vector16_unaligned*)(s_it + 32);
+        Vector16 c = *(Vector16_unaligned*)(s_it + 16);
+        Vector16 e = *(Vector16_unaligned*)(s_it + 0);
+        *(Vector16*)(it + 48) = a;
+        *(Vector16*)(it + 32) = b;
+        *(Vector16*)(it + 16) = c;
+        *(Vector16*)(it + 0) = e;
+    }
+
+    for (; (u64)(it - d) >= 16; )
     {
-        it[i] = value;
+        it -= 16;
+        s_it -= 16;
+        *(Vector16*)it = *(Vector16_unaligned*)s_it;
     }
+
+    *(Vector16_unaligned*)(d_end - 16) = tail;
+    *(Vector16_unaligned*)d = head;
 }
 
-s32 vprint(const char* format, va_list list)
+void* memmove(void* dst, const void* src, usize bytes)
 {
-    char buffer[128];
-    s32 char_count = 0;
+    u64 distance = (u64)dst - (u64)src;
 
-    for (u32 i = 0; format[i]; i++)
+    // A forward copy is correct unless dst starts inside [src, src + bytes)
+    if (bytes <= 16)
     {
-        char c = format[i];
-        bool formatting_mode = c == '%';
+        memcpy_small(dst, src, bytes);
+    }
+    else if (distance >= bytes)
+    {
+        memcpy(dst, src, bytes);
+    }
+    else if (distance != 0)
+    {
+        memmove_backward_SSE2(dst, src, bytes);
+    }
 
-        switch (c)
-        {
-            case '%':
-                {
-                    FormattingMode mode;
-                    if (format[i + 1])
-                    {
-                        mode = find_formatting_mode(format, i);
-                    }
-                    else
+    return dst;
+}
+
+enum
+{
+    NON_TEMPORAL_THRESHOLD = 256,
+};
+
+// Non-temporal variants: the stores bypass the cache, so multi-megabyte transfers into the framebuffer
+// or MMIO do not evict the working set. Small transfers fall back to the regular routines
+void* memcpy_nt(void* dst, const void* src, usize bytes)
+{
+    if (bytes < NON_TEMPORAL_THRESHOLD)
+    {
+        return memcpy(dst, src, bytes);
+    }
+
+    u8* d = dst;
+    const u8* s = src;
+    u8* d_end = d + bytes;
+    usize skew = 16 - ((u64)d & 15);
+
+    *(Vector16_unaligned*)d = *(Vector16_unaligned*)s;
+    u8* it = d + skew;
+    s += skew;
+
+    for (; it + 64 <= d_end; it += 64, s += 64)
+    {
+        Vector16 a = *(Vector16_unaligned*)(s + 0);
+        Vector16 b = *(Vector16_unaligned*)(s + 16);
+        Vector16 c = *(Vector16_unaligned*)(s + 32);
+        Vector16 e = *(Vector16_unaligned*)(s + 48);
+        __builtin_ia32_movntdq((Vector16_builtin*)(it + 0), (Vector16_builtin)a);
+        __builtin_ia32_movntdq((Vector16_builtin*)(it + 16), (Vector16_builtin)b);
+        __builtin_ia32_movntdq((Vector16_builtin*)(it + 32), (Vector16_builtin)c);
+        __builtin_ia32_movntdq((Vector16_builtin*)(it + 48), (Vector16_builtin)e);
+    }
+
+    for (; it + 16 <= d_end; it += 16, s += 16)
+    {
+        __builtin_ia32_movntdq((Vector16_builtin*)it, (Vector16_builtin)*(Vector16_unaligned*)s);
+    }
+
+    *(Vector16_unaligned*)(d_end - 16) = *(Vector16_unaligned*)((const u8*)src + bytes - 16);
+
+    // Non-temporal stores are weakly ordered
+    __builtin_ia32_sfence();
+
+    return dst;
+}
+
+static void memset_pattern_nt(void* dst, u64 pattern, usize bytes)
+{
+    u8* d = dst;
+    Vector16 value = { (s64)pattern, (s64)pattern };
+    u8* d_end = d + bytes;
+    u8* it = d + 16 - ((u64)d & 15);
+
+    *(Vector16_unaligned*)d = value;
+
+    for (; it + 64 <= d_end; it += 64)
+    {
+        __builtin_ia32_movntdq((Vector16_builtin*)(it + 0), (Vector16_builtin)value);
+        __builtin_ia32_movntdq((Vector16_builtin*)(it + 16), (Vector16_builtin)value);
+        __builtin_ia32_movntdq((Vector16_builtin*)(it + 32), (Vector16_builtin)value);
+        __builtin_ia32_movntdq((Vector16_builtin*)(it + 48), (Vector16_builtin)value);
+    }
+
+    for (; it + 16 <= d_end; it += 16)
+    {
+        __builtin_ia32_movntdq((Vector16_builtin*)it, (Vector16_builtin)value);
+    }
+
+    *(Vector16_unaligned*)(d_end - 16) = value;
+
+    __builtin_ia32_sfence();
+}
+
+void memset_nt(void* dst, u8 value, usize bytes)
+{
+    if (bytes < NON_TEMPORAL_THRESHOLD)
+    {
+        memset(dst, value, bytes);
+        return;
+    }
+
+    memset_pattern_nt(dst, value * 0x0101010101010101ULL, bytes);
+}
+
+// Fills count 32-bit values (e.g. pixels). dst must be 4-byte aligned
+void memset32_nt(void* dst, u32 value, usize count)
+{
+    u64 pattern = ((u64)value << 32) | value;
+    usize bytes = count * sizeof(u32);
+
+    if (bytes < NON_TEMPORAL_THRESHOLD)
+    {
+        u32* it = dst;
+        for (usize i = 0; i < count; i++)
+        {
+            it[i] = value;
+        }
+        return;
+    }
+
+    memset_pattern_nt(dst, pattern, bytes);
+}
+
+void memset(void* address, u8 value, u64 bytes)
+{
+    u64 pattern = value * 0x0101010101010101ULL;
+
+    if (bytes <= 16)
+    {
+        memset_small(address, pattern, bytes);
+    }
+    else if (bytes >= rep_string_threshold)
+    {
+        rep_stosb(address, value, bytes);
+    }
+    else if (bytes > memcpy_vector_min)
+    {
+        memset_vector(address, pattern, bytes);
+    }
+    else
+    {
+        memset_SSE2(address, pattern, bytes);
+    }
+}
+
+// Cached counterpart of memset32_nt, for memory that is about to be read again. dst must be 4-byte
+// aligned: the pattern then lines up with every store, unaligned head and tail included
+void memset32(void* dst, u32 value, usize count)
+{
+    u64 pattern = ((u64)value << 32) | value;
+    usize bytes = count * sizeof(u32);
+
+    if (bytes <= 16)
+    {
+        memset_small(dst, pattern, bytes);
+    }
+    else if (bytes > memcpy_vector_min)
+    {
+        memset_vector(dst, pattern, bytes);
+    }
+    else
+    {
+        memset_SSE2(dst, pattern, bytes);
+    }
+}
+
+enum
+{
+    FORMAT_CHUNK_SIZE = 256,
+};
+
+// Output is staged in a small chunk and handed to the sink in one call when full, so sinks
+// see a few large writes per format call instead of one per character
+typedef struct FormatWriter
+{
+    FormatSink* sink;
+    usize total;
+    u32 used;
+    char chunk[FORMAT_CHUNK_SIZE];
+} FormatWriter;
+
+static void format_flush(FormatWriter* writer)
+{
+    if (writer->used)
+    {
+        writer->sink->write(writer->sink, writer->chunk, writer->used);
+        writer->used = 0;
+    }
+}
+
+static void format_emit(FormatWriter* writer, const char* data, usize length)
+{
+    writer->total += length;
+
+    if (writer->used + length > FORMAT_CHUNK_SIZE)
+    {
+        format_flush(writer);
+
+        if (length >= FORMAT_CHUNK_SIZE)
+        {
+            writer->sink->write(writer->sink, data, length);
+            return;
+        }
+    }
+
+    memcpy(writer->chunk + writer->used, data, length);
+    writer->used += length;
+}
+
+static void format_emit_fill(FormatWriter* writer, char fill, usize count)
+{
+    writer->total += count;
+
+    while (count)
+    {
+        if (writer->used == FORMAT_CHUNK_SIZE)
+        {
+            format_flush(writer);
+        }
+
+        u32 run = FORMAT_CHUNK_SIZE - writer->used;
+        if (run > count)
+        {
+            run = count;
+        }
+
+        memset(writer->chunk + writer->used, fill, run);
+        writer->used += run;
+        count -= run;
+    }
+}
+
+typedef struct FormatSpec
+{
+    u32 width;
+    u32 precision;
+    char fill;
+    bool left_align;
+    bool has_precision;
+} FormatSpec;
+
+static u32 parse_format_number(const char* format, u32* i, va_list* list)
+{
+    if (format[*i] == '*')
+    {
+        (*i)++;
+        return va_arg(*list, u32);
+    }
+
+    u32 value = 0;
+    while (format[*i] >= '0' && format[*i] <= '9')
+    {
+        value = value * 10 + (format[*i] - '0');
+        (*i)++;
+    }
+
+    return value;
+}
+
+// Parses the optional "[flags width .precision]" block following a '%'. Flags are '-' (left align),
+// '0' (zero fill) and '\'' followed by any fill character. Returns false if the block is malformed
+static bool parse_format_spec(const char* format, u32* i, va_list* list, FormatSpec* spec)
+{
+    *spec = (FormatSpec) { .fill = ' ' };
+
+    if (format[*i] != '[')
+    {
+        return true;
+    }
+
+    (*i)++;
+
+    for (;;)
+    {
+        char c = format[*i];
+        if (c == '-')
+        {
+            spec->left_align = true;
+        }
+        else if (c == '0')
+        {
+            spec->fill = '0';
+        }
+        else if (c == '\'' && format[*i + 1])
+        {
+            (*i)++;
+            spec->fill = format[*i];
+        }
+        else
+        {
+            break;
+        }
+        (*i)++;
+    }
+
+    spec->width = parse_format_number(format, i, list);
+
+    if (format[*i] == '.')
+    {
+        (*i)++;
+        spec->has_precision = true;
+        spec->precision = parse_format_number(format, i, list);
+    }
+
+    if (format[*i] != ']')
+    {
+        return false;
+    }
+
+    (*i)++;
+    return true;
+}
+
+static void format_emit_field(FormatWriter* writer, const FormatSpec* spec, const char* text, usize length)
+{
+    usize padding = spec->width > length ? spec->width - length : 0;
+
+    if (spec->left_align)
+    {
+        format_emit(writer, text, length);
+        format_emit_fill(writer, ' ', padding);
+        return;
+    }
+
+    // Zero fill goes between the sign and the digits
+    if (spec->fill == '0' && padding && length && text[0] == '-')
+    {
+        format_emit(writer, text, 1);
+        text++;
+        length--;
+    }
+
+    format_emit_fill(writer, spec->fill, padding);
+    format_emit(writer, text, length);
+}
+
+// Formats into writer without flushing it, so callers can append before the sink sees the output
+static void vformat_writer(FormatWriter* writer, const char* format, va_list list)
+{
+    char buffer[128];
+    va_list args;
+    va_copy(args, list);
+
+    for (u32 i = 0; format[i]; i++)
+    {
+        char c = format[i];
+
+        switch (c)
+        {
+            case '%':
+                {
+                    FormatSpec spec;
+                    u32 spec_end = i + 1;
+                    FormattingMode mode = Error;
+
+                    if (parse_format_spec(format, &spec_end, &args, &spec) && format[spec_end])
                     {
-                        mode = Error;
+                        // The type lookup and the per-type advances below are relative to the '%'
+                        i = spec_end - 1;
+                        mode = find_formatting_mode(format, i);
                     }
 
                     if (mode) // No error
                     {
-                        char* write_here = buffer;
+                        const char* write_here = buffer;
+                        usize length = 0;
                         switch (mode)
                         {
                             case String:
                                 {
                                     i++;
-                                    write_here = va_arg(list, char*);
+                                    write_here = va_arg(args, char*);
+                                    if (spec.has_precision)
+                                    {
+                                        while (length < spec.precision && write_here[length])
+                                        {
+                                            length++;
+                                        }
+                                    }
+                                    else
+                                    {
+                                        length = strlen(write_here);
+                                    }
                                     break;
                                 }
                             case UnsignedInteger8:
                                 {
                                     i += 2;
-                                    u8 value = (u8)va_arg(list, u32);
-                                    unsigned_to_string_vprintf(value, write_here);
+                                    u8 value = (u8)va_arg(args, u32);
+                                    length = unsigned_to_string_vprintf(value, buffer);
                                     break;
                                 }
                             case UnsignedInteger16:
                                 {
                                     i += 3;
-                                    u16 value = (u16)va_arg(list, u32);
-                                    unsigned_to_string_vprintf(value, write_here);
+                                    u16 value = (u16)va_arg(args, u32);
+                                    length = unsigned_to_string_vprintf(value, buffer);
                                     break;
                                 }
                             case UnsignedInteger32:
                                 {
                                     i += 3;
-                                    u32 value = (u32)va_arg(list, u32);
-                                    unsigned_to_string_vprintf(value, write_here);
+                                    u32 value = (u32)va_arg(args, u32);
+                                    length = unsigned_to_string_vprintf(value, buffer);
                                     break;
                                 }
                             case UnsignedInteger64:
                                 {
                                     i += 3;
-                                    u64 value = (u64)va_arg(list, u64);
-                                    unsigned_to_string_vprintf(value, write_here);
+                                    u64 value = (u64)va_arg(args, u64);
+                                    length = unsigned_to_string_vprintf(value, buffer);
                                     break;
                                 }
                             case SignedInteger8:
                                 {
                                     i += 2;
-                                    s8 value = (s8)va_arg(list, s32);
-                                    signed_to_string_vprintf(value, write_here);
+                                    s8 value = (s8)va_arg(args, s32);
+                                    length = signed_to_string_vprintf(value, buffer);
                                     break;
                                 }
                             case SignedInteger16:
                                 {
                                     i += 3;
-                                    s16 value = (s16)va_arg(list, s32);
-                                    signed_to_string_vprintf(value, write_here);
+                                    s16 value = (s16)va_arg(args, s32);
+                                    length = signed_to_string_vprintf(value, buffer);
                                     break;
                                 }
                             case SignedInteger32:
                                 {
                                     i += 3;
-                                    s32 value = (s32)va_arg(list, s32);
-                                    signed_to_string_vprintf(value, write_here);
+                                    s32 value = (s32)va_arg(args, s32);
+                                    length = signed_to_string_vprintf(value, buffer);
                                     break;
                                 }
                             case SignedInteger64:
                                 {
                                     i += 3;
-                                    s64 value = (s64)va_arg(list, s64);
-                                    signed_to_string_vprintf(value, write_here);
+                                    s64 value = (s64)va_arg(args, s64);
+                                    length = signed_to_string_vprintf(value, buffer);
                                     break;
                                 }
                             case Hexadecimal8:
                                 {
                                     i += 2;
-                                    u8 value = (u8)va_arg(list, u32);
-                                    hex_to_string_u8_vprintf(value, write_here);
+                                    u8 value = (u8)va_arg(args, u32);
+                                    length = hex_to_string_u8_vprintf(value, buffer);
                                     break;
                                 }
                             case Hexadecimal16:
                                 {
                                     i += 3;
-                                    u16 value = (u16)va_arg(list, u32);
-                                    hex_to_string_u16_vprintf(value, write_here);
+                                    u16 value = (u16)va_arg(args, u32);
+                                    length = hex_to_string_u16_vprintf(value, buffer);
                                     break;
                                 }
                             case Hexadecimal32:
                                 {
                                     i += 3;
-                                    u32 value = (u32)va_arg(list, u32);
-                                    hex_to_string_u32_vprintf(value, write_here);
+                                    u32 value = (u32)va_arg(args, u32);
+                                    length = hex_to_string_u32_vprintf(value, buffer);
                                     break;
                                 }
                             case Hexadecimal64:
                                 {
                                     i += 3;
-                                    u64 value = (u64)va_arg(list, u64);
-                                    hex_to_string_u64_vprintf(value, write_here);
+                                    u64 value = (u64)va_arg(args, u64);
+                                    length = hex_to_string_u64_vprintf(value, buffer);
+                                    break;
+                                }
+                            case Binary8:
+                                {
+                                    i += 2;
+                                    u8 value = (u8)va_arg(args, u32);
+                                    length = binary_to_string_bytes_vprintf(value, sizeof(u8), buffer);
+                                    break;
+                                }
+                            case Binary16:
+                                {
+                                    i += 3;
+                                    u16 value = (u16)va_arg(args, u32);
+                                    length = binary_to_string_bytes_vprintf(value, sizeof(u16), buffer);
+                                    break;
+                                }
+                            case Binary32:
+                                {
+                                    i += 3;
+                                    u32 value = (u32)va_arg(args, u32);
+                                    length = binary_to_string_bytes_vprintf(value, sizeof(u32), buffer);
                                     break;
                                 }
-                            case Binary8: case Binary16: case Binary32: case Binary64:
+                            case Binary64:
                                 {
-                                    // @TODO: implement
+                                    i += 3;
+                                    u64 value = (u64)va_arg(args, u64);
+                                    length = binary_to_string_bytes_vprintf(value, sizeof(u64), buffer);
                                     break;
                                 }
                             case Float:
                                 {
                                     i++;
-                                    f64 value = va_arg(list, f64);
-                                    float_to_string_vprintf(value, 5, write_here);
+                                    f64 value = va_arg(args, f64);
+                                    length = float_to_string_vprintf(value, spec.has_precision ? (s32)spec.precision : -1, buffer);
                                     break;
                                 }
                             case Char:
                                 {
                                     i++;
-                                    char value = (char)va_arg(list, u32);
-                                    write_here[0] = value;
-                                    write_here[1] = 0;
+                                    buffer[0] = (char)va_arg(args, u32);
+                                    length = 1;
                                     break;
                                 }
                             case Bool:
                                 {
                                     i++;
-                                    bool value = (bool)va_arg(list, u32);
-                                    if (value)
-                                    {
-                                        write_here[0] = 't';
-                                        write_here[1] = 'r';
-                                        write_here[2] = 'u';
-                                        write_here[3] = 'e';
-                                        write_here[4] = '\0';
-                                    }
-                                    else
-                                    {
-                                        write_here[0] = 'f';
-                                        write_here[1] = 'a';
-                                        write_here[2] = 'l';
-                                        write_here[3] = 's';
-                                        write_here[4] = 'e';
-                                        write_here[5] = '\0';
-                                    }
+                                    bool value = (bool)va_arg(args, u32);
+                                    write_here = value ? "true" : "false";
+                                    length = value ? 4 : 5;
+                                    break;
                                 }
                             default:
                                 break;
                         }
 
-                        char c;
-                        for (u32 i = 0; (c = write_here[i]); i++)
-                        {
-                            putc(c);
-                            char_count++;
-                        }
+                        format_emit_field(writer, &spec, write_here, length);
                     }
                     else
                     {
-error:
                         assert("This is an error" && false);
-                        return char_count;
+                        va_end(args);
+                        return;
                     }
                 }
                 break;
             case '\t':
-                putc(' ');
-                char_count++;
-                while (char_count % 4 != 0)
+                format_emit_fill(writer, ' ', 4 - (writer->total % 4));
+                break;
+            default:
                 {
-                    putc(' ');
-                    char_count++;
+                    // Literal text is emitted as one run up to the next directive
+                    u32 run_end = i + 1;
+                    while (format[run_end] && format[run_end] != '%' && format[run_end] != '\t')
+                    {
+                        run_end++;
+                    }
+
+                    format_emit(writer, &format[i], run_end - i);
+                    i = run_end - 1;
                 }
                 break;
-            case '\n':
-                new_line();
-                char_count++;
+        }
+    }
+
+    va_end(args);
+}
+
+// Directives are %[spec]<type>, where spec is optional and described in parse_format_spec(). Precision
+// is the maximum length for %s and the number of decimals for %f, which otherwise prints the shortest
+// representation that reads back as the same value. Returns the number of characters produced
+s32 vformat(FormatSink* sink, const char* format, va_list list)
+{
+    FormatWriter writer;
+    writer.sink = sink;
+    writer.total = 0;
+    writer.used = 0;
+
+    vformat_writer(&writer, format, list);
+    format_flush(&writer);
+
+    return writer.total;
+}
+
+// Emits a FormatArgKind_End-terminated argument list built by the typed_print.h macros. Same output
+// as the equivalent vformat() directives, without parsing a format string
+s32 format_args(FormatSink* sink, const FormatArg* args)
+{
+    FormatWriter writer;
+    writer.sink = sink;
+    writer.total = 0;
+    writer.used = 0;
+
+    char buffer[128];
+
+    for (const FormatArg* arg = args; arg->kind != FormatArgKind_End; arg++)
+    {
+        FormatSpec spec = { .width = arg->width, .fill = ' ' };
+        const char* text = buffer;
+        usize length = 0;
+
+        switch (arg->kind)
+        {
+            case FormatArgKind_String:
+                text = arg->string;
+                length = strlen(text);
+                break;
+            case FormatArgKind_Char:
+                buffer[0] = (char)arg->unsigned_value;
+                length = 1;
+                break;
+            case FormatArgKind_Bool:
+                text = arg->unsigned_value ? "true" : "false";
+                length = arg->unsigned_value ? 4 : 5;
+                break;
+            case FormatArgKind_Unsigned:
+                length = unsigned_to_string_vprintf(arg->unsigned_value, buffer);
+                break;
+            case FormatArgKind_Signed:
+                length = signed_to_string_vprintf(arg->signed_value, buffer);
+                break;
+            case FormatArgKind_Hexadecimal:
+                length = hex_to_string_bytes_vprintf(arg->unsigned_value, arg->bytes, buffer);
+                break;
+            case FormatArgKind_Binary:
+                length = binary_to_string_bytes_vprintf(arg->unsigned_value, arg->bytes, buffer);
+                break;
+            case FormatArgKind_Float:
+                length = float_to_string_vprintf(arg->float_value, arg->precision == FORMAT_PRECISION_SHORTEST ? -1 : arg->precision, buffer);
                 break;
             default:
-                putc(c);
-                char_count++;
                 break;
         }
+
+        format_emit_field(&writer, &spec, text, length);
     }
 
-    return char_count;
+    format_flush(&writer);
+
+    return writer.total;
+}
+
+// Renders through the putc()/new_line() console hooks
+static void framebuffer_sink_write(FormatSink* sink, const char* data, usize length)
+{
+    for (usize i = 0; i < length; i++)
+    {
+        if (data[i] == '\n')
+        {
+            new_line();
+        }
+        else
+        {
+            putc(data[i]);
+        }
+    }
+}
+
+FormatSink framebuffer_sink = { .write = framebuffer_sink_write };
+FormatSink* console_sink = &framebuffer_sink;
+
+// Keeps the longest prefix that fits, always leaving room for the terminator
+static void buffer_sink_write(FormatSink* sink, const char* data, usize length)
+{
+    BufferSink* buffer_sink = (BufferSink*)sink;
+
+    if (buffer_sink->length < buffer_sink->capacity)
+    {
+        usize space = buffer_sink->capacity - buffer_sink->length;
+        usize to_copy = length < space ? length : space;
+        memcpy(buffer_sink->buffer + buffer_sink->length, data, to_copy);
+    }
+
+    buffer_sink->length += length;
+}
+
+BufferSink buffer_sink_make(char* buffer, usize capacity)
+{
+    return (BufferSink)
+    {
+        .sink = { .write = buffer_sink_write },
+        .buffer = buffer,
+        .capacity = capacity ? capacity - 1 : 0,
+        .length = 0,
+    };
+}
+
+// Like C's vsnprintf: the output is truncated to capacity - 1 characters and terminated, and the
+// untruncated length is returned
+s32 vsnprintf(char* buffer, usize capacity, const char* format, va_list list)
+{
+    BufferSink sink = buffer_sink_make(buffer, capacity);
+    s32 length = vformat(&sink.sink, format, list);
+
+    if (capacity)
+    {
+        buffer[sink.length < sink.capacity ? sink.length : sink.capacity] = 0;
+    }
+
+    return length;
+}
+
+s32 snprintf(char* buffer, usize capacity, const char* format, ...)
+{
+    va_list list;
+    va_start(list, format);
+    s32 length = vsnprintf(buffer, capacity, format, list);
+    va_end(list);
+    return length;
+}
+
+s32 sink_print(FormatSink* sink, const char* format, ...)
+{
+    va_list list;
+    va_start(list, format);
+    s32 length = vformat(sink, format, list);
+    va_end(list);
+    return length;
+}
+
+s32 vprint(const char* format, va_list list)
+{
+    return vformat(console_sink, format, list);
 }
 
 s32 print(const char* format, ...)
@@ -568,14 +1717,23 @@ s32 print(const char* format, ...)
 
 }
 
+// The newline goes out in the same sink write as the text, so the log keeps the line in one piece
 s32 println(const char* format, ...)
 {
+    FormatWriter writer;
+    writer.sink = console_sink;
+    writer.total = 0;
+    writer.used = 0;
+
     va_list list;
     va_start(list, format);
-    s32 written_char_count = vprint(format, list);
+    vformat_writer(&writer, format, list);
     va_end(list);
-    new_line();
-    return written_char_count + 1;
+
+    format_emit(&writer, "\n", 1);
+    format_flush(&writer);
+
+    return writer.total;
 }
 
 char* strcpy(char* dst, const char* src)
@@ -594,51 +1752,70 @@ char* strcpy(char* dst, const char* src)
     return dst;
 }
 
-s32 strcmp(const char* lhs, const char* rhs)
+// Compares 16 bytes at a time. A block is only loaded as a whole when neither string can cross
+// into the next page inside it, since the bytes after the terminator might not be mapped
+s32 strncmp(const char* lhs, const char* rhs, usize count)
 {
-    char* lit = (char*)lhs;
-    char* rit = (char*)rhs;
+    const u8* l = (const u8*)lhs;
+    const u8* r = (const u8*)rhs;
+    VectorBytes16 zero = {0};
+    usize i = 0;
 
-    while (*lit == *rit)
+    while (i < count)
     {
-        if (*lit == 0)
+        if (count - i >= 16 && !crosses_page(l + i, 16) && !crosses_page(r + i, 16))
         {
-            return 0;
-        }
-        lit++;
-        rit++;
-    }
-
-    return *lit - *rit;
-}
+            VectorBytes16 a = *(VectorBytes16_unaligned*)(l + i);
+            VectorBytes16 b = *(VectorBytes16_unaligned*)(r + i);
+            u32 mask = byte_mask((VectorBytes16)((a != b) | (a == zero)));
+            if (mask)
+            {
+                i += __builtin_ctz(mask);
+                return (s32)l[i] - (s32)r[i];
+            }
 
-s32 strncmp(const char* lhs, const char* rhs, usize count)
-{
-    char* lit = (char*)lhs;
-    char* rit = (char*)rhs;
-    bool eq;
+            i += 16;
+            continue;
+        }
 
-    for (usize i = 0; i < count && (eq = *lit == *rit); i++, lit++, rit++)
-    {
-        if (*lit == 0)
+        usize block_end = count - i < 16 ? count : i + 16;
+        for (; i < block_end; i++)
         {
-            return 0;
+            if (l[i] != r[i] || l[i] == 0)
+            {
+                return (s32)l[i] - (s32)r[i];
+            }
         }
     }
 
-    return (*lit - *rit) * (!eq);
+    return 0;
+}
+
+s32 strcmp(const char* lhs, const char* rhs)
+{
+    return strncmp(lhs, rhs, UINT64_MAX);
 }
 
+// Aligned 16-byte loads never cross a page boundary, so reading the whole block holding the terminator is safe
 usize strlen(const char* s)
 {
-    char* it = (char*)s;
+    const char* aligned = (const char*)((u64)s & ~15ULL);
+    VectorBytes16 zero = {0};
 
-    while (*it)
+    u32 mask = byte_mask((VectorBytes16)(*(VectorBytes16*)aligned == zero)) >> ((u64)s & 15);
+    if (mask)
     {
-        it++;
+        return __builtin_ctz(mask);
     }
 
-    return it - s;
+    for (aligned += 16;; aligned += 16)
+    {
+        mask = byte_mask((VectorBytes16)(*(VectorBytes16*)aligned == zero));
+        if (mask)
+        {
+            return aligned + __builtin_ctz(mask) - s;
+        }
+    }
 }
 
 bool string_eq(const char* a, const char* b)
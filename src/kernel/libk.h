@@ -2,13 +2,55 @@
 #include "types.h"
 #define assert(x) _assert(x, #x)
 
+typedef struct CPUFeatures CPUFeatures;
+
+// libk has no dependencies of its own besides these hooks, which the environment provides: the
+// renderer in the kernel, stubs when libk.c is built for a hosted target. panic() comes from panic.h
+void putc(char c);
+void new_line(void);
+
+typedef struct FormatSink FormatSink;
+typedef void FormatSinkWriteFn(FormatSink* sink, const char* data, usize length);
+
+// Destination of vformat() output. Embed it as the first member to carry sink-specific state
+struct FormatSink
+{
+    FormatSinkWriteFn* write;
+};
+
+typedef struct BufferSink
+{
+    FormatSink sink;
+    char* buffer;
+    usize capacity;
+    usize length;
+} BufferSink;
+
+extern FormatSink framebuffer_sink;
+// Destination of print, println and tprint. Starts out as framebuffer_sink, the kernel redirects it
+// to its log once that is set up
+extern FormatSink* console_sink;
+
+s32 vformat(FormatSink* sink, const char* format, va_list va_args);
+s32 sink_print(FormatSink* sink, const char* format, ...);
+BufferSink buffer_sink_make(char* buffer, usize capacity);
+s32 vsnprintf(char* buffer, usize capacity, const char* format, va_list va_args);
+s32 snprintf(char* buffer, usize capacity, const char* format, ...);
 s32 vprint(const char* format, va_list va_args);
 s32 print(const char* format, ...);
 s32 println(const char* format, ...);
 bool memequal(const void* a, const void* b, usize bytes);
-void new_line();
 void memset(void* mem, u8 value, usize bytes);
 void* memcpy(void* dst, const void* src, usize bytes);
-extern void putc(char c);
+void* memmove(void* dst, const void* src, usize bytes);
+void* memcpy_nt(void* dst, const void* src, usize bytes);
+void memset_nt(void* dst, u8 value, usize bytes);
+void memset32(void* dst, u32 value, usize count);
+void memset32_nt(void* dst, u32 value, usize count);
+void libk_setup(const CPUFeatures* features);
 u64 string_to_unsigned(const char* str);
+usize strlen(const char* s);
+s32 strcmp(const char* lhs, const char* rhs);
+s32 strncmp(const char* lhs, const char* rhs, usize count);
+char* strcpy(char* dst, const char* src);
 bool string_eq(const char* a, const char* b);
\ No newline at end of file
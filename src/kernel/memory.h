@@ -0,0 +1,10 @@
+#pragma once
+#include "types.h"
+
+#define PAGE_SIZE 0x1000
+
+void* request_page(void);
+void* request_pages(u64 page_count);
+void free_page(void* address);
+void free_pages(void* address, u64 page_count);
+void memmap(void* virtual_memory, void* physical_memory);
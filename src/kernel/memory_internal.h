@@ -0,0 +1,9 @@
+#pragma once
+#include "memory.h"
+
+// Untraced page allocator entry points for the allocators layered on top of it (slab, kmalloc),
+// whose own callers are already traced as objects. Everything else goes through memory.h
+void* request_page_internal(void);
+void* request_pages_internal(u64 page_count);
+void free_page_internal(void* address);
+void free_pages_internal(void* address, u64 page_count);
@@ -1,18 +1,29 @@
 #include "panic.h"
 #include "renderer_internal.h"
 #include "libk.h"
+#include "klog.h"
 
 void panic(const char* format, ...)
 {
+    // The panic may have been raised while the renderer lock was held, so it is forcibly released
+    spin_lock_init(&renderer.lock);
+    // What runs after the panic (stack traces in the fault handlers, then a spin) never reaches
+    // another flush, so from here on everything is drawn straight to the framebuffer
+    renderer.back_buffer = NULL;
+    renderer.dirty_count = 0;
     renderer.clear_color = Color_Red;
     fb_clear();
     renderer.cursor_position = (Point){0};
     renderer.color = Color_Black;
+    // Nothing will flush the log anymore, so the panic report bypasses it
+    console_sink = &framebuffer_sink;
     println("Kernel panic");
-    new_line();
+    print("\n");
+    // Whatever was logged but not shown yet may explain what led here
+    klog_flush();
     va_list list;
     va_start(list, format);
     (void)vprint(format, list);
     va_end(list);
-    new_line();
+    print("\n");
 }
\ No newline at end of file
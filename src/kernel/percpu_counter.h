@@ -0,0 +1,60 @@
+#pragma once
+#include "types.h"
+#include "cpu.h"
+
+// Counter split in one slot per CPU, each on its own cache line. A CPU only ever writes its own
+// slot, with a single read-modify-write instruction that interrupt handlers on the same CPU cannot
+// tear, so updates need neither a lock prefix nor disabled interrupts and never move a cache line
+// between CPUs. Reads fold every slot: each slot is read atomically, but updates that race with
+// the fold may or may not be counted. The result is exact once the counter stops changing.
+//
+// Slots hold signed deltas: a CPU that only decrements ends up with a negative slot, only the sum
+// is meaningful.
+
+typedef struct ALIGN(CACHE_LINE_SIZE) PerCPUCounterSlot
+{
+    s64 value;
+} PerCPUCounterSlot;
+
+typedef struct PerCPUCounter
+{
+    PerCPUCounterSlot slots[CPU_MAX_COUNT];
+} PerCPUCounter;
+
+// Not safe against concurrent updates, meant for setup
+static inline void percpu_counter_init(PerCPUCounter* counter, s64 value)
+{
+    for (u32 i = 0; i < CPU_MAX_COUNT; i++)
+    {
+        counter->slots[i].value = 0;
+    }
+
+    counter->slots[0].value = value;
+}
+
+static inline void percpu_counter_add(PerCPUCounter* counter, s64 delta)
+{
+    asm volatile("addq %1, %0" : "+m"(counter->slots[cpu_get_id()].value) : "er"(delta));
+}
+
+static inline void percpu_counter_sub(PerCPUCounter* counter, s64 delta)
+{
+    percpu_counter_add(counter, -delta);
+}
+
+static inline void percpu_counter_inc(PerCPUCounter* counter)
+{
+    percpu_counter_add(counter, 1);
+}
+
+static inline s64 percpu_counter_sum(const PerCPUCounter* counter)
+{
+    s64 sum = 0;
+
+    for (u32 i = 0; i < CPU_MAX_COUNT; i++)
+    {
+        sum += __atomic_load_n(&counter->slots[i].value, __ATOMIC_RELAXED);
+    }
+
+    return sum;
+}
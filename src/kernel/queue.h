@@ -0,0 +1,168 @@
+#pragma once
+#include "types.h"
+#include "cpu.h"
+#include <stdatomic.h>
+
+// Bounded lock-free queues, generated per element type in the style of GEN_BUFFER_FUNCTIONS.
+// capacity must be a power of two. Indices are free-running and wrap through the mask.
+//
+// GEN_SPSC_QUEUE: one producer, one consumer (e.g. an interrupt handler feeding the main loop).
+// Both operations are wait-free. head and tail live on separate cache lines and each side keeps a
+// private copy of the other side's index, so the shared lines are only touched when the cached view
+// says the queue is full or empty.
+//
+// GEN_MPMC_QUEUE: any number of producers and consumers (Dmitry Vyukov's bounded queue). Every cell
+// carries a sequence number that tells whether it is ready to be written or read for a given lap,
+// so producers and consumers only contend on their own position counter.
+
+#define GEN_SPSC_QUEUE(name, type, capacity) \
+    _Static_assert(((capacity) & ((capacity) - 1)) == 0, #name " capacity must be a power of two"); \
+    \
+    typedef struct name \
+    { \
+        ALIGN(CACHE_LINE_SIZE) _Atomic u32 head; \
+        u32 cached_tail; \
+        ALIGN(CACHE_LINE_SIZE) _Atomic u32 tail; \
+        u32 cached_head; \
+        ALIGN(CACHE_LINE_SIZE) type slots[capacity]; \
+    } name; \
+    \
+    static inline void name##_init(name* queue) \
+    { \
+        atomic_init(&queue->head, 0); \
+        atomic_init(&queue->tail, 0); \
+        queue->cached_head = 0; \
+        queue->cached_tail = 0; \
+    } \
+    \
+    /* Producer side */ \
+    static inline bool name##_push(name* queue, type value) \
+    { \
+        u32 tail = atomic_load_explicit(&queue->tail, memory_order_relaxed); \
+        if (tail - queue->cached_head == (capacity)) \
+        { \
+            queue->cached_head = atomic_load_explicit(&queue->head, memory_order_acquire); \
+            if (tail - queue->cached_head == (capacity)) \
+            { \
+                return false; \
+            } \
+        } \
+        queue->slots[tail & ((capacity) - 1)] = value; \
+        /* Publishes the slot contents before the new tail */ \
+        atomic_store_explicit(&queue->tail, tail + 1, memory_order_release); \
+        return true; \
+    } \
+    \
+    /* Consumer side */ \
+    static inline bool name##_pop(name* queue, type* out_value) \
+    { \
+        u32 head = atomic_load_explicit(&queue->head, memory_order_relaxed); \
+        if (head == queue->cached_tail) \
+        { \
+            queue->cached_tail = atomic_load_explicit(&queue->tail, memory_order_acquire); \
+            if (head == queue->cached_tail) \
+            { \
+                return false; \
+            } \
+        } \
+        *out_value = queue->slots[head & ((capacity) - 1)]; \
+        /* The slot may be reused once the producer sees the new head */ \
+        atomic_store_explicit(&queue->head, head + 1, memory_order_release); \
+        return true; \
+    } \
+    \
+    /* Exact only when called from one of the two sides while the other is idle */ \
+    static inline u32 name##_count(name* queue) \
+    { \
+        return atomic_load_explicit(&queue->tail, memory_order_acquire) - atomic_load_explicit(&queue->head, memory_order_acquire); \
+    }
+
+#define GEN_MPMC_QUEUE(name, type, capacity) \
+    _Static_assert(((capacity) & ((capacity) - 1)) == 0, #name " capacity must be a power of two"); \
+    \
+    typedef struct name##Cell \
+    { \
+        _Atomic u64 sequence; \
+        type value; \
+    } name##Cell; \
+    \
+    typedef struct name \
+    { \
+        ALIGN(CACHE_LINE_SIZE) _Atomic u64 enqueue_position; \
+        ALIGN(CACHE_LINE_SIZE) _Atomic u64 dequeue_position; \
+        ALIGN(CACHE_LINE_SIZE) name##Cell cells[capacity]; \
+    } name; \
+    \
+    static inline void name##_init(name* queue) \
+    { \
+        for (u64 i = 0; i < (capacity); i++) \
+        { \
+            atomic_init(&queue->cells[i].sequence, i); \
+        } \
+        atomic_init(&queue->enqueue_position, 0); \
+        atomic_init(&queue->dequeue_position, 0); \
+    } \
+    \
+    static inline bool name##_push(name* queue, type value) \
+    { \
+        name##Cell* cell; \
+        u64 position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed); \
+        for (;;) \
+        { \
+            cell = &queue->cells[position & ((capacity) - 1)]; \
+            u64 sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire); \
+            s64 difference = (s64)(sequence - position); \
+            if (difference == 0) \
+            { \
+                /* The cell is free for this lap: claim the position */ \
+                if (atomic_compare_exchange_weak_explicit(&queue->enqueue_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) \
+                { \
+                    break; \
+                } \
+            } \
+            else if (difference < 0) \
+            { \
+                /* Still holds a value from the previous lap: full */ \
+                return false; \
+            } \
+            else \
+            { \
+                position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed); \
+            } \
+        } \
+        cell->value = value; \
+        atomic_store_explicit(&cell->sequence, position + 1, memory_order_release); \
+        return true; \
+    } \
+    \
+    static inline bool name##_pop(name* queue, type* out_value) \
+    { \
+        name##Cell* cell; \
+        u64 position = atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed); \
+        for (;;) \
+        { \
+            cell = &queue->cells[position & ((capacity) - 1)]; \
+            u64 sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire); \
+            s64 difference = (s64)(sequence - (position + 1)); \
+            if (difference == 0) \
+            { \
+                if (atomic_compare_exchange_weak_explicit(&queue->dequeue_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) \
+                { \
+                    break; \
+                } \
+            } \
+            else if (difference < 0) \
+            { \
+                /* Not written yet for this lap: empty */ \
+                return false; \
+            } \
+            else \
+            { \
+                position = atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed); \
+            } \
+        } \
+        *out_value = cell->value; \
+        /* Hands the cell to the producer of the next lap */ \
+        atomic_store_explicit(&cell->sequence, position + (capacity), memory_order_release); \
+        return true; \
+    }
@@ -0,0 +1,229 @@
+#include "radix_tree.h"
+#include "slab.h"
+#include "libk.h"
+#include "panic.h"
+
+static SlabCache* radix_tree_node_cache;
+
+void radix_tree_setup(void)
+{
+    radix_tree_node_cache = kmem_cache_create("radix_tree_node", sizeof(RadixTreeNode), CACHE_LINE_SIZE);
+    if (!radix_tree_node_cache)
+    {
+        panic("Failed to create radix_tree_node");
+    }
+}
+
+void radix_tree_init(RadixTree* tree)
+{
+    tree->root = NULL;
+    tree->height = 0;
+}
+
+static RadixTreeNode* radix_tree_node_alloc(RadixTreeNode* parent, u8 offset)
+{
+    RadixTreeNode* node = kmem_cache_alloc(radix_tree_node_cache);
+    if (node)
+    {
+        memset(node, 0, sizeof(*node));
+        node->parent = parent;
+        node->offset = offset;
+    }
+    return node;
+}
+
+static inline u64 radix_tree_max_index(u32 height)
+{
+    u32 bits = height * RADIX_TREE_MAP_SHIFT;
+    return bits >= 64 ? UINT64_MAX : (1ULL << bits) - 1;
+}
+
+// Drops root levels whose only child is slot 0
+static void radix_tree_shrink(RadixTree* tree)
+{
+    while (tree->height > 1 && tree->root->count == 1 && tree->root->slots[0])
+    {
+        RadixTreeNode* old_root = tree->root;
+        tree->root = old_root->slots[0];
+        tree->root->parent = NULL;
+        tree->height--;
+        kmem_cache_free(radix_tree_node_cache, old_root);
+    }
+}
+
+// Frees the empty nodes from node upwards, then the root levels that are no longer needed
+static void radix_tree_prune(RadixTree* tree, RadixTreeNode* node)
+{
+    while (node->count == 0)
+    {
+        RadixTreeNode* parent = node->parent;
+        u8 node_offset = node->offset;
+        kmem_cache_free(radix_tree_node_cache, node);
+
+        if (!parent)
+        {
+            radix_tree_init(tree);
+            return;
+        }
+
+        parent->slots[node_offset] = NULL;
+        parent->count--;
+        node = parent;
+    }
+
+    radix_tree_shrink(tree);
+}
+
+// Adds levels on top until index fits. The old root becomes slot 0 of the new one
+static bool radix_tree_extend(RadixTree* tree, u64 index)
+{
+    while (tree->height == 0 || index > radix_tree_max_index(tree->height))
+    {
+        RadixTreeNode* node = radix_tree_node_alloc(NULL, 0);
+        if (!node)
+        {
+            // Takes the levels added so far off again. Below them is either the old root, which
+            // is not empty, or the first new level, which is
+            if (tree->root)
+            {
+                RadixTreeNode* bottom = tree->root;
+                for (u32 level = 1; level < tree->height && bottom->slots[0]; level++)
+                {
+                    bottom = bottom->slots[0];
+                }
+                radix_tree_prune(tree, bottom);
+            }
+            return false;
+        }
+
+        if (tree->root)
+        {
+            node->slots[0] = tree->root;
+            node->count = 1;
+            tree->root->parent = node;
+        }
+
+        tree->root = node;
+        tree->height++;
+    }
+
+    return true;
+}
+
+bool radix_tree_insert(RadixTree* tree, u64 index, void* item)
+{
+    if (!radix_tree_extend(tree, index))
+    {
+        return false;
+    }
+
+    RadixTreeNode* node = tree->root;
+    u32 shift = (tree->height - 1) * RADIX_TREE_MAP_SHIFT;
+
+    for (; shift; shift -= RADIX_TREE_MAP_SHIFT)
+    {
+        u8 offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+        RadixTreeNode* child = node->slots[offset];
+        if (!child)
+        {
+            child = radix_tree_node_alloc(node, offset);
+            if (!child)
+            {
+                // Frees the path allocated by this call, which ends in the still empty node
+                radix_tree_prune(tree, node);
+                return false;
+            }
+            node->slots[offset] = child;
+            node->count++;
+        }
+        node = child;
+    }
+
+    u8 offset = index & RADIX_TREE_MAP_MASK;
+    if (node->slots[offset])
+    {
+        return false;
+    }
+
+    node->slots[offset] = item;
+    node->count++;
+    return true;
+}
+
+void* radix_tree_lookup(const RadixTree* tree, u64 index)
+{
+    if (tree->height == 0 || index > radix_tree_max_index(tree->height))
+    {
+        return NULL;
+    }
+
+    RadixTreeNode* node = tree->root;
+    u32 shift = (tree->height - 1) * RADIX_TREE_MAP_SHIFT;
+
+    for (; node && shift; shift -= RADIX_TREE_MAP_SHIFT)
+    {
+        node = node->slots[(index >> shift) & RADIX_TREE_MAP_MASK];
+    }
+
+    return node ? node->slots[index & RADIX_TREE_MAP_MASK] : NULL;
+}
+
+void* radix_tree_delete(RadixTree* tree, u64 index)
+{
+    if (tree->height == 0 || index > radix_tree_max_index(tree->height))
+    {
+        return NULL;
+    }
+
+    RadixTreeNode* node = tree->root;
+    u32 shift = (tree->height - 1) * RADIX_TREE_MAP_SHIFT;
+
+    for (; shift; shift -= RADIX_TREE_MAP_SHIFT)
+    {
+        node = node->slots[(index >> shift) & RADIX_TREE_MAP_MASK];
+        if (!node)
+        {
+            return NULL;
+        }
+    }
+
+    u8 offset = index & RADIX_TREE_MAP_MASK;
+    void* item = node->slots[offset];
+    if (!item)
+    {
+        return NULL;
+    }
+
+    node->slots[offset] = NULL;
+    node->count--;
+
+    radix_tree_prune(tree, node);
+    return item;
+}
+
+static void radix_tree_free_node(RadixTreeNode* node, u32 height)
+{
+    if (height > 1)
+    {
+        for (u32 i = 0; i < RADIX_TREE_MAP_SIZE; i++)
+        {
+            if (node->slots[i])
+            {
+                radix_tree_free_node(node->slots[i], height - 1);
+            }
+        }
+    }
+
+    kmem_cache_free(radix_tree_node_cache, node);
+}
+
+// Frees the nodes, not the items
+void radix_tree_free(RadixTree* tree)
+{
+    if (tree->root)
+    {
+        radix_tree_free_node(tree->root, tree->height);
+    }
+
+    radix_tree_init(tree);
+}
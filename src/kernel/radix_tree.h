@@ -0,0 +1,34 @@
+#pragma once
+#include "types.h"
+
+// Maps u64 indices (page frame numbers, file page offsets) to pointers. Each level consumes
+// RADIX_TREE_MAP_SHIFT bits of the index and the tree is only as tall as the largest index needs,
+// so dense small ranges stay one or two levels deep.
+
+#define RADIX_TREE_MAP_SHIFT 6
+#define RADIX_TREE_MAP_SIZE (1 << RADIX_TREE_MAP_SHIFT)
+#define RADIX_TREE_MAP_MASK (RADIX_TREE_MAP_SIZE - 1)
+
+typedef struct RadixTreeNode
+{
+    struct RadixTreeNode* parent;
+    // Position in the parent's slots
+    u8 offset;
+    u8 count;
+    void* slots[RADIX_TREE_MAP_SIZE];
+} RadixTreeNode;
+
+typedef struct RadixTree
+{
+    RadixTreeNode* root;
+    u32 height;
+} RadixTree;
+
+void radix_tree_setup(void);
+void radix_tree_init(RadixTree* tree);
+// Fails if the index is already occupied or a node cannot be allocated
+bool radix_tree_insert(RadixTree* tree, u64 index, void* item);
+void* radix_tree_lookup(const RadixTree* tree, u64 index);
+// Returns the removed item, or NULL if there was none
+void* radix_tree_delete(RadixTree* tree, u64 index);
+void radix_tree_free(RadixTree* tree);
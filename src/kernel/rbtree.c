@@ -0,0 +1,399 @@
+#include "rbtree.h"
+
+typedef enum RBColor
+{
+    RBColor_Red = 0,
+    RBColor_Black = 1,
+} RBColor;
+
+static inline RBColor rb_color(const RBNode* node)
+{
+    return node->parent_color & 1;
+}
+
+static inline bool rb_is_red(const RBNode* node)
+{
+    return node && rb_color(node) == RBColor_Red;
+}
+
+static inline bool rb_is_black(const RBNode* node)
+{
+    return !node || rb_color(node) == RBColor_Black;
+}
+
+static inline void rb_set_parent(RBNode* node, RBNode* parent)
+{
+    node->parent_color = (node->parent_color & 1) | (uptr)parent;
+}
+
+static inline void rb_set_color(RBNode* node, RBColor color)
+{
+    node->parent_color = (node->parent_color & ~(uptr)1) | color;
+}
+
+static inline void rb_replace_child(RBNode* parent, RBNode* old_child, RBNode* new_child, RBTree* tree)
+{
+    if (!parent)
+    {
+        tree->root = new_child;
+    }
+    else if (parent->left == old_child)
+    {
+        parent->left = new_child;
+    }
+    else
+    {
+        parent->right = new_child;
+    }
+}
+
+static void rb_rotate_left(RBNode* node, RBTree* tree)
+{
+    RBNode* right = node->right;
+    RBNode* parent = rb_parent(node);
+
+    node->right = right->left;
+    if (right->left)
+    {
+        rb_set_parent(right->left, node);
+    }
+
+    right->left = node;
+    rb_set_parent(right, parent);
+    rb_replace_child(parent, node, right, tree);
+    rb_set_parent(node, right);
+}
+
+static void rb_rotate_right(RBNode* node, RBTree* tree)
+{
+    RBNode* left = node->left;
+    RBNode* parent = rb_parent(node);
+
+    node->left = left->right;
+    if (left->right)
+    {
+        rb_set_parent(left->right, node);
+    }
+
+    left->right = node;
+    rb_set_parent(left, parent);
+    rb_replace_child(parent, node, left, tree);
+    rb_set_parent(node, left);
+}
+
+void rb_insert_color(RBNode* node, RBTree* tree)
+{
+    RBNode* parent;
+
+    while ((parent = rb_parent(node)) && rb_is_red(parent))
+    {
+        // A red parent is never the root, so the grandparent exists
+        RBNode* grandparent = rb_parent(parent);
+
+        if (parent == grandparent->left)
+        {
+            RBNode* uncle = grandparent->right;
+            if (rb_is_red(uncle))
+            {
+                rb_set_color(uncle, RBColor_Black);
+                rb_set_color(parent, RBColor_Black);
+                rb_set_color(grandparent, RBColor_Red);
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->right)
+            {
+                rb_rotate_left(parent, tree);
+                RBNode* tmp = parent;
+                parent = node;
+                node = tmp;
+            }
+
+            rb_set_color(parent, RBColor_Black);
+            rb_set_color(grandparent, RBColor_Red);
+            rb_rotate_right(grandparent, tree);
+        }
+        else
+        {
+            RBNode* uncle = grandparent->left;
+            if (rb_is_red(uncle))
+            {
+                rb_set_color(uncle, RBColor_Black);
+                rb_set_color(parent, RBColor_Black);
+                rb_set_color(grandparent, RBColor_Red);
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->left)
+            {
+                rb_rotate_right(parent, tree);
+                RBNode* tmp = parent;
+                parent = node;
+                node = tmp;
+            }
+
+            rb_set_color(parent, RBColor_Black);
+            rb_set_color(grandparent, RBColor_Red);
+            rb_rotate_left(grandparent, tree);
+        }
+    }
+
+    rb_set_color(tree->root, RBColor_Black);
+}
+
+// node (possibly NULL) carries an extra black; parent is passed separately for the NULL case
+static void rb_erase_color(RBNode* node, RBNode* parent, RBTree* tree)
+{
+    while (rb_is_black(node) && node != tree->root)
+    {
+        if (parent->left == node)
+        {
+            RBNode* sibling = parent->right;
+            if (rb_is_red(sibling))
+            {
+                rb_set_color(sibling, RBColor_Black);
+                rb_set_color(parent, RBColor_Red);
+                rb_rotate_left(parent, tree);
+                sibling = parent->right;
+            }
+
+            if (rb_is_black(sibling->left) && rb_is_black(sibling->right))
+            {
+                rb_set_color(sibling, RBColor_Red);
+                node = parent;
+                parent = rb_parent(node);
+                continue;
+            }
+
+            if (rb_is_black(sibling->right))
+            {
+                rb_set_color(sibling->left, RBColor_Black);
+                rb_set_color(sibling, RBColor_Red);
+                rb_rotate_right(sibling, tree);
+                sibling = parent->right;
+            }
+
+            rb_set_color(sibling, rb_color(parent));
+            rb_set_color(parent, RBColor_Black);
+            rb_set_color(sibling->right, RBColor_Black);
+            rb_rotate_left(parent, tree);
+            node = tree->root;
+            break;
+        }
+        else
+        {
+            RBNode* sibling = parent->left;
+            if (rb_is_red(sibling))
+            {
+                rb_set_color(sibling, RBColor_Black);
+                rb_set_color(parent, RBColor_Red);
+                rb_rotate_right(parent, tree);
+                sibling = parent->left;
+            }
+
+            if (rb_is_black(sibling->left) && rb_is_black(sibling->right))
+            {
+                rb_set_color(sibling, RBColor_Red);
+                node = parent;
+                parent = rb_parent(node);
+                continue;
+            }
+
+            if (rb_is_black(sibling->left))
+            {
+                rb_set_color(sibling->right, RBColor_Black);
+                rb_set_color(sibling, RBColor_Red);
+                rb_rotate_left(sibling, tree);
+                sibling = parent->left;
+            }
+
+            rb_set_color(sibling, rb_color(parent));
+            rb_set_color(parent, RBColor_Black);
+            rb_set_color(sibling->left, RBColor_Black);
+            rb_rotate_right(parent, tree);
+            node = tree->root;
+            break;
+        }
+    }
+
+    if (node)
+    {
+        rb_set_color(node, RBColor_Black);
+    }
+}
+
+void rb_erase(RBNode* node, RBTree* tree)
+{
+    RBNode* child;
+    RBNode* parent;
+    RBColor color;
+
+    if (node->left && node->right)
+    {
+        // Two children: the in-order successor takes the node's place and color
+        RBNode* old = node;
+        node = node->right;
+        while (node->left)
+        {
+            node = node->left;
+        }
+
+        rb_replace_child(rb_parent(old), old, node, tree);
+
+        child = node->right;
+        parent = rb_parent(node);
+        color = rb_color(node);
+
+        if (parent == old)
+        {
+            parent = node;
+        }
+        else
+        {
+            if (child)
+            {
+                rb_set_parent(child, parent);
+            }
+            parent->left = child;
+
+            node->right = old->right;
+            rb_set_parent(old->right, node);
+        }
+
+        node->parent_color = old->parent_color;
+        node->left = old->left;
+        rb_set_parent(old->left, node);
+    }
+    else
+    {
+        child = node->left ? node->left : node->right;
+        parent = rb_parent(node);
+        color = rb_color(node);
+
+        if (child)
+        {
+            rb_set_parent(child, parent);
+        }
+        rb_replace_child(parent, node, child, tree);
+    }
+
+    if (color == RBColor_Black)
+    {
+        rb_erase_color(child, parent, tree);
+    }
+}
+
+void rb_insert(RBTree* tree, RBNode* node, RBCompareFn* compare)
+{
+    RBNode** link = &tree->root;
+    RBNode* parent = NULL;
+
+    while (*link)
+    {
+        parent = *link;
+        link = compare(node, parent) < 0 ? &parent->left : &parent->right;
+    }
+
+    rb_link_node(node, parent, link);
+    rb_insert_color(node, tree);
+}
+
+RBNode* rb_find(const RBTree* tree, const void* key, RBCompareKeyFn* compare)
+{
+    RBNode* it = tree->root;
+
+    while (it)
+    {
+        s32 result = compare(key, it);
+        if (result == 0)
+        {
+            return it;
+        }
+        it = result < 0 ? it->left : it->right;
+    }
+
+    return NULL;
+}
+
+RBNode* rb_lower_bound(const RBTree* tree, const void* key, RBCompareKeyFn* compare)
+{
+    RBNode* it = tree->root;
+    RBNode* result = NULL;
+
+    while (it)
+    {
+        if (compare(key, it) <= 0)
+        {
+            result = it;
+            it = it->left;
+        }
+        else
+        {
+            it = it->right;
+        }
+    }
+
+    return result;
+}
+
+RBNode* rb_first(const RBTree* tree)
+{
+    RBNode* it = tree->root;
+    while (it && it->left)
+    {
+        it = it->left;
+    }
+    return it;
+}
+
+RBNode* rb_last(const RBTree* tree)
+{
+    RBNode* it = tree->root;
+    while (it && it->right)
+    {
+        it = it->right;
+    }
+    return it;
+}
+
+RBNode* rb_next(const RBNode* node)
+{
+    if (node->right)
+    {
+        node = node->right;
+        while (node->left)
+        {
+            node = node->left;
+        }
+        return (RBNode*)node;
+    }
+
+    RBNode* parent;
+    while ((parent = rb_parent(node)) && node == parent->right)
+    {
+        node = parent;
+    }
+    return parent;
+}
+
+RBNode* rb_prev(const RBNode* node)
+{
+    if (node->left)
+    {
+        node = node->left;
+        while (node->right)
+        {
+            node = node->right;
+        }
+        return (RBNode*)node;
+    }
+
+    RBNode* parent;
+    while ((parent = rb_parent(node)) && node == parent->left)
+    {
+        node = parent;
+    }
+    return parent;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "types.h"
+
+// Intrusive red-black tree: embed an RBNode in the structure to be indexed and get back to it with
+// container_of(). Nodes are three words, the color lives in the low bit of the parent pointer.
+//
+// Insertion is split in two so that the caller does the key comparisons inline:
+//
+//     RBNode** link = &tree->root;
+//     RBNode* parent = NULL;
+//     while (*link)
+//     {
+//         parent = *link;
+//         link = key < entry_of(parent)->key ? &parent->left : &parent->right;
+//     }
+//     rb_link_node(&entry->node, parent, link);
+//     rb_insert_color(&entry->node, tree);
+
+typedef struct ALIGN(sizeof(u64)) RBNode
+{
+    uptr parent_color;
+    struct RBNode* left;
+    struct RBNode* right;
+} RBNode;
+
+typedef struct RBTree
+{
+    RBNode* root;
+} RBTree;
+
+typedef s32 RBCompareFn(const RBNode* a, const RBNode* b);
+typedef s32 RBCompareKeyFn(const void* key, const RBNode* node);
+
+static inline RBNode* rb_parent(const RBNode* node)
+{
+    return (RBNode*)(node->parent_color & ~(uptr)1);
+}
+
+static inline void rb_link_node(RBNode* node, RBNode* parent, RBNode** link)
+{
+    // Linked red
+    node->parent_color = (uptr)parent;
+    node->left = node->right = NULL;
+    *link = node;
+}
+
+void rb_insert_color(RBNode* node, RBTree* tree);
+void rb_erase(RBNode* node, RBTree* tree);
+
+// Convenience wrappers for callers that prefer a comparison callback. Equal keys go to the right
+void rb_insert(RBTree* tree, RBNode* node, RBCompareFn* compare);
+RBNode* rb_find(const RBTree* tree, const void* key, RBCompareKeyFn* compare);
+// First node whose key is not less than key, e.g. the range that may contain an address
+RBNode* rb_lower_bound(const RBTree* tree, const void* key, RBCompareKeyFn* compare);
+
+RBNode* rb_first(const RBTree* tree);
+RBNode* rb_last(const RBTree* tree);
+RBNode* rb_next(const RBNode* node);
+RBNode* rb_prev(const RBNode* node);
@@ -0,0 +1,119 @@
+#include "rcu.h"
+#include "asm.h"
+#include "cpu.h"
+#include <stdatomic.h>
+
+// Every call to synchronize_rcu or call_rcu opens a new epoch. A CPU reporting a quiescent state
+// records the epoch it observed, so once the minimum over all CPUs reaches an epoch, no reader that
+// could have seen the pre-update data is still running.
+typedef struct ALIGN(CACHE_LINE_SIZE) RCUCPUData
+{
+    _Atomic u64 quiescent_epoch;
+    // FIFO of pending callbacks. Epochs are handed out in increasing order, so the ready ones are
+    // always a prefix of the list
+    RCUHead* callbacks;
+    RCUHead** callbacks_tail;
+} RCUCPUData;
+
+static ALIGN(CACHE_LINE_SIZE) _Atomic u64 rcu_epoch;
+static RCUCPUData rcu_cpu[CPU_MAX_COUNT];
+
+static void rcu_report_quiescent_state(RCUCPUData* data)
+{
+    // Sequentially consistent so that every read-side access of this CPU is complete before other
+    // CPUs can see the new epoch
+    atomic_store(&data->quiescent_epoch, atomic_load(&rcu_epoch));
+}
+
+static u64 rcu_completed_epoch(void)
+{
+    u64 completed = UINT64_MAX;
+
+    for (u32 i = 0; i < cpu_count; i++)
+    {
+        u64 epoch = atomic_load_explicit(&rcu_cpu[i].quiescent_epoch, memory_order_acquire);
+        if (epoch < completed)
+        {
+            completed = epoch;
+        }
+    }
+
+    return completed;
+}
+
+// Called from the idle loop, outside of any read-side critical section
+void rcu_quiescent_state(void)
+{
+    RCUCPUData* data = &rcu_cpu[cpu_get_id()];
+    rcu_report_quiescent_state(data);
+
+    if (!data->callbacks)
+    {
+        return;
+    }
+
+    u64 completed = rcu_completed_epoch();
+
+    u64 flags = interrupts_save_disable();
+
+    RCUHead* ready = NULL;
+    RCUHead** ready_tail = &ready;
+    while (data->callbacks && data->callbacks->epoch <= completed)
+    {
+        RCUHead* head = data->callbacks;
+        data->callbacks = head->next;
+        *ready_tail = head;
+        ready_tail = &head->next;
+    }
+    *ready_tail = NULL;
+
+    if (!data->callbacks)
+    {
+        data->callbacks_tail = &data->callbacks;
+    }
+
+    interrupts_restore(flags);
+
+    while (ready)
+    {
+        RCUHead* next = ready->next;
+        ready->callback(ready);
+        ready = next;
+    }
+}
+
+// Waits until every reader that may hold a reference to the data unpublished before the call is done.
+// Must not be called from a read-side critical section or an interrupt handler.
+void synchronize_rcu(void)
+{
+    u64 target = atomic_fetch_add(&rcu_epoch, 1) + 1;
+
+    // The caller is not inside a read-side section, so this CPU is quiescent already
+    rcu_report_quiescent_state(&rcu_cpu[cpu_get_id()]);
+
+    while (rcu_completed_epoch() < target)
+    {
+        cpu_relax();
+    }
+}
+
+// Safe from any context, including interrupt handlers and read-side sections
+void call_rcu(RCUHead* head, RCUCallback* callback)
+{
+    head->next = NULL;
+    head->callback = callback;
+
+    u64 flags = interrupts_save_disable();
+
+    RCUCPUData* data = &rcu_cpu[cpu_get_id()];
+    if (!data->callbacks)
+    {
+        data->callbacks_tail = &data->callbacks;
+    }
+
+    head->epoch = atomic_fetch_add(&rcu_epoch, 1) + 1;
+    *data->callbacks_tail = head;
+    data->callbacks_tail = &head->next;
+
+    interrupts_restore(flags);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "types.h"
+
+// Quiescent-state based RCU.
+//
+// Readers bracket their accesses with rcu_read_lock/rcu_read_unlock and load shared pointers through
+// rcu_dereference. Neither writes memory: the kernel is not preemptible, so a read-side critical
+// section simply ends before its CPU gets back to the idle loop, which is where quiescent states are
+// reported. A read-side section must therefore never wait for a grace period or halt the CPU.
+//
+// Writers publish a new version with rcu_assign_pointer (serialized among themselves by whatever lock
+// protects the update) and then either wait with synchronize_rcu or hand the old version to call_rcu,
+// whose callbacks run from the idle loop of the CPU that queued them once every CPU has gone through
+// a quiescent state.
+
+#define rcu_dereference(pointer) __atomic_load_n(&(pointer), __ATOMIC_CONSUME)
+#define rcu_assign_pointer(pointer, value) __atomic_store_n(&(pointer), (value), __ATOMIC_RELEASE)
+
+typedef struct RCUHead RCUHead;
+typedef void RCUCallback(RCUHead* head);
+
+// Embedded in the object to be reclaimed, recovered in the callback with container_of
+struct RCUHead
+{
+    RCUHead* next;
+    RCUCallback* callback;
+    u64 epoch;
+};
+
+static inline void rcu_read_lock(void)
+{
+    asm volatile("" : : : "memory");
+}
+
+static inline void rcu_read_unlock(void)
+{
+    asm volatile("" : : : "memory");
+}
+
+void rcu_quiescent_state(void);
+void synchronize_rcu(void);
+void call_rcu(RCUHead* head, RCUCallback* callback);
@@ -1,5 +1,6 @@
 #include "renderer_internal.h"
 #include "libk.h"
+#include "memory.h"
 
 Renderer renderer = {0};
 
@@ -27,11 +28,170 @@ static u32 mouse_cursor_buffer[array_length(mouse_pointer) * array_length(mouse_
 static u32 mouse_cursor_buffer_post_render[array_length(mouse_pointer) * array_length(mouse_pointer)];
 static bool mouse_never_drawn = true;
 
+// Where drawing goes: the back buffer once there is one. Both share the framebuffer's pitch
+static u32* draw_target(Renderer* renderer)
+{
+    return renderer->back_buffer ? renderer->back_buffer : (u32*)renderer->fb->base_address;
+}
+
+// The back buffer is read again by the next renderer_flush, so it is filled through the cache.
+// Only the framebuffer itself, written directly before renderer_setup, gets streaming stores
+static void fill_pixels(Renderer* renderer, u32* pixels, Color color, usize count)
+{
+    if (renderer->back_buffer)
+    {
+        memset32(pixels, color, count);
+    }
+    else
+    {
+        memset32_nt(pixels, color, count);
+    }
+}
+
+static bool rects_touch(Rect a, Rect b)
+{
+    return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1;
+}
+
+static Rect rect_union(Rect a, Rect b)
+{
+    return (Rect)
+    {
+        .x0 = a.x0 < b.x0 ? a.x0 : b.x0,
+        .y0 = a.y0 < b.y0 ? a.y0 : b.y0,
+        .x1 = a.x1 > b.x1 ? a.x1 : b.x1,
+        .y1 = a.y1 > b.y1 ? a.y1 : b.y1,
+    };
+}
+
+static s64 rect_area(Rect rect)
+{
+    return (rect.x1 - rect.x0) * (rect.y1 - rect.y0);
+}
+
+// Called with the renderer lock held
+static void mark_dirty(Renderer* renderer, Rect rect)
+{
+    if (!renderer->back_buffer)
+    {
+        return;
+    }
+
+    rect.x0 = rect.x0 < 0 ? 0 : rect.x0;
+    rect.y0 = rect.y0 < 0 ? 0 : rect.y0;
+    rect.x1 = rect.x1 > renderer->fb->width ? renderer->fb->width : rect.x1;
+    rect.y1 = rect.y1 > renderer->fb->height ? renderer->fb->height : rect.y1;
+    if (rect.x0 >= rect.x1 || rect.y0 >= rect.y1)
+    {
+        return;
+    }
+
+    // Consecutive characters of a line touch each other, so typing keeps extending a single rect
+    for (u32 i = 0; i < renderer->dirty_count; i++)
+    {
+        if (rects_touch(renderer->dirty[i], rect))
+        {
+            renderer->dirty[i] = rect_union(renderer->dirty[i], rect);
+            return;
+        }
+    }
+
+    if (renderer->dirty_count < RENDERER_MAX_DIRTY_RECTS)
+    {
+        renderer->dirty[renderer->dirty_count++] = rect;
+        return;
+    }
+
+    // Out of slots: grow whichever rect takes in the least extra area
+    u32 best = 0;
+    s64 best_growth = INT64_MAX;
+    for (u32 i = 0; i < renderer->dirty_count; i++)
+    {
+        s64 growth = rect_area(rect_union(renderer->dirty[i], rect)) - rect_area(renderer->dirty[i]);
+        if (growth < best_growth)
+        {
+            best = i;
+            best_growth = growth;
+        }
+    }
+
+    renderer->dirty[best] = rect_union(renderer->dirty[best], rect);
+}
+
+static void mark_all_dirty(Renderer* renderer)
+{
+    renderer->dirty_count = 0;
+    mark_dirty(renderer, (Rect) { .x0 = 0, .y0 = 0, .x1 = renderer->fb->width, .y1 = renderer->fb->height });
+}
+
+// Moves drawing off the framebuffer, which is uncached or write-combined and so very slow to read
+// back (scrolling) and to write in scattered pixels (glyphs). Without the pages drawing stays direct
+void renderer_setup(void)
+{
+    Framebuffer* fb = renderer.fb;
+    u64 bytes = (u64)fb->pixels_per_scanline * fb->height * sizeof(u32);
+    u32* back_buffer = request_pages((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+
+    if (!back_buffer)
+    {
+        return;
+    }
+
+    u64 flags = spin_lock_irqsave(&renderer.lock);
+    // Starts out as whatever is on the screen
+    memcpy(back_buffer, fb->base_address, bytes);
+    renderer.back_buffer = back_buffer;
+    renderer.dirty_count = 0;
+    spin_unlock_irqrestore(&renderer.lock, flags);
+}
+
+// Copies the damaged areas to the framebuffer with streaming stores, so the destination is never
+// read nor pulled into the cache. Called once per idle loop iteration, which batches everything
+// drawn since the last one (a burst of scrolls costs a single full screen copy)
+void renderer_flush(void)
+{
+    Rect dirty[RENDERER_MAX_DIRTY_RECTS];
+
+    // Drawing that lands while copying marks its area again and is picked up next time
+    u64 flags = spin_lock_irqsave(&renderer.lock);
+    u32 dirty_count = renderer.dirty_count;
+    memcpy(dirty, renderer.dirty, dirty_count * sizeof(Rect));
+    renderer.dirty_count = 0;
+    spin_unlock_irqrestore(&renderer.lock, flags);
+
+    Framebuffer* fb = renderer.fb;
+    u32* source = renderer.back_buffer;
+    u32* destination = fb->base_address;
+    u64 pitch = fb->pixels_per_scanline;
+
+    for (u32 i = 0; i < dirty_count; i++)
+    {
+        // Widened to 16 byte boundaries so rows are made of whole vector stores
+        u64 x0 = dirty[i].x0 & ~3;
+        u64 x1 = (dirty[i].x1 + 3) & ~3;
+        x1 = x1 > pitch ? pitch : x1;
+
+        if (x0 == 0 && x1 >= fb->width)
+        {
+            // Full rows are contiguous, padding included
+            u64 offset = dirty[i].y0 * pitch;
+            memcpy_nt(destination + offset, source + offset, (dirty[i].y1 - dirty[i].y0) * pitch * sizeof(u32));
+            continue;
+        }
+
+        for (s64 y = dirty[i].y0; y < dirty[i].y1; y++)
+        {
+            u64 offset = y * pitch + x0;
+            memcpy_nt(destination + offset, source + offset, (x1 - x0) * sizeof(u32));
+        }
+    }
+}
+
 void scroll(Renderer* renderer)
 {
     Framebuffer* fb = renderer->fb;
 
-    u64 fb_base = (u64)fb->base_address;
+    u64 fb_base = (u64)draw_target(renderer);
     u64 bytes_per_scanline = fb->pixels_per_scanline * sizeof(Color);
     u64 fb_height = fb->height;
     u64 fb_size = fb->size;
@@ -39,16 +199,13 @@ void scroll(Renderer* renderer)
     u8 char_size = renderer->font->header->char_size;
     u64 lines_to_be_skipped = char_size;
     u64 lines_to_be_copied = fb_height - lines_to_be_skipped;
-    memcpy((void*)fb_base, (void*)(fb_base + (bytes_per_scanline * lines_to_be_skipped)), bytes_per_scanline * lines_to_be_copied);
+    // Source and destination overlap
+    memmove((void*)fb_base, (void*)(fb_base + (bytes_per_scanline * lines_to_be_skipped)), bytes_per_scanline * lines_to_be_copied);
 
     u32* line_clear_it = (u32*)(fb_base + (bytes_per_scanline * lines_to_be_copied));
-    u32* top = (u32*)(fb_base + (bytes_per_scanline * fb_height));
-    Color clear_color = renderer->clear_color;
+    fill_pixels(renderer, line_clear_it, renderer->clear_color, fb->pixels_per_scanline * lines_to_be_skipped);
 
-    while (line_clear_it < top)
-    {
-        *line_clear_it++ = clear_color;
-    }
+    mark_all_dirty(renderer);
 
     // Don't advance line, we are scrolling
     renderer->cursor_position.x = 0;
@@ -73,7 +230,9 @@ void new_line_ex(Renderer* renderer)
 
 void new_line(void)
 {
+    u64 flags = spin_lock_irqsave(&renderer.lock);
     new_line_ex(&renderer);
+    spin_unlock_irqrestore(&renderer.lock, flags);
 }
 
 void handle_newline_while_printing(Renderer* renderer)
@@ -87,7 +246,7 @@ void handle_newline_while_printing(Renderer* renderer)
 
 void render_char(Renderer* renderer, char c, u32 xo, u32 yo)
 {
-    u32* pix_writer = (u32*)renderer->fb->base_address;
+    u32* pix_writer = draw_target(renderer);
     char* font_reader = renderer->font->glyph_buffer + (c * renderer->font->header->char_size);
 
     for (u64 y = yo; y < yo + 16; y++, font_reader++)
@@ -100,52 +259,54 @@ void render_char(Renderer* renderer, char c, u32 xo, u32 yo)
             }
         }
     }
+
+    mark_dirty(renderer, (Rect) { .x0 = xo, .y0 = yo, .x1 = xo + 8, .y1 = yo + 16 });
 }
 
 void putc(char c)
 {
+    u64 flags = spin_lock_irqsave(&renderer.lock);
     render_char(&renderer, c, renderer.cursor_position.x, renderer.cursor_position.y);
     handle_newline_while_printing(&renderer);
+    spin_unlock_irqrestore(&renderer.lock, flags);
 }
 
 void put_pixel(s64 x, s64 y, Color color)
 {
-    *(u32*)( (u64)renderer.fb->base_address + (x*4) + (y * renderer.fb->pixels_per_scanline * 4)) = color;
+    *(u32*)( (u64)draw_target(&renderer) + (x*4) + (y * renderer.fb->pixels_per_scanline * 4)) = color;
 }
 
 u32 get_pixel(s64 x, s64 y)
 {
-    return *(u32*)( (u64)renderer.fb->base_address + (x*4) + (y * renderer.fb->pixels_per_scanline * 4));
+    return *(u32*)( (u64)draw_target(&renderer) + (x*4) + (y * renderer.fb->pixels_per_scanline * 4));
 }
 
 void put_char_in_point(char c, u32 xo, u32 yo)
 {
+    u64 flags = spin_lock_irqsave(&renderer.lock);
     render_char(&renderer, c, xo, yo);
+    spin_unlock_irqrestore(&renderer.lock, flags);
 }
 
 void fb_clear(void)
 {
     Framebuffer* fb = renderer.fb;
-    u64 fb_base = (u64)fb->base_address;
     u64 bytes_per_scanline = fb->pixels_per_scanline * sizeof(Color);
     u64 fb_height = fb->height;
     u64 fb_size = fb->size;
 
-    for (u64 vertical_scanline = 0; vertical_scanline < fb_height; vertical_scanline++)
-    {
-        u64 pix_base_ptr = fb_base + (bytes_per_scanline * vertical_scanline);
-        u32* top_ptr = (u32*)(pix_base_ptr + bytes_per_scanline);
-
-        for (u32* pix_ptr = (u32*)pix_base_ptr; pix_ptr < top_ptr; pix_ptr++)
-        {
-            *pix_ptr = renderer.clear_color;
-        }
-    }
+    // Scanlines are contiguous, so the whole screen is filled at once
+    u64 flags = spin_lock_irqsave(&renderer.lock);
+    fill_pixels(&renderer, draw_target(&renderer), renderer.clear_color, (bytes_per_scanline * fb_height) / sizeof(u32));
+    mark_all_dirty(&renderer);
+    spin_unlock_irqrestore(&renderer.lock, flags);
 }
 
 
 void clear_char(void)
 {
+    u64 flags = spin_lock_irqsave(&renderer.lock);
+
     if (renderer.cursor_position.x == 0)
     {
         renderer.cursor_position.x = renderer.fb->width;
@@ -156,16 +317,21 @@ void clear_char(void)
         }
     }
 
-    u32* pix_writer = (u32*)renderer.fb->base_address;
+    u32* pix_writer = draw_target(&renderer);
 
-    for (u64 y = renderer.cursor_position.y; y < renderer.cursor_position.y + 16; y++)
+    for (s64 y = renderer.cursor_position.y; y < renderer.cursor_position.y + 16; y++)
     {
-        for (u64 x = renderer.cursor_position.x - 8; x < renderer.cursor_position.x; x++)
+        for (s64 x = renderer.cursor_position.x - 8; x < renderer.cursor_position.x; x++)
         {
             *(u32*)(pix_writer + x + (y * renderer.fb->pixels_per_scanline)) = renderer.clear_color;
         }
     }
     renderer.cursor_position.x -= 8;
+    mark_dirty(&renderer, (Rect)
+    {
+        .x0 = renderer.cursor_position.x, .y0 = renderer.cursor_position.y,
+        .x1 = renderer.cursor_position.x + 8, .y1 = renderer.cursor_position.y + 16,
+    });
 
     if (renderer.cursor_position.x < 0)
     {
@@ -176,6 +342,8 @@ void clear_char(void)
             renderer.cursor_position.y = 0;
         }
     }
+
+    spin_unlock_irqrestore(&renderer.lock, flags);
 }
 
 void clear_mouse_cursor(u8* mouse_cursor, Point position)
@@ -185,6 +353,8 @@ void clear_mouse_cursor(u8* mouse_cursor, Point position)
         return;
     }
 
+    u64 flags = spin_lock_irqsave(&renderer.lock);
+
     s64 x_max = 16;
     s64 y_max = 16;
     s64 difference_x = renderer.fb->width - position.x;
@@ -212,10 +382,16 @@ void clear_mouse_cursor(u8* mouse_cursor, Point position)
             }
         }
     }
+
+    mark_dirty(&renderer, (Rect) { .x0 = position.x, .y0 = position.y, .x1 = position.x + x_max, .y1 = position.y + y_max });
+
+    spin_unlock_irqrestore(&renderer.lock, flags);
 }
 
 void draw_overlay_mouse_cursor(u8* mouse_cursor, Point position, Color color)
 {
+    u64 flags = spin_lock_irqsave(&renderer.lock);
+
     s64 x_max = 16;
     s64 y_max = 16;
     s64 difference_x = renderer.fb->width - position.x;
@@ -246,5 +422,8 @@ void draw_overlay_mouse_cursor(u8* mouse_cursor, Point position, Color color)
         }
     }
 
+    mark_dirty(&renderer, (Rect) { .x0 = position.x, .y0 = position.y, .x1 = position.x + x_max, .y1 = position.y + y_max });
     mouse_never_drawn = false;
+
+    spin_unlock_irqrestore(&renderer.lock, flags);
 }
@@ -25,4 +25,6 @@ typedef struct PSF1Font
     void* glyph_buffer;
 } PSF1Font;
 
+void renderer_setup(void);
+void renderer_flush(void);
 void fb_clear(void);
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include "types.h"
 #include "renderer.h"
+#include "spinlock.h"
 
 // @TODO: first bit can cause problems, check out
 typedef enum Color
@@ -12,6 +13,14 @@ typedef enum Color
     Color_White     = Color_Blue | Color_Green | Color_Red,
 } Color;
 
+#define RENDERER_MAX_DIRTY_RECTS 8
+
+// Pixels [x0, x1) x [y0, y1)
+typedef struct Rect
+{
+    s64 x0, y0, x1, y1;
+} Rect;
+
 typedef struct Renderer
 {
     Framebuffer* fb;
@@ -19,6 +28,17 @@ typedef struct Renderer
     Point cursor_position;
     Color color;
     Color clear_color;
+    // Copy of the screen in RAM with the framebuffer's layout. All drawing lands here and
+    // renderer_flush copies the damaged areas out. NULL until renderer_setup, then drawing goes
+    // straight to the framebuffer
+    u32* back_buffer;
+    // Areas of back_buffer not yet copied to the framebuffer. Overlapping or touching ones are merged
+    Rect dirty[RENDERER_MAX_DIRTY_RECTS];
+    u32 dirty_count;
+    // Serializes drawing, cursor and damage updates. Taken with interrupts disabled since the mouse
+    // handler draws too. put_pixel/get_pixel are left unlocked and record no damage, for callers
+    // that batch pixels and mark the whole area once
+    Spinlock lock;
 } Renderer;
 
 extern Renderer renderer;
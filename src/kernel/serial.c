@@ -0,0 +1,285 @@
+#include "serial.h"
+#include "config.h"
+#include "asm.h"
+#include "queue.h"
+#include "spinlock.h"
+
+#define COM1 0x3f8
+#define SERIAL_CLOCK_BAUD 115200
+#define SERIAL_FIFO_SIZE 16
+
+typedef enum SerialRegister
+{
+    SerialRegister_Data                 = 0,
+    SerialRegister_InterruptEnable      = 1,
+    SerialRegister_InterruptIdentify    = 2,
+    SerialRegister_FIFOControl          = 2,
+    SerialRegister_LineControl          = 3,
+    SerialRegister_ModemControl         = 4,
+    SerialRegister_LineStatus           = 5,
+    SerialRegister_ModemStatus          = 6,
+    // With LineControlBit_DivisorLatch set
+    SerialRegister_DivisorLow           = 0,
+    SerialRegister_DivisorHigh          = 1,
+} SerialRegister;
+
+typedef enum InterruptEnableBit
+{
+    InterruptEnableBit_DataAvailable    = 1 << 0,
+    InterruptEnableBit_TransmitterEmpty = 1 << 1,
+    InterruptEnableBit_LineStatus       = 1 << 2,
+} InterruptEnableBit;
+
+typedef enum InterruptIdentify
+{
+    InterruptIdentify_NonePending       = 1 << 0,
+    InterruptIdentify_Mask              = 0x0e,
+    InterruptIdentify_ModemStatus       = 0x00,
+    InterruptIdentify_TransmitterEmpty  = 0x02,
+    InterruptIdentify_DataAvailable     = 0x04,
+    InterruptIdentify_LineStatus        = 0x06,
+    InterruptIdentify_CharacterTimeout  = 0x0c,
+} InterruptIdentify;
+
+typedef enum LineControlBit
+{
+    LineControlBit_8N1                  = 0x03,
+    LineControlBit_DivisorLatch         = 1 << 7,
+} LineControlBit;
+
+typedef enum LineStatusBit
+{
+    LineStatusBit_DataReady             = 1 << 0,
+    LineStatusBit_TransmitterEmpty      = 1 << 5,
+} LineStatusBit;
+
+// Enable, clear both FIFOs, interrupt when 14 bytes are waiting
+#define SERIAL_FIFO_CONTROL 0xc7
+// DTR, RTS and OUT2, which gates the IRQ line
+#define SERIAL_MODEM_CONTROL 0x0b
+
+GEN_SPSC_QUEUE(SerialRing, u8, 4096)
+
+static bool serial_present = false;
+static u32 serial_baud = 0;
+
+// TX: any context produces, serialized by serial_tx_producer_lock. The consumer is whoever moves
+// bytes into the UART FIFO (the interrupt handler, serial_poll or a producer waiting for space),
+// serialized by serial_tx_consumer_lock, which also owns the interrupt enable register
+static SerialRing serial_tx;
+static Spinlock serial_tx_producer_lock = SPINLOCK_INIT;
+static Spinlock serial_tx_consumer_lock = SPINLOCK_INIT;
+static bool serial_tx_interrupt_enabled = false;
+
+// RX: filled by the interrupt handler or serial_poll under serial_rx_lock, drained by serial_read
+static SerialRing serial_rx;
+static Spinlock serial_rx_lock = SPINLOCK_INIT;
+static u64 serial_rx_dropped = 0;
+
+static void serial_set_interrupts(bool transmit)
+{
+    u8 enabled = InterruptEnableBit_DataAvailable | InterruptEnableBit_LineStatus;
+    if (transmit)
+    {
+        enabled |= InterruptEnableBit_TransmitterEmpty;
+    }
+
+    outb(COM1 + SerialRegister_InterruptEnable, enabled);
+    serial_tx_interrupt_enabled = transmit;
+}
+
+// Refills the transmit FIFO if it ran empty. The THRE interrupt is only kept enabled while there
+// is something left to send, otherwise an idle transmitter would interrupt continuously
+static void serial_tx_pump(void)
+{
+    u64 flags = spin_lock_irqsave(&serial_tx_consumer_lock);
+
+    if (inb(COM1 + SerialRegister_LineStatus) & LineStatusBit_TransmitterEmpty)
+    {
+        u8 byte;
+        for (u32 i = 0; i < SERIAL_FIFO_SIZE && SerialRing_pop(&serial_tx, &byte); i++)
+        {
+            outb(COM1 + SerialRegister_Data, byte);
+        }
+    }
+
+    bool pending = SerialRing_count(&serial_tx) != 0;
+    if (pending != serial_tx_interrupt_enabled)
+    {
+        serial_set_interrupts(pending);
+    }
+
+    spin_unlock_irqrestore(&serial_tx_consumer_lock, flags);
+}
+
+static void serial_rx_pump(void)
+{
+    u64 flags = spin_lock_irqsave(&serial_rx_lock);
+
+    while (inb(COM1 + SerialRegister_LineStatus) & LineStatusBit_DataReady)
+    {
+        u8 byte = inb(COM1 + SerialRegister_Data);
+        if (!SerialRing_push(&serial_rx, byte))
+        {
+            serial_rx_dropped++;
+        }
+    }
+
+    spin_unlock_irqrestore(&serial_rx_lock, flags);
+}
+
+// Baud rates are derived from the 115200 Hz reference, so only its integer divisors are accepted
+bool serial_set_baud(u32 baud)
+{
+    if (!baud || baud > SERIAL_CLOCK_BAUD || SERIAL_CLOCK_BAUD % baud)
+    {
+        return false;
+    }
+
+    u16 divisor = SERIAL_CLOCK_BAUD / baud;
+
+    u64 flags = spin_lock_irqsave(&serial_tx_consumer_lock);
+    outb(COM1 + SerialRegister_LineControl, LineControlBit_DivisorLatch);
+    outb(COM1 + SerialRegister_DivisorLow, divisor & 0xff);
+    outb(COM1 + SerialRegister_DivisorHigh, divisor >> 8);
+    outb(COM1 + SerialRegister_LineControl, LineControlBit_8N1);
+    // Writing the divisor latch shadows the interrupt enable register, so it is restored
+    serial_set_interrupts(serial_tx_interrupt_enabled);
+    spin_unlock_irqrestore(&serial_tx_consumer_lock, flags);
+
+    serial_baud = baud;
+
+    return true;
+}
+
+u32 serial_get_baud(void)
+{
+    return serial_baud;
+}
+
+// SERIAL_BAUD (config.h), 8N1, FIFOs enabled. Received data and transmitter empty raise IRQ 4;
+// where that is not routed, serial_poll moves the data instead
+void serial_setup(void)
+{
+    SerialRing_init(&serial_tx);
+    SerialRing_init(&serial_rx);
+
+    outb(COM1 + SerialRegister_InterruptEnable, 0x00);
+    outb(COM1 + SerialRegister_FIFOControl, SERIAL_FIFO_CONTROL);
+    outb(COM1 + SerialRegister_ModemControl, SERIAL_MODEM_CONTROL);
+
+    // Reads back as 0xff when there is no UART behind the port
+    serial_present = inb(COM1 + SerialRegister_LineStatus) != 0xff;
+    if (!serial_present)
+    {
+        return;
+    }
+
+    if (!serial_set_baud(SERIAL_BAUD))
+    {
+        serial_set_baud(SERIAL_CLOCK_BAUD);
+    }
+
+    // Drops whatever the firmware left behind and clears any pending interrupt condition
+    (void)inb(COM1 + SerialRegister_LineStatus);
+    (void)inb(COM1 + SerialRegister_ModemStatus);
+    while (inb(COM1 + SerialRegister_LineStatus) & LineStatusBit_DataReady)
+    {
+        (void)inb(COM1 + SerialRegister_Data);
+    }
+}
+
+// Called from the COM1 interrupt handler, which sends the EOI
+void serial_interrupt(void)
+{
+    u8 identify;
+
+    while (!((identify = inb(COM1 + SerialRegister_InterruptIdentify)) & InterruptIdentify_NonePending))
+    {
+        switch (identify & InterruptIdentify_Mask)
+        {
+            case InterruptIdentify_DataAvailable:
+            case InterruptIdentify_CharacterTimeout:
+                serial_rx_pump();
+                break;
+            case InterruptIdentify_TransmitterEmpty:
+                serial_tx_pump();
+                break;
+            case InterruptIdentify_LineStatus:
+                (void)inb(COM1 + SerialRegister_LineStatus);
+                break;
+            case InterruptIdentify_ModemStatus:
+                (void)inb(COM1 + SerialRegister_ModemStatus);
+                break;
+            default:
+                return;
+        }
+    }
+}
+
+// Moves data in both directions without relying on the IRQ. Called from the idle loop
+void serial_poll(void)
+{
+    if (!serial_present)
+    {
+        return;
+    }
+
+    serial_rx_pump();
+    serial_tx_pump();
+}
+
+static void serial_put(char c)
+{
+    // Only blocks when the ring is full: the transmitter is then fed by polling until there is room
+    while (!SerialRing_push(&serial_tx, c))
+    {
+        serial_tx_pump();
+        cpu_relax();
+    }
+}
+
+void serial_write(const char* data, usize length)
+{
+    if (!serial_present)
+    {
+        return;
+    }
+
+    u64 flags = spin_lock_irqsave(&serial_tx_producer_lock);
+
+    for (usize i = 0; i < length; i++)
+    {
+        if (data[i] == '\n')
+        {
+            serial_put('\r');
+        }
+        serial_put(data[i]);
+    }
+
+    spin_unlock_irqrestore(&serial_tx_producer_lock, flags);
+
+    // Starts the transmitter if it was idle; from then on the THRE interrupt keeps it fed
+    serial_tx_pump();
+}
+
+// Returns the number of bytes copied, never waits for more
+usize serial_read(char* buffer, usize capacity)
+{
+    usize count = 0;
+    u8 byte;
+
+    while (count < capacity && SerialRing_pop(&serial_rx, &byte))
+    {
+        buffer[count++] = byte;
+    }
+
+    return count;
+}
+
+static void serial_sink_write(FormatSink* sink, const char* data, usize length)
+{
+    serial_write(data, length);
+}
+
+FormatSink serial_sink = { .write = serial_sink_write };
@@ -0,0 +1,13 @@
+#pragma once
+#include "types.h"
+#include "libk.h"
+
+extern FormatSink serial_sink;
+
+void serial_setup(void);
+bool serial_set_baud(u32 baud);
+u32 serial_get_baud(void);
+void serial_interrupt(void);
+void serial_poll(void);
+void serial_write(const char* data, usize length);
+usize serial_read(char* buffer, usize capacity);
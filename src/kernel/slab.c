@@ -0,0 +1,406 @@
+#include "slab.h"
+#include "asm.h"
+#include "libk.h"
+#include "memory_internal.h"
+#include "panic.h"
+#include "alloc_trace.h"
+#include "blog.h"
+
+#define SLAB_MAGIC 0x42414c53424c4c53ULL
+
+static SlabCache cache_cache;
+static SlabCache* cache_list = NULL;
+static Spinlock cache_list_lock = SPINLOCK_INIT;
+
+static inline usize align_up(usize value, usize align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+static void slab_list_push(Slab** list, Slab* slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list)
+    {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+static void slab_list_remove(Slab** list, Slab* slab)
+{
+    if (slab->prev)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        *list = slab->next;
+    }
+
+    if (slab->next)
+    {
+        slab->next->prev = slab->prev;
+    }
+
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static bool kmem_cache_init(SlabCache* cache, const char* name, usize size, usize align)
+{
+    if (align < sizeof(void*))
+    {
+        align = sizeof(void*);
+    }
+
+    if ((align & (align - 1)) != 0 || align > CACHE_LINE_SIZE)
+    {
+        return false;
+    }
+
+    usize object_size = align_up(size < sizeof(void*) ? sizeof(void*) : size, align);
+    if (object_size > SLAB_MAX_OBJECT_SIZE)
+    {
+        return false;
+    }
+
+    memset(cache, 0, sizeof(SlabCache));
+    cache->name = name;
+    cache->object_size = object_size;
+    cache->align = align;
+    cache->objects_per_slab = (PAGE_SIZE - sizeof(Slab)) / object_size;
+
+    // Slab colouring: the space left over at the end of each slab is used to
+    // shift the first object, so equal-index objects of different slabs do not
+    // all compete for the same cache sets
+    usize leftover = PAGE_SIZE - sizeof(Slab) - cache->objects_per_slab * object_size;
+    cache->color_step = CACHE_LINE_SIZE;
+    cache->color_count = leftover / cache->color_step + 1;
+
+    spin_lock_init(&cache->lock);
+
+    u64 flags = spin_lock_irqsave(&cache_list_lock);
+    cache->next = cache_list;
+    cache_list = cache;
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+
+    return true;
+}
+
+static Slab* slab_new(SlabCache* cache)
+{
+    Slab* slab = (Slab*)request_page_internal();
+    if (!slab)
+    {
+        return NULL;
+    }
+
+    slab->magic = SLAB_MAGIC;
+    slab->cache = cache;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->in_use = 0;
+    slab->color_offset = cache->next_color * cache->color_step;
+    cache->next_color = (cache->next_color + 1) % cache->color_count;
+
+    blog("slab: new slab for %s at %64h, colour offset %32u", cache->name, slab, slab->color_offset);
+
+    u8* object = (u8*)(slab + 1) + slab->color_offset;
+    slab->free_list = object;
+
+    for (u32 i = 0; i < cache->objects_per_slab - 1; i++, object += cache->object_size)
+    {
+        *(void**)object = object + cache->object_size;
+    }
+    *(void**)object = NULL;
+
+    cache->slab_count++;
+
+    return slab;
+}
+
+Slab* slab_from_object(void* object)
+{
+    Slab* slab = (Slab*)((u64)object & ~((u64)PAGE_SIZE - 1));
+    if (slab->magic != SLAB_MAGIC)
+    {
+        return NULL;
+    }
+
+    return slab;
+}
+
+// Slow path: moves up to half a magazine worth of objects from the slab lists
+// into the per-CPU cache
+static void slab_refill(SlabCache* cache, SlabCPUCache* cpu_cache)
+{
+    u32 target = SLAB_MAGAZINE_SIZE / 2;
+
+    spin_lock(&cache->lock);
+
+    while (cpu_cache->count < target)
+    {
+        Slab* slab = cache->partial;
+
+        if (!slab)
+        {
+            if (cache->empty)
+            {
+                slab = cache->empty;
+                slab_list_remove(&cache->empty, slab);
+            }
+            else
+            {
+                slab = slab_new(cache);
+                if (!slab)
+                {
+                    break;
+                }
+            }
+
+            slab_list_push(&cache->partial, slab);
+        }
+
+        while (slab->free_list && cpu_cache->count < target)
+        {
+            void* object = slab->free_list;
+            slab->free_list = *(void**)object;
+            slab->in_use++;
+            cpu_cache->objects[cpu_cache->count++] = object;
+        }
+
+        if (!slab->free_list)
+        {
+            slab_list_remove(&cache->partial, slab);
+            slab_list_push(&cache->full, slab);
+        }
+    }
+
+    spin_unlock(&cache->lock);
+}
+
+static void slab_release_object(SlabCache* cache, void* object)
+{
+    Slab* slab = slab_from_object(object);
+    if (!slab || slab->cache != cache)
+    {
+        panic("kmem_cache_free: object %64h does not belong to cache %s", (u64)object, cache->name);
+        return;
+    }
+
+    bool was_full = slab->free_list == NULL;
+    *(void**)object = slab->free_list;
+    slab->free_list = object;
+    slab->in_use--;
+
+    if (was_full)
+    {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+
+    if (slab->in_use == 0)
+    {
+        slab_list_remove(&cache->partial, slab);
+
+        // Keep a single empty slab around to avoid bouncing pages on alloc/free pairs
+        if (cache->empty)
+        {
+            slab->magic = 0;
+            cache->slab_count--;
+            free_page_internal(slab);
+        }
+        else
+        {
+            slab_list_push(&cache->empty, slab);
+        }
+    }
+}
+
+// Slow path: gives back objects from the per-CPU cache to their slabs
+static void slab_drain(SlabCache* cache, SlabCPUCache* cpu_cache, u32 count)
+{
+    spin_lock(&cache->lock);
+
+    while (count-- && cpu_cache->count)
+    {
+        slab_release_object(cache, cpu_cache->objects[--cpu_cache->count]);
+    }
+
+    spin_unlock(&cache->lock);
+}
+
+void slab_setup(void)
+{
+    if (!kmem_cache_init(&cache_cache, "kmem_cache", sizeof(SlabCache), CACHE_LINE_SIZE))
+    {
+        panic("Failed to create the slab cache of caches");
+    }
+}
+
+SlabCache* kmem_cache_create(const char* name, usize size, usize align)
+{
+    SlabCache* cache = slab_alloc(&cache_cache);
+    if (!cache)
+    {
+        return NULL;
+    }
+
+    if (!kmem_cache_init(cache, name, size, align))
+    {
+        slab_free(&cache_cache, cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+void kmem_cache_destroy(SlabCache* cache)
+{
+    u64 flags = interrupts_save_disable();
+
+    for (u32 i = 0; i < cpu_count; i++)
+    {
+        slab_drain(cache, &cache->cpu[i], SLAB_MAGAZINE_SIZE);
+    }
+
+    spin_lock(&cache->lock);
+
+    if (cache->partial || cache->full)
+    {
+        panic("kmem_cache_destroy: cache %s still has objects in use", cache->name);
+    }
+
+    if (cache->empty)
+    {
+        cache->empty->magic = 0;
+        free_page_internal(cache->empty);
+        cache->empty = NULL;
+    }
+
+    spin_unlock(&cache->lock);
+
+    spin_lock(&cache_list_lock);
+    for (SlabCache** it = &cache_list; *it; it = &(*it)->next)
+    {
+        if (*it == cache)
+        {
+            *it = cache->next;
+            break;
+        }
+    }
+    spin_unlock(&cache_list_lock);
+
+    interrupts_restore(flags);
+
+    slab_free(&cache_cache, cache);
+}
+
+// Untraced allocation, for allocators layered on top of the slab caches
+void* slab_alloc(SlabCache* cache)
+{
+    u64 flags = interrupts_save_disable();
+    SlabCPUCache* cpu_cache = &cache->cpu[cpu_get_id()];
+
+    if (!cpu_cache->count)
+    {
+        slab_refill(cache, cpu_cache);
+    }
+
+    void* object = NULL;
+    if (cpu_cache->count)
+    {
+        object = cpu_cache->objects[--cpu_cache->count];
+        cpu_cache->alloc_count++;
+    }
+
+    interrupts_restore(flags);
+
+    return object;
+}
+
+void slab_free(SlabCache* cache, void* object)
+{
+    if (!object)
+    {
+        return;
+    }
+
+    u64 flags = interrupts_save_disable();
+    SlabCPUCache* cpu_cache = &cache->cpu[cpu_get_id()];
+
+    if (cpu_cache->count == SLAB_MAGAZINE_SIZE)
+    {
+        slab_drain(cache, cpu_cache, SLAB_MAGAZINE_SIZE / 2);
+    }
+
+    cpu_cache->objects[cpu_cache->count++] = object;
+    cpu_cache->free_count++;
+
+    interrupts_restore(flags);
+}
+
+void* kmem_cache_alloc(SlabCache* cache)
+{
+    void* object = slab_alloc(cache);
+    alloc_trace_alloc(AllocTraceKind_Object, object, cache->object_size);
+    return object;
+}
+
+void kmem_cache_free(SlabCache* cache, void* object)
+{
+    alloc_trace_free(object);
+    slab_free(cache, object);
+}
+
+void kmem_cache_get_stats(SlabCache* cache, SlabCacheStats* out_stats)
+{
+    u64 flags = spin_lock_irqsave(&cache->lock);
+
+    SlabCacheStats stats =
+    {
+        .name = cache->name,
+        .object_size = cache->object_size,
+        .objects_per_slab = cache->objects_per_slab,
+        .slab_count = cache->slab_count,
+        .total_objects = cache->slab_count * cache->objects_per_slab,
+    };
+
+    Slab* lists[] = { cache->partial, cache->full, cache->empty };
+    for (u32 i = 0; i < array_length(lists); i++)
+    {
+        for (Slab* slab = lists[i]; slab; slab = slab->next)
+        {
+            stats.active_objects += slab->in_use;
+        }
+    }
+
+    for (u32 i = 0; i < cpu_count; i++)
+    {
+        stats.cached_objects += cache->cpu[i].count;
+        stats.alloc_count += cache->cpu[i].alloc_count;
+        stats.free_count += cache->cpu[i].free_count;
+    }
+
+    // Objects sitting in the per-CPU caches are accounted as in use by their slabs
+    stats.active_objects -= stats.cached_objects;
+
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    *out_stats = stats;
+}
+
+void kmem_cache_print_stats(void)
+{
+    println("Slab caches:");
+    for (SlabCache* cache = cache_list; cache; cache = cache->next)
+    {
+        SlabCacheStats stats;
+        kmem_cache_get_stats(cache, &stats);
+        println("* %s: %64u B, %64u/%64u objects, %64u slabs, %64u allocs, %64u frees",
+                stats.name, stats.object_size, stats.active_objects, stats.total_objects,
+                stats.slab_count, stats.alloc_count, stats.free_count);
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "types.h"
+#include "cpu.h"
+#include "memory.h"
+#include "spinlock.h"
+
+#define SLAB_MAGAZINE_SIZE 12
+
+// Per-CPU object stack. Allocations and frees only touch this while it is
+// neither empty nor full, so the fast path never leaves the local cache line
+typedef struct ALIGN(CACHE_LINE_SIZE) SlabCPUCache
+{
+    u32 count;
+    u32 reserved;
+    u64 alloc_count;
+    u64 free_count;
+    void* objects[SLAB_MAGAZINE_SIZE];
+} SlabCPUCache;
+
+// Slab header, stored at the beginning of every slab page
+typedef struct ALIGN(CACHE_LINE_SIZE) Slab
+{
+    u64 magic;
+    struct SlabCache* cache;
+    struct Slab* next;
+    struct Slab* prev;
+    void* free_list;
+    u32 in_use;
+    u32 color_offset;
+} Slab;
+
+#define SLAB_MAX_OBJECT_SIZE ((PAGE_SIZE - sizeof(Slab)) / 2)
+
+typedef struct SlabCache
+{
+    SlabCPUCache cpu[CPU_MAX_COUNT];
+    // Guards the slab lists and the colour cursor. Only the refill/drain slow paths take it,
+    // always with interrupts already disabled
+    Spinlock lock;
+    const char* name;
+    u32 object_size;
+    u32 align;
+    u32 objects_per_slab;
+    u32 color_count;
+    u32 color_step;
+    u32 next_color;
+    Slab* partial;
+    Slab* full;
+    Slab* empty;
+    u64 slab_count;
+    struct SlabCache* next;
+} SlabCache;
+
+typedef struct SlabCacheStats
+{
+    const char* name;
+    u64 object_size;
+    u64 objects_per_slab;
+    u64 slab_count;
+    u64 total_objects;
+    u64 active_objects;
+    u64 cached_objects;
+    u64 alloc_count;
+    u64 free_count;
+} SlabCacheStats;
+
+void slab_setup(void);
+
+SlabCache* kmem_cache_create(const char* name, usize size, usize align);
+void kmem_cache_destroy(SlabCache* cache);
+void* kmem_cache_alloc(SlabCache* cache);
+void kmem_cache_free(SlabCache* cache, void* object);
+void* slab_alloc(SlabCache* cache);
+void slab_free(SlabCache* cache, void* object);
+
+Slab* slab_from_object(void* object);
+void kmem_cache_get_stats(SlabCache* cache, SlabCacheStats* out_stats);
+void kmem_cache_print_stats(void);
@@ -0,0 +1,384 @@
+#pragma once
+#include "types.h"
+#include "asm.h"
+#include "cpu.h"
+#include <stdatomic.h>
+
+// Busy-waiting locks. Every spin loop only reads the lock word (so waiters share the cache line
+// instead of bouncing it in exclusive state) and executes pause between reads.
+//
+// Spinlock:  test-and-test-and-set. Smallest and fastest when uncontended, but unfair.
+// TicketLock: FIFO. Waiters take a ticket and spin until it is served, so no CPU starves.
+// MCSLock:   queued lock. Every waiter spins on its own MCSNode, so a release only touches the
+//            cache line of the next waiter. Preferred for paths that are contended on purpose.
+// RWLock:    many readers or one writer. Writers announce themselves so new readers back off.
+// SeqLock:   readers do not write shared memory at all; they retry if a writer ran meanwhile.
+//            Meant for small, read-mostly state that can be copied out (timekeeping and the like).
+//
+// None of them disable interrupts by themselves. Data that is also touched from an interrupt
+// handler must be locked through the _irqsave variants, otherwise the handler can spin forever
+// on a lock held by the code it interrupted.
+
+typedef struct Spinlock
+{
+    _Atomic u32 locked;
+} Spinlock;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_lock_init(Spinlock* lock)
+{
+    atomic_init(&lock->locked, 0);
+}
+
+static inline bool spin_trylock(Spinlock* lock)
+{
+    return !atomic_load_explicit(&lock->locked, memory_order_relaxed) &&
+        !atomic_exchange_explicit(&lock->locked, 1, memory_order_acquire);
+}
+
+static inline void spin_lock(Spinlock* lock)
+{
+    while (atomic_exchange_explicit(&lock->locked, 1, memory_order_acquire))
+    {
+        while (atomic_load_explicit(&lock->locked, memory_order_relaxed))
+        {
+            cpu_relax();
+        }
+    }
+}
+
+static inline void spin_unlock(Spinlock* lock)
+{
+    atomic_store_explicit(&lock->locked, 0, memory_order_release);
+}
+
+static inline bool spin_is_locked(Spinlock* lock)
+{
+    return atomic_load_explicit(&lock->locked, memory_order_relaxed) != 0;
+}
+
+// Returns the previous RFLAGS, to be handed back to spin_unlock_irqrestore
+static inline u64 spin_lock_irqsave(Spinlock* lock)
+{
+    u64 flags = interrupts_save_disable();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(Spinlock* lock, u64 flags)
+{
+    spin_unlock(lock);
+    interrupts_restore(flags);
+}
+
+typedef struct TicketLock
+{
+    _Atomic u32 next;
+    _Atomic u32 owner;
+} TicketLock;
+
+#define TICKET_LOCK_INIT { 0, 0 }
+
+static inline void ticket_lock_init(TicketLock* lock)
+{
+    atomic_init(&lock->next, 0);
+    atomic_init(&lock->owner, 0);
+}
+
+static inline void ticket_lock(TicketLock* lock)
+{
+    u32 ticket = atomic_fetch_add_explicit(&lock->next, 1, memory_order_relaxed);
+
+    while (atomic_load_explicit(&lock->owner, memory_order_acquire) != ticket)
+    {
+        cpu_relax();
+    }
+}
+
+static inline bool ticket_trylock(TicketLock* lock)
+{
+    u32 owner = atomic_load_explicit(&lock->owner, memory_order_relaxed);
+    u32 expected = owner;
+
+    return atomic_compare_exchange_strong_explicit(&lock->next, &expected, owner + 1, memory_order_acquire, memory_order_relaxed);
+}
+
+static inline void ticket_unlock(TicketLock* lock)
+{
+    // Only the holder writes owner, so a plain increment is enough
+    u32 owner = atomic_load_explicit(&lock->owner, memory_order_relaxed);
+    atomic_store_explicit(&lock->owner, owner + 1, memory_order_release);
+}
+
+static inline u64 ticket_lock_irqsave(TicketLock* lock)
+{
+    u64 flags = interrupts_save_disable();
+    ticket_lock(lock);
+    return flags;
+}
+
+static inline void ticket_unlock_irqrestore(TicketLock* lock, u64 flags)
+{
+    ticket_unlock(lock);
+    interrupts_restore(flags);
+}
+
+// Queue node, owned by the caller (usually on its stack) from mcs_lock until mcs_unlock returns.
+// Cache line aligned so that spinning on it never shares a line with another waiter.
+typedef struct ALIGN(CACHE_LINE_SIZE) MCSNode
+{
+    struct MCSNode* _Atomic next;
+    _Atomic u32 locked;
+} MCSNode;
+
+typedef struct MCSLock
+{
+    MCSNode* _Atomic tail;
+} MCSLock;
+
+#define MCS_LOCK_INIT { NULL }
+
+static inline void mcs_lock_init(MCSLock* lock)
+{
+    atomic_init(&lock->tail, NULL);
+}
+
+static inline void mcs_lock(MCSLock* lock, MCSNode* node)
+{
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->locked, 1, memory_order_relaxed);
+
+    MCSNode* previous = atomic_exchange_explicit(&lock->tail, node, memory_order_acq_rel);
+    if (!previous)
+    {
+        return;
+    }
+
+    atomic_store_explicit(&previous->next, node, memory_order_release);
+
+    while (atomic_load_explicit(&node->locked, memory_order_acquire))
+    {
+        cpu_relax();
+    }
+}
+
+static inline bool mcs_trylock(MCSLock* lock, MCSNode* node)
+{
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->locked, 0, memory_order_relaxed);
+
+    MCSNode* expected = NULL;
+    return atomic_compare_exchange_strong_explicit(&lock->tail, &expected, node, memory_order_acquire, memory_order_relaxed);
+}
+
+static inline void mcs_unlock(MCSLock* lock, MCSNode* node)
+{
+    MCSNode* next = atomic_load_explicit(&node->next, memory_order_acquire);
+
+    if (!next)
+    {
+        MCSNode* expected = node;
+        if (atomic_compare_exchange_strong_explicit(&lock->tail, &expected, NULL, memory_order_release, memory_order_relaxed))
+        {
+            return;
+        }
+
+        // A waiter swapped itself in as the tail but has not linked itself behind us yet
+        while (!(next = atomic_load_explicit(&node->next, memory_order_acquire)))
+        {
+            cpu_relax();
+        }
+    }
+
+    atomic_store_explicit(&next->locked, 0, memory_order_release);
+}
+
+static inline u64 mcs_lock_irqsave(MCSLock* lock, MCSNode* node)
+{
+    u64 flags = interrupts_save_disable();
+    mcs_lock(lock, node);
+    return flags;
+}
+
+static inline void mcs_unlock_irqrestore(MCSLock* lock, MCSNode* node, u64 flags)
+{
+    mcs_unlock(lock, node);
+    interrupts_restore(flags);
+}
+
+// state layout: bit 0 is set while a writer holds the lock, bit 1 while a writer is waiting,
+// the remaining bits count the readers inside
+typedef enum RWLockBit
+{
+    RWLockBit_Writer        = 1 << 0,
+    RWLockBit_WriterPending = 1 << 1,
+    RWLockBit_Reader        = 1 << 2,
+} RWLockBit;
+
+typedef struct RWLock
+{
+    _Atomic u32 state;
+} RWLock;
+
+#define RW_LOCK_INIT { 0 }
+
+static inline void rw_lock_init(RWLock* lock)
+{
+    atomic_init(&lock->state, 0);
+}
+
+static inline bool read_trylock(RWLock* lock)
+{
+    u32 state = atomic_load_explicit(&lock->state, memory_order_relaxed);
+
+    return !(state & (RWLockBit_Writer | RWLockBit_WriterPending)) &&
+        atomic_compare_exchange_weak_explicit(&lock->state, &state, state + RWLockBit_Reader, memory_order_acquire, memory_order_relaxed);
+}
+
+static inline void read_lock(RWLock* lock)
+{
+    while (!read_trylock(lock))
+    {
+        cpu_relax();
+    }
+}
+
+static inline void read_unlock(RWLock* lock)
+{
+    atomic_fetch_sub_explicit(&lock->state, RWLockBit_Reader, memory_order_release);
+}
+
+static inline bool write_trylock(RWLock* lock)
+{
+    u32 state = atomic_load_explicit(&lock->state, memory_order_relaxed);
+
+    return (state & ~RWLockBit_WriterPending) == 0 &&
+        atomic_compare_exchange_strong_explicit(&lock->state, &state, RWLockBit_Writer, memory_order_acquire, memory_order_relaxed);
+}
+
+static inline void write_lock(RWLock* lock)
+{
+    for (;;)
+    {
+        u32 state = atomic_load_explicit(&lock->state, memory_order_relaxed);
+
+        if ((state & ~RWLockBit_WriterPending) == 0)
+        {
+            // Taking the lock also clears the pending bit; other waiting writers set it again
+            if (atomic_compare_exchange_weak_explicit(&lock->state, &state, RWLockBit_Writer, memory_order_acquire, memory_order_relaxed))
+            {
+                return;
+            }
+        }
+        else if (!(state & RWLockBit_WriterPending))
+        {
+            atomic_fetch_or_explicit(&lock->state, RWLockBit_WriterPending, memory_order_relaxed);
+        }
+
+        cpu_relax();
+    }
+}
+
+static inline void write_unlock(RWLock* lock)
+{
+    // Keeps a pending bit set by a writer that arrived meanwhile
+    atomic_fetch_and_explicit(&lock->state, ~(u32)RWLockBit_Writer, memory_order_release);
+}
+
+static inline u64 read_lock_irqsave(RWLock* lock)
+{
+    u64 flags = interrupts_save_disable();
+    read_lock(lock);
+    return flags;
+}
+
+static inline void read_unlock_irqrestore(RWLock* lock, u64 flags)
+{
+    read_unlock(lock);
+    interrupts_restore(flags);
+}
+
+static inline u64 write_lock_irqsave(RWLock* lock)
+{
+    u64 flags = interrupts_save_disable();
+    write_lock(lock);
+    return flags;
+}
+
+static inline void write_unlock_irqrestore(RWLock* lock, u64 flags)
+{
+    write_unlock(lock);
+    interrupts_restore(flags);
+}
+
+// Reader usage:
+//     u32 sequence;
+//     do
+//     {
+//         sequence = read_seqbegin(&lock);
+//         copy = shared;
+//     } while (read_seqretry(&lock, sequence));
+//
+// The copy may be torn while the loop runs, so readers must not follow pointers read from it
+// before read_seqretry confirms it.
+typedef struct SeqLock
+{
+    _Atomic u32 sequence;
+    Spinlock writer;
+} SeqLock;
+
+#define SEQ_LOCK_INIT { 0, SPINLOCK_INIT }
+
+static inline void seq_lock_init(SeqLock* lock)
+{
+    atomic_init(&lock->sequence, 0);
+    spin_lock_init(&lock->writer);
+}
+
+static inline u32 read_seqbegin(SeqLock* lock)
+{
+    u32 sequence;
+
+    // Odd while a writer is inside
+    while ((sequence = atomic_load_explicit(&lock->sequence, memory_order_acquire)) & 1)
+    {
+        cpu_relax();
+    }
+
+    return sequence;
+}
+
+static inline bool read_seqretry(SeqLock* lock, u32 sequence)
+{
+    // Orders the data reads of the critical section before the sequence re-read
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&lock->sequence, memory_order_relaxed) != sequence;
+}
+
+static inline void write_seqlock(SeqLock* lock)
+{
+    spin_lock(&lock->writer);
+    atomic_store_explicit(&lock->sequence, atomic_load_explicit(&lock->sequence, memory_order_relaxed) + 1, memory_order_relaxed);
+    // The odd sequence must be visible before any of the data stores
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void write_sequnlock(SeqLock* lock)
+{
+    atomic_store_explicit(&lock->sequence, atomic_load_explicit(&lock->sequence, memory_order_relaxed) + 1, memory_order_release);
+    spin_unlock(&lock->writer);
+}
+
+static inline u64 write_seqlock_irqsave(SeqLock* lock)
+{
+    u64 flags = interrupts_save_disable();
+    write_seqlock(lock);
+    return flags;
+}
+
+static inline void write_sequnlock_irqrestore(SeqLock* lock, u64 flags)
+{
+    write_sequnlock(lock);
+    interrupts_restore(flags);
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include "types.h"
+#include "libk.h"
+
+// Typed printing: every argument is turned into a FormatArg by _Generic at compile time, so there is
+// no format string to parse at runtime and no way for a directive to disagree with its argument.
+// Unsupported argument types fail to compile.
+//
+//     tprintln("Free RAM: ", free_memory / 1024, " KB");
+//     tprintln(fmt_hex(address), ": ", fmt_width(fmt_hex(byte), 6));
+//
+// Character literals are ints in C, so they print as numbers unless cast to char
+
+typedef enum FormatArgKind
+{
+    FormatArgKind_End = 0,
+    FormatArgKind_String,
+    FormatArgKind_Char,
+    FormatArgKind_Bool,
+    FormatArgKind_Unsigned,
+    FormatArgKind_Signed,
+    FormatArgKind_Hexadecimal,
+    FormatArgKind_Binary,
+    FormatArgKind_Float,
+} FormatArgKind;
+
+// Floats print the shortest string that reads back as the same value unless a precision is set
+#define FORMAT_PRECISION_SHORTEST 0xffff
+
+typedef struct FormatArg
+{
+    u8 kind;
+    // Byte width of the value, used by hexadecimal and binary output
+    u8 bytes;
+    // Minimum field width, padded with spaces on the left
+    u16 width;
+    // Number of decimals for floats
+    u16 precision;
+    union
+    {
+        const char* string;
+        u64 unsigned_value;
+        s64 signed_value;
+        f64 float_value;
+    };
+} FormatArg;
+
+s32 format_args(FormatSink* sink, const FormatArg* args);
+
+static inline FormatArg format_arg_string(const char* value) { return (FormatArg) { .kind = FormatArgKind_String, .string = value }; }
+static inline FormatArg format_arg_char(char value) { return (FormatArg) { .kind = FormatArgKind_Char, .unsigned_value = (u8)value }; }
+static inline FormatArg format_arg_bool(bool value) { return (FormatArg) { .kind = FormatArgKind_Bool, .unsigned_value = value }; }
+static inline FormatArg format_arg_unsigned(u64 value) { return (FormatArg) { .kind = FormatArgKind_Unsigned, .unsigned_value = value }; }
+static inline FormatArg format_arg_signed(s64 value) { return (FormatArg) { .kind = FormatArgKind_Signed, .signed_value = value }; }
+static inline FormatArg format_arg_float(f64 value) { return (FormatArg) { .kind = FormatArgKind_Float, .precision = FORMAT_PRECISION_SHORTEST, .float_value = value }; }
+static inline FormatArg format_arg_pointer(const void* value) { return (FormatArg) { .kind = FormatArgKind_Hexadecimal, .bytes = sizeof(u64), .unsigned_value = (u64)value }; }
+static inline FormatArg format_arg_identity(FormatArg arg) { return arg; }
+
+static inline FormatArg format_arg_hex8(u8 value) { return (FormatArg) { .kind = FormatArgKind_Hexadecimal, .bytes = 1, .unsigned_value = value }; }
+static inline FormatArg format_arg_hex16(u16 value) { return (FormatArg) { .kind = FormatArgKind_Hexadecimal, .bytes = 2, .unsigned_value = value }; }
+static inline FormatArg format_arg_hex32(u32 value) { return (FormatArg) { .kind = FormatArgKind_Hexadecimal, .bytes = 4, .unsigned_value = value }; }
+static inline FormatArg format_arg_hex64(u64 value) { return (FormatArg) { .kind = FormatArgKind_Hexadecimal, .bytes = 8, .unsigned_value = value }; }
+static inline FormatArg format_arg_binary8(u8 value) { return (FormatArg) { .kind = FormatArgKind_Binary, .bytes = 1, .unsigned_value = value }; }
+static inline FormatArg format_arg_binary16(u16 value) { return (FormatArg) { .kind = FormatArgKind_Binary, .bytes = 2, .unsigned_value = value }; }
+static inline FormatArg format_arg_binary32(u32 value) { return (FormatArg) { .kind = FormatArgKind_Binary, .bytes = 4, .unsigned_value = value }; }
+static inline FormatArg format_arg_binary64(u64 value) { return (FormatArg) { .kind = FormatArgKind_Binary, .bytes = 8, .unsigned_value = value }; }
+
+static inline FormatArg format_arg_with_width(FormatArg arg, u16 width)
+{
+    arg.width = width;
+    return arg;
+}
+
+static inline FormatArg format_arg_with_precision(FormatArg arg, u16 precision)
+{
+    arg.precision = precision;
+    return arg;
+}
+
+#define fmt_width(x, width) format_arg_with_width(FORMAT_ARG(x), (width))
+#define fmt_precision(x, precision) format_arg_with_precision(FORMAT_ARG(x), (precision))
+
+// Only unsigned integers of a known width can be printed as hexadecimal or binary
+#define fmt_hex(x) _Generic((x), \
+    u8: format_arg_hex8, u16: format_arg_hex16, u32: format_arg_hex32, u64: format_arg_hex64, \
+    unsigned long long: format_arg_hex64)(x)
+
+#define fmt_bin(x) _Generic((x), \
+    u8: format_arg_binary8, u16: format_arg_binary16, u32: format_arg_binary32, u64: format_arg_binary64, \
+    unsigned long long: format_arg_binary64)(x)
+
+#define FORMAT_ARG(x) _Generic((x), \
+    FormatArg: format_arg_identity, \
+    char*: format_arg_string, const char*: format_arg_string, \
+    char: format_arg_char, \
+    bool: format_arg_bool, \
+    u8: format_arg_unsigned, u16: format_arg_unsigned, u32: format_arg_unsigned, u64: format_arg_unsigned, \
+    unsigned long long: format_arg_unsigned, \
+    s8: format_arg_signed, s16: format_arg_signed, s32: format_arg_signed, s64: format_arg_signed, \
+    long long: format_arg_signed, \
+    f32: format_arg_float, f64: format_arg_float, \
+    void*: format_arg_pointer, const void*: format_arg_pointer)(x)
+
+// FORMAT_MAP(m, a, b, c) expands to m(a), m(b), m(c), for up to 16 arguments
+#define FORMAT_MAP_1(m, x) m(x)
+#define FORMAT_MAP_2(m, x, ...) m(x), FORMAT_MAP_1(m, __VA_ARGS__)
+#define FORMAT_MAP_3(m, x, ...) m(x), FORMAT_MAP_2(m, __VA_ARGS__)
+#define FORMAT_MAP_4(m, x, ...) m(x), FORMAT_MAP_3(m, __VA_ARGS__)
+#define FORMAT_MAP_5(m, x, ...) m(x), FORMAT_MAP_4(m, __VA_ARGS__)
+#define FORMAT_MAP_6(m, x, ...) m(x), FORMAT_MAP_5(m, __VA_ARGS__)
+#define FORMAT_MAP_7(m, x, ...) m(x), FORMAT_MAP_6(m, __VA_ARGS__)
+#define FORMAT_MAP_8(m, x, ...) m(x), FORMAT_MAP_7(m, __VA_ARGS__)
+#define FORMAT_MAP_9(m, x, ...) m(x), FORMAT_MAP_8(m, __VA_ARGS__)
+#define FORMAT_MAP_10(m, x, ...) m(x), FORMAT_MAP_9(m, __VA_ARGS__)
+#define FORMAT_MAP_11(m, x, ...) m(x), FORMAT_MAP_10(m, __VA_ARGS__)
+#define FORMAT_MAP_12(m, x, ...) m(x), FORMAT_MAP_11(m, __VA_ARGS__)
+#define FORMAT_MAP_13(m, x, ...) m(x), FORMAT_MAP_12(m, __VA_ARGS__)
+#define FORMAT_MAP_14(m, x, ...) m(x), FORMAT_MAP_13(m, __VA_ARGS__)
+#define FORMAT_MAP_15(m, x, ...) m(x), FORMAT_MAP_14(m, __VA_ARGS__)
+#define FORMAT_MAP_16(m, x, ...) m(x), FORMAT_MAP_15(m, __VA_ARGS__)
+#define FORMAT_MAP_SELECT(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, name, ...) name
+#define FORMAT_MAP(m, ...) FORMAT_MAP_SELECT(__VA_ARGS__, \
+    FORMAT_MAP_16, FORMAT_MAP_15, FORMAT_MAP_14, FORMAT_MAP_13, FORMAT_MAP_12, FORMAT_MAP_11, FORMAT_MAP_10, FORMAT_MAP_9, \
+    FORMAT_MAP_8, FORMAT_MAP_7, FORMAT_MAP_6, FORMAT_MAP_5, FORMAT_MAP_4, FORMAT_MAP_3, FORMAT_MAP_2, FORMAT_MAP_1)(m, __VA_ARGS__)
+
+#define FORMAT_ARGS(...) ((const FormatArg[]) { FORMAT_MAP(FORMAT_ARG, __VA_ARGS__), { .kind = FormatArgKind_End } })
+
+#define sink_tprint(sink, ...) format_args((sink), FORMAT_ARGS(__VA_ARGS__))
+#define tprint(...) format_args(console_sink, FORMAT_ARGS(__VA_ARGS__))
+#define tprintln(...) format_args(console_sink, FORMAT_ARGS(__VA_ARGS__, "\n"))
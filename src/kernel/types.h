@@ -36,6 +36,7 @@ typedef float128_t f128;
 #endif
 
 #define array_length(_arr) ((sizeof(_arr))/ (sizeof(_arr[0])))
+#define container_of(ptr, type, member) ((type*)((u8*)(ptr) - offsetof(type, member)))
 #define CASE_TO_STR(x) case(x): return #x
 #define UNUSED_ELEM(x) x = x
 
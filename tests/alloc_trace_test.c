@@ -0,0 +1,148 @@
+#include "host.h"
+#include "slab.h"
+#include "kmalloc.h"
+#include "arena.h"
+#include "alloc_trace.h"
+
+// alloc_trace.c with ALLOC_TRACE=1, over the real slab and kmalloc. Three call sites allocate
+// so that every sort key puts a different one first:
+//     slow:  200 x 16 bytes spread over a long time, all freed   -> most calls
+//     large: 10 x 4096 bytes, never freed                        -> most bytes and live bytes
+//     burst: 50 x 16 bytes back to back, all freed               -> highest rate
+// The print output tells the sites apart by their call counts.
+
+#define SLOW_COUNT 200
+#define LARGE_COUNT 10
+#define BURST_COUNT 50
+
+static void* slow_objects[SLOW_COUNT];
+static void* large_objects[LARGE_COUNT];
+static void* burst_objects[BURST_COUNT];
+
+static void spin_cycles(u64 cycles)
+{
+    u64 start = rdtsc();
+    while (rdtsc() - start < cycles)
+    {
+        asm volatile("pause");
+    }
+}
+
+static __attribute__((noinline)) void allocate_slow(void)
+{
+    for (u32 i = 0; i < SLOW_COUNT; i++)
+    {
+        slow_objects[i] = kmalloc(16);
+        spin_cycles(100000);
+    }
+}
+
+static __attribute__((noinline)) void allocate_large(void)
+{
+    for (u32 i = 0; i < LARGE_COUNT; i++)
+    {
+        large_objects[i] = kmalloc(4096);
+    }
+}
+
+static __attribute__((noinline)) void allocate_burst(void)
+{
+    for (u32 i = 0; i < BURST_COUNT; i++)
+    {
+        burst_objects[i] = kmalloc(16);
+    }
+}
+
+// Call count of the first site line alloc_trace_print wrote, which is the top of the sort
+static u64 first_site_calls(void)
+{
+    const char* line = host_console;
+    while (*line && *line != '\n')
+    {
+        line++;
+    }
+
+    const char* calls = line;
+    while (*calls && !(calls[0] == ':' && calls[1] == ' '))
+    {
+        calls++;
+    }
+
+    u64 value = 0;
+    for (calls += *calls ? 2 : 0; *calls >= '0' && *calls <= '9'; calls++)
+    {
+        value = value * 10 + (u64)(*calls - '0');
+    }
+
+    return value;
+}
+
+static bool console_contains(const char* text)
+{
+    usize length = strlen(text);
+    for (const char* it = host_console; *it; it++)
+    {
+        if (strncmp(it, text, length) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static u64 print_top_site(Arena* arena, AllocTraceSortKey key)
+{
+    host_console_reset();
+    alloc_trace_print(arena, key, 3);
+    arena_reset(arena);
+    return first_site_calls();
+}
+
+int main(void)
+{
+    host_setup();
+    slab_setup();
+    kmalloc_setup();
+
+    // The arena keeps its first chunk across resets. Taking it before tracing starts keeps it out
+    // of the sites under test
+    Arena arena;
+    arena_init(&arena, KILOBYTE(64));
+    arena_alloc(&arena, 1);
+    arena_reset(&arena);
+
+    alloc_trace_setup();
+
+    allocate_slow();
+    allocate_large();
+    allocate_burst();
+    for (u32 i = 0; i < SLOW_COUNT; i++)
+    {
+        kfree(slow_objects[i]);
+    }
+    for (u32 i = 0; i < BURST_COUNT; i++)
+    {
+        kfree(burst_objects[i]);
+    }
+
+    CHECK_U64(print_top_site(&arena, AllocTraceSortKey_Calls), SLOW_COUNT);
+    CHECK_U64(print_top_site(&arena, AllocTraceSortKey_Bytes), LARGE_COUNT);
+    CHECK_U64(print_top_site(&arena, AllocTraceSortKey_Live), LARGE_COUNT);
+    CHECK_U64(print_top_site(&arena, AllocTraceSortKey_Rate), BURST_COUNT);
+
+    // Frees are charged back to the allocating site
+    host_console_reset();
+    alloc_trace_print(&arena, AllocTraceSortKey_Calls, 3);
+    CHECK(console_contains(": 200 calls, 3200 bytes, 200 frees, 0 live bytes"));
+    CHECK(console_contains(": 10 calls, 40960 bytes, 0 frees, 40960 live bytes"));
+    CHECK(console_contains(": 50 calls, 800 bytes, 50 frees, 0 live bytes"));
+    printf("%s", host_console);
+
+    for (u32 i = 0; i < LARGE_COUNT; i++)
+    {
+        kfree(large_objects[i]);
+    }
+
+    return host_test_finish("alloc_trace_test");
+}
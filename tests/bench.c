@@ -0,0 +1,80 @@
+#include "bench.h"
+
+BenchConfig bench_config =
+{
+    .sample_count = BENCH_MAX_SAMPLES,
+    .iteration_count = 1000,
+};
+
+static void bench_sort(u64* samples, u32 count)
+{
+    for (u32 i = 1; i < count; i++)
+    {
+        u64 sample = samples[i];
+        u32 j = i;
+        for (; j && samples[j - 1] > sample; j--)
+        {
+            samples[j] = samples[j - 1];
+        }
+        samples[j] = sample;
+    }
+}
+
+void bench_setup(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (string_eq(argv[i], "--quick"))
+        {
+            bench_config.sample_count = 3;
+            bench_config.iteration_count = 10;
+            bench_config.quick = true;
+        }
+    }
+
+    u64 samples[BENCH_MAX_SAMPLES];
+    for (u32 i = 0; i < BENCH_MAX_SAMPLES; i++)
+    {
+        u64 begin = bench_start();
+        for (u32 j = 0; j < bench_config.iteration_count; j++)
+        {
+            bench_clobber();
+        }
+        samples[i] = bench_stop() - begin;
+    }
+
+    bench_sort(samples, BENCH_MAX_SAMPLES);
+    bench_config.overhead = (f64)samples[0] / bench_config.iteration_count;
+
+    printf("%-40s %12s %12s %10s\n", "benchmark", "median", "min", "bytes/cyc");
+}
+
+u32 bench_iterations(u64 bytes)
+{
+    u64 budget = 4 * 1024 * 1024;
+    if (bytes * bench_config.iteration_count <= budget)
+    {
+        return bench_config.iteration_count;
+    }
+
+    return budget / bytes ? (u32)(budget / bytes) : 1;
+}
+
+void bench_report(const char* name, u64* samples, u32 sample_count, u32 iteration_count, u64 bytes)
+{
+    bench_sort(samples, sample_count);
+
+    f64 median = (f64)samples[sample_count / 2] / iteration_count - bench_config.overhead;
+    f64 min = (f64)samples[0] / iteration_count - bench_config.overhead;
+    median = median > 0 ? median : 0;
+    min = min > 0 ? min : 0;
+
+    if (bytes && median > 0)
+    {
+        printf("%-40s %12.1f %12.1f %10.2f\n", name, median, min, bytes / median);
+    }
+    else
+    {
+        printf("%-40s %12.1f %12.1f %10s\n", name, median, min, "-");
+    }
+}
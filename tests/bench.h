@@ -0,0 +1,79 @@
+#pragma once
+#include "host.h"
+
+// Microbenchmarks timed with the TSC. A sample runs the body a number of times between two
+// serialized TSC reads; the median and minimum over all samples are reported per iteration, minus
+// the cost of an empty iteration. The TSC ticks at a constant reference rate, which matches core cycles
+// only with turbo and frequency scaling off, so compare numbers taken on the same setup.
+//
+//     BENCH("memcpy 64", 64, memcpy(dst, src, 64));
+//
+// With --quick (as CTest runs them) every benchmark takes a handful of samples, just enough to
+// catch crashes and wrong results.
+
+#define BENCH_MAX_SAMPLES 101
+
+typedef struct BenchConfig
+{
+    u32 sample_count;
+    u32 iteration_count;
+    // Set by --quick, for benchmarks that have to skip sizes rather than just take fewer samples
+    bool quick;
+    // Cost of an empty iteration, subtracted from every measurement
+    f64 overhead;
+} BenchConfig;
+
+extern BenchConfig bench_config;
+
+// Parses --quick and measures the timing overhead
+void bench_setup(int argc, char** argv);
+// Fewer iterations for bodies that process a lot of data, so every sample covers about the same time
+u32 bench_iterations(u64 bytes);
+// bytes is the amount of data one iteration processes, 0 if throughput makes no sense
+void bench_report(const char* name, u64* samples, u32 sample_count, u32 iteration_count, u64 bytes);
+
+// lfence keeps earlier instructions from finishing after the read and later ones from starting before it
+static inline u64 bench_start(void)
+{
+    u32 eax, edx;
+    asm volatile("lfence; rdtsc; lfence" : "=a"(eax), "=d"(edx) : : "memory");
+    return ((u64)edx << 32) | eax;
+}
+
+// rdtscp waits for everything before it to finish
+static inline u64 bench_stop(void)
+{
+    u32 eax, edx;
+    asm volatile("rdtscp; lfence" : "=a"(eax), "=d"(edx) : : "rcx", "memory");
+    return ((u64)edx << 32) | eax;
+}
+
+// Keeps the compiler from dropping a computation whose result is otherwise unused
+static inline void bench_use(u64 value)
+{
+    asm volatile("" : : "r"(value) : "memory");
+}
+
+// Makes the compiler assume memory changed, so loads are not hoisted out of the timed loop
+static inline void bench_clobber(void)
+{
+    asm volatile("" : : : "memory");
+}
+
+#define BENCH(name, bytes, ...) \
+    do \
+    { \
+        u64 bench_samples_[BENCH_MAX_SAMPLES]; \
+        u32 bench_iteration_count_ = bench_iterations(bytes); \
+        for (u32 bench_sample_ = 0; bench_sample_ < bench_config.sample_count; bench_sample_++) \
+        { \
+            u64 bench_begin_ = bench_start(); \
+            for (u32 bench_iteration_ = 0; bench_iteration_ < bench_iteration_count_; bench_iteration_++) \
+            { \
+                __VA_ARGS__; \
+                bench_clobber(); \
+            } \
+            bench_samples_[bench_sample_] = bench_stop() - bench_begin_; \
+        } \
+        bench_report((name), bench_samples_, bench_config.sample_count, bench_iteration_count_, (bytes)); \
+    } while (0)
@@ -0,0 +1,249 @@
+#include "bench.h"
+#include "rbtree.h"
+#include "radix_tree.h"
+#include "hash_table.h"
+#include "slab.h"
+#include "kmalloc.h"
+#include "panic.h"
+
+// Insert, lookup and delete for the kernel containers at a few sizes, with keys in ascending
+// order and in random order. A sample builds the container from empty, looks every key up and
+// deletes every key again, timing each of the three passes; the reported numbers are per key.
+// Random keys are a shuffle of the same sparse key set (every fourth index), so the radix tree
+// stays as tall as it would for page frame numbers. The hash table starts without storage, so its
+// insert numbers include growing. --quick leaves out the largest size.
+
+typedef struct BenchEntry
+{
+    RBNode node;
+    u64 key;
+} BenchEntry;
+
+typedef struct ContainerSamples
+{
+    u64 insert[BENCH_MAX_SAMPLES];
+    u64 lookup[BENCH_MAX_SAMPLES];
+    u64 remove[BENCH_MAX_SAMPLES];
+} ContainerSamples;
+
+static u64 keys_seed = 0x2545f4914f6cdd1dull;
+
+static u64* keys_make(u32 count, bool random)
+{
+    u64* keys = malloc(count * sizeof(u64));
+    for (u32 i = 0; i < count; i++)
+    {
+        keys[i] = (u64)i * 4;
+    }
+
+    if (random)
+    {
+        for (u32 i = count - 1; i > 0; i--)
+        {
+            u32 j = (u32)(host_random(&keys_seed) % (i + 1));
+            u64 key = keys[i];
+            keys[i] = keys[j];
+            keys[j] = key;
+        }
+    }
+
+    return keys;
+}
+
+// Large containers take long enough per sample that a few samples suffice
+static u32 container_sample_count(u32 count)
+{
+    u32 limit = count >= 1024 * 1024 ? 5 : count >= 64 * 1024 ? 21 : BENCH_MAX_SAMPLES;
+    return bench_config.sample_count < limit ? bench_config.sample_count : limit;
+}
+
+static void container_report(const char* container, const char* order, u32 count, ContainerSamples* samples, u32 sample_count)
+{
+    char name[64];
+
+    snprintf(name, sizeof(name), "%s insert %32u %s", container, count, order);
+    bench_report(name, samples->insert, sample_count, count, 0);
+    snprintf(name, sizeof(name), "%s lookup %32u %s", container, count, order);
+    bench_report(name, samples->lookup, sample_count, count, 0);
+    snprintf(name, sizeof(name), "%s delete %32u %s", container, count, order);
+    bench_report(name, samples->remove, sample_count, count, 0);
+}
+
+static inline BenchEntry* bench_entry(RBNode* node)
+{
+    return container_of(node, BenchEntry, node);
+}
+
+static void bench_rbtree(const u64* keys, u32 count, const char* order)
+{
+    ContainerSamples samples;
+    u32 sample_count = container_sample_count(count);
+    BenchEntry* entries = malloc(count * sizeof(BenchEntry));
+
+    for (u32 sample = 0; sample < sample_count; sample++)
+    {
+        RBTree tree = { 0 };
+
+        u64 begin = bench_start();
+        for (u32 i = 0; i < count; i++)
+        {
+            BenchEntry* entry = &entries[i];
+            entry->key = keys[i];
+
+            RBNode** link = &tree.root;
+            RBNode* parent = NULL;
+            while (*link)
+            {
+                parent = *link;
+                link = entry->key < bench_entry(parent)->key ? &parent->left : &parent->right;
+            }
+            rb_link_node(&entry->node, parent, link);
+            rb_insert_color(&entry->node, &tree);
+        }
+        samples.insert[sample] = bench_stop() - begin;
+
+        u32 found = 0;
+        begin = bench_start();
+        for (u32 i = 0; i < count; i++)
+        {
+            RBNode* node = tree.root;
+            while (node && bench_entry(node)->key != keys[i])
+            {
+                node = keys[i] < bench_entry(node)->key ? node->left : node->right;
+            }
+            found += node != NULL;
+        }
+        samples.lookup[sample] = bench_stop() - begin;
+
+        begin = bench_start();
+        for (u32 i = 0; i < count; i++)
+        {
+            rb_erase(&entries[i].node, &tree);
+        }
+        samples.remove[sample] = bench_stop() - begin;
+
+        if (found != count || tree.root)
+        {
+            panic("rbtree: lookups or deletes went wrong");
+        }
+    }
+
+    container_report("rbtree", order, count, &samples, sample_count);
+    free(entries);
+}
+
+static void bench_radix_tree(const u64* keys, u32 count, const char* order)
+{
+    ContainerSamples samples;
+    u32 sample_count = container_sample_count(count);
+
+    for (u32 sample = 0; sample < sample_count; sample++)
+    {
+        RadixTree tree;
+        radix_tree_init(&tree);
+
+        u32 inserted = 0;
+        u64 begin = bench_start();
+        for (u32 i = 0; i < count; i++)
+        {
+            inserted += radix_tree_insert(&tree, keys[i], (void*)(keys[i] + 1));
+        }
+        samples.insert[sample] = bench_stop() - begin;
+
+        u32 found = 0;
+        begin = bench_start();
+        for (u32 i = 0; i < count; i++)
+        {
+            found += radix_tree_lookup(&tree, keys[i]) == (void*)(keys[i] + 1);
+        }
+        samples.lookup[sample] = bench_stop() - begin;
+
+        u32 removed = 0;
+        begin = bench_start();
+        for (u32 i = 0; i < count; i++)
+        {
+            removed += radix_tree_delete(&tree, keys[i]) != NULL;
+        }
+        samples.remove[sample] = bench_stop() - begin;
+
+        if (inserted != count || found != count || removed != count || tree.root)
+        {
+            panic("radix_tree: inserts, lookups or deletes went wrong");
+        }
+    }
+
+    container_report("radix_tree", order, count, &samples, sample_count);
+}
+
+static void bench_hash_table(const u64* keys, u32 count, const char* order)
+{
+    ContainerSamples samples;
+    u32 sample_count = container_sample_count(count);
+
+    for (u32 sample = 0; sample < sample_count; sample++)
+    {
+        HashTable table;
+        hash_table_init(&table, 0);
+
+        u32 inserted = 0;
+        u64 begin = bench_start();
+        for (u32 i = 0; i < count; i++)
+        {
+            inserted += hash_table_insert(&table, keys[i], keys[i] + 1);
+        }
+        samples.insert[sample] = bench_stop() - begin;
+
+        u32 found = 0;
+        begin = bench_start();
+        for (u32 i = 0; i < count; i++)
+        {
+            u64 value = 0;
+            found += hash_table_find(&table, keys[i], &value) && value == keys[i] + 1;
+        }
+        samples.lookup[sample] = bench_stop() - begin;
+
+        u32 removed = 0;
+        begin = bench_start();
+        for (u32 i = 0; i < count; i++)
+        {
+            removed += hash_table_remove(&table, keys[i]);
+        }
+        samples.remove[sample] = bench_stop() - begin;
+
+        if (inserted != count || found != count || removed != count || table.count)
+        {
+            panic("hash_table: inserts, lookups or deletes went wrong");
+        }
+        hash_table_free(&table);
+    }
+
+    container_report("hash_table", order, count, &samples, sample_count);
+}
+
+int main(int argc, char** argv)
+{
+    host_setup();
+    slab_setup();
+    kmalloc_setup();
+    radix_tree_setup();
+    bench_setup(argc, argv);
+
+    u32 counts[] = { 1024, 64 * 1024, 1024 * 1024 };
+    u32 count_count = bench_config.quick ? array_length(counts) - 1 : array_length(counts);
+    for (u32 i = 0; i < count_count; i++)
+    {
+        for (u32 random = 0; random < 2; random++)
+        {
+            const char* order = random ? "random" : "sequential";
+            u64* keys = keys_make(counts[i], random);
+
+            bench_rbtree(keys, counts[i], order);
+            bench_radix_tree(keys, counts[i], order);
+            bench_hash_table(keys, counts[i], order);
+
+            free(keys);
+        }
+    }
+
+    return 0;
+}
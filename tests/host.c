@@ -0,0 +1,97 @@
+#include "host.h"
+#include "cpu.h"
+#include "checksum.h"
+#include "panic.h"
+#include <sched.h>
+
+char host_console[HOST_CONSOLE_SIZE];
+usize host_console_length;
+
+u32 host_check_count;
+u32 host_failure_count;
+
+// The hooks libk.h expects from its environment. The kernel renders them on the framebuffer,
+// here they are captured so tests can compare the output
+void putc(char c)
+{
+    if (host_console_length < HOST_CONSOLE_SIZE - 1)
+    {
+        host_console[host_console_length++] = c;
+        host_console[host_console_length] = 0;
+    }
+}
+
+void new_line(void)
+{
+    putc('\n');
+}
+
+void panic(const char* format, ...)
+{
+    printf("panic: %s\n", format);
+    abort();
+}
+
+void host_relax(void)
+{
+    static _Thread_local u32 spins;
+
+    asm volatile("pause" : : : "memory");
+    if (++spins % 64 == 0)
+    {
+        sched_yield();
+    }
+}
+
+void host_console_reset(void)
+{
+    host_console_length = 0;
+    host_console[0] = 0;
+}
+
+void host_setup(void)
+{
+    CPU_setup();
+    libk_setup(&cpu_features);
+    checksum_setup();
+}
+
+void host_check(bool condition, const char* expression, const char* file, u32 line)
+{
+    host_check_count++;
+
+    if (!condition)
+    {
+        host_failure_count++;
+        printf("%s:%u: check failed: %s\n", file, line, expression);
+    }
+}
+
+void host_check_string(const char* actual, const char* expected, const char* expression, const char* file, u32 line)
+{
+    host_check_count++;
+
+    if (!string_eq(actual, expected))
+    {
+        host_failure_count++;
+        printf("%s:%u: %s is \"%s\", expected \"%s\"\n", file, line, expression, actual, expected);
+    }
+}
+
+void host_check_u64(u64 actual, u64 expected, const char* expression, const char* file, u32 line)
+{
+    host_check_count++;
+
+    if (actual != expected)
+    {
+        host_failure_count++;
+        printf("%s:%u: %s is %llu (0x%llx), expected %llu (0x%llx)\n", file, line, expression,
+               (unsigned long long)actual, (unsigned long long)actual, (unsigned long long)expected, (unsigned long long)expected);
+    }
+}
+
+int host_test_finish(const char* name)
+{
+    printf("%s: %u checks, %u failed\n", name, host_check_count, host_failure_count);
+    return host_failure_count ? 1 : 0;
+}
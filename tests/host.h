@@ -0,0 +1,47 @@
+#pragma once
+#include "types.h"
+#include "libk.h"
+#include <stdlib.h>
+
+// Support for running kernel code as a Linux program (see CMakeLists.txt in this directory).
+//
+// libk defines its own putc, memset, strlen, snprintf and so on with kernel signatures, so test
+// sources cannot include <stdio.h> or <string.h> next to libk.h. The few libc functions they need
+// besides <stdlib.h> are declared here.
+int printf(const char* format, ...);
+int memcmp(const void* a, const void* b, usize bytes);
+f64 strtod(const char* str, char** end);
+
+// CPU_setup, libk_setup and checksum_setup, with the features of the machine running the tests
+void host_setup(void);
+
+// Everything libk renders through putc()/new_line(), e.g. print and println
+#define HOST_CONSOLE_SIZE 4096
+extern char host_console[HOST_CONSOLE_SIZE];
+extern usize host_console_length;
+void host_console_reset(void);
+
+// Checks report the failing expression and keep going, so one run lists every failure
+extern u32 host_check_count;
+extern u32 host_failure_count;
+
+void host_check(bool condition, const char* expression, const char* file, u32 line);
+void host_check_string(const char* actual, const char* expected, const char* expression, const char* file, u32 line);
+void host_check_u64(u64 actual, u64 expected, const char* expression, const char* file, u32 line);
+// Prints the summary and returns the process exit code
+int host_test_finish(const char* name);
+
+#define CHECK(condition) host_check((condition), #condition, __FILE__, __LINE__)
+#define CHECK_STRING(actual, expected) host_check_string((actual), (expected), #actual, __FILE__, __LINE__)
+#define CHECK_U64(actual, expected) host_check_u64((actual), (expected), #actual, __FILE__, __LINE__)
+
+// Deterministic across runs and platforms, unlike rand()
+static inline u64 host_random(u64* state)
+{
+    u64 x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
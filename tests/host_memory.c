@@ -0,0 +1,59 @@
+#include "host.h"
+#include "memory_internal.h"
+#include "blog.h"
+#include "alloc_trace.h"
+
+// Page allocator and binary log for the host builds of slab and kmalloc. Pages come from the C
+// library, aligned so masking an object pointer down to its page still finds the slab header. A
+// page run is always freed as a whole by its owner, so one free() releases it
+void* request_page_internal(void)
+{
+    return aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+}
+
+void* request_pages_internal(u64 page_count)
+{
+    return aligned_alloc(PAGE_SIZE, page_count * PAGE_SIZE);
+}
+
+void free_page_internal(void* address)
+{
+    free(address);
+}
+
+void free_pages_internal(void* address, u64 page_count)
+{
+    free(address);
+}
+
+// Traced like their kernel.c counterparts when built with ALLOC_TRACE
+void* request_page(void)
+{
+    void* page = request_page_internal();
+    alloc_trace_alloc(AllocTraceKind_Page, page, PAGE_SIZE);
+    return page;
+}
+
+void* request_pages(u64 page_count)
+{
+    void* pages = request_pages_internal(page_count);
+    alloc_trace_alloc(AllocTraceKind_Page, pages, page_count * PAGE_SIZE);
+    return pages;
+}
+
+void free_page(void* address)
+{
+    alloc_trace_free(address);
+    free_page_internal(address);
+}
+
+void free_pages(void* address, u64 page_count)
+{
+    alloc_trace_free(address);
+    free_pages_internal(address, page_count);
+}
+
+// Nothing on the host decodes blog records, so they are dropped
+void blog_write(const char* format, const u64* args, u32 arg_count)
+{
+}
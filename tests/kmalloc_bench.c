@@ -0,0 +1,303 @@
+#include "bench.h"
+#include "slab.h"
+#include "kmalloc.h"
+#include "panic.h"
+
+// kmalloc against the C library allocator on synthetic traces. A trace is a fixed sequence of
+// allocations, frees and reallocations over a table of slots that ends with every slot free, so
+// it can be replayed in a loop; each benchmark iteration is one operation. Both allocators replay
+// the same trace. Page runs (slab pages and allocations above the largest size class) come from
+// aligned_alloc here, so the large trace measures kmalloc's own overhead on top of host pages
+// rather than the kernel page allocator.
+
+#define TRACE_MAX_OPS 65536
+#define TRACE_MAX_SLOTS 1024
+
+typedef enum TraceOpKind
+{
+    TraceOpKind_Alloc = 0,
+    TraceOpKind_Free = 1,
+    TraceOpKind_Realloc = 2,
+} TraceOpKind;
+
+typedef struct TraceOp
+{
+    u32 kind;
+    u32 slot;
+    u32 size;
+} TraceOp;
+
+typedef struct Trace
+{
+    const char* kmalloc_name;
+    const char* malloc_name;
+    TraceOp ops[TRACE_MAX_OPS];
+    u32 op_count;
+    u32 slot_count;
+    u32 next_op;
+    bool live[TRACE_MAX_SLOTS];
+    u32 sizes[TRACE_MAX_SLOTS];
+    void* slots[TRACE_MAX_SLOTS];
+} Trace;
+
+static Trace trace;
+static u64 trace_seed = 0x9e3779b97f4a7c15ull;
+
+static void trace_begin(const char* kmalloc_name, const char* malloc_name, u32 slot_count)
+{
+    trace.kmalloc_name = kmalloc_name;
+    trace.malloc_name = malloc_name;
+    trace.op_count = 0;
+    trace.slot_count = slot_count;
+    trace.next_op = 0;
+    memset(trace.live, 0, sizeof(trace.live));
+    memset(trace.slots, 0, sizeof(trace.slots));
+}
+
+static void trace_push(TraceOpKind kind, u32 slot, u32 size)
+{
+    if (trace.op_count == TRACE_MAX_OPS)
+    {
+        panic("trace: too many operations");
+    }
+
+    trace.ops[trace.op_count++] = (TraceOp) { .kind = kind, .slot = slot, .size = size };
+    trace.live[slot] = kind != TraceOpKind_Free;
+    trace.sizes[slot] = size;
+}
+
+// Frees whatever is still live, so the trace can start over
+static void trace_end(void)
+{
+    for (u32 slot = 0; slot < trace.slot_count; slot++)
+    {
+        if (trace.live[slot])
+        {
+            trace_push(TraceOpKind_Free, slot, 0);
+        }
+    }
+}
+
+// P(size > s) falls off like 1/s: most requests are a few dozen bytes, a few are kilobytes
+static u32 power_law_size(u32 max_size)
+{
+    u64 random = host_random(&trace_seed);
+    u32 k = __builtin_ctzll(random | (1ull << 10));
+    u32 base = 8u << k;
+    u32 size = base + (u32)((random >> 16) % base);
+
+    return size < max_size ? size : max_size;
+}
+
+static void trace_make_random(u32 op_count)
+{
+    trace_begin("kmalloc power-law random", "malloc power-law random", 1024);
+    while (trace.op_count < op_count)
+    {
+        u32 slot = (u32)(host_random(&trace_seed) % trace.slot_count);
+        if (trace.live[slot])
+        {
+            trace_push(TraceOpKind_Free, slot, 0);
+        }
+        else
+        {
+            trace_push(TraceOpKind_Alloc, slot, power_law_size(4096));
+        }
+    }
+    trace_end();
+}
+
+static void trace_make_lifo(u32 op_count)
+{
+    trace_begin("kmalloc power-law LIFO", "malloc power-law LIFO", 256);
+    while (trace.op_count + 2 * trace.slot_count <= op_count)
+    {
+        for (u32 slot = 0; slot < trace.slot_count; slot++)
+        {
+            trace_push(TraceOpKind_Alloc, slot, power_law_size(4096));
+        }
+        for (u32 slot = trace.slot_count; slot > 0; slot--)
+        {
+            trace_push(TraceOpKind_Free, slot - 1, 0);
+        }
+    }
+}
+
+static void trace_make_fifo(u32 op_count)
+{
+    trace_begin("kmalloc power-law FIFO", "malloc power-law FIFO", 256);
+    for (u32 i = 0; trace.op_count < op_count; i++)
+    {
+        u32 slot = i % trace.slot_count;
+        if (trace.live[slot])
+        {
+            trace_push(TraceOpKind_Free, slot, 0);
+        }
+        trace_push(TraceOpKind_Alloc, slot, power_law_size(4096));
+    }
+    trace_end();
+}
+
+static void trace_make_churn(const char* kmalloc_name, const char* malloc_name, u32 size, u32 op_count)
+{
+    trace_begin(kmalloc_name, malloc_name, 1);
+    while (trace.op_count < op_count)
+    {
+        trace_push(TraceOpKind_Alloc, 0, size);
+        trace_push(TraceOpKind_Free, 0, 0);
+    }
+}
+
+// Buffers that grow by half at a time, as buffer.h and the string builder do
+static void trace_make_realloc(u32 op_count)
+{
+    trace_begin("kmalloc realloc growth 16..64K", "malloc realloc growth 16..64K", 16);
+    while (trace.op_count < op_count)
+    {
+        u32 slot = (u32)(host_random(&trace_seed) % trace.slot_count);
+        if (!trace.live[slot])
+        {
+            trace_push(TraceOpKind_Alloc, slot, 16);
+        }
+        else if (trace.sizes[slot] >= 64 * 1024)
+        {
+            trace_push(TraceOpKind_Free, slot, 0);
+        }
+        else
+        {
+            trace_push(TraceOpKind_Realloc, slot, trace.sizes[slot] + trace.sizes[slot] / 2);
+        }
+    }
+    trace_end();
+}
+
+static void trace_make_large(u32 op_count)
+{
+    trace_begin("kmalloc large 8K..256K", "malloc large 8K..256K", 16);
+    while (trace.op_count < op_count)
+    {
+        u32 slot = (u32)(host_random(&trace_seed) % trace.slot_count);
+        if (trace.live[slot])
+        {
+            trace_push(TraceOpKind_Free, slot, 0);
+        }
+        else
+        {
+            trace_push(TraceOpKind_Alloc, slot, 8192 + (u32)(host_random(&trace_seed) % (248 * 1024)));
+        }
+    }
+    trace_end();
+}
+
+// Every allocation is tagged with its slot in the first word, which the free checks, so a block
+// handed out twice shows up as a panic instead of a fast number
+static inline void* trace_tag(void* ptr, u32 slot)
+{
+    if (!ptr)
+    {
+        panic("trace: allocation failed");
+    }
+
+    *(u32*)ptr = slot;
+    return ptr;
+}
+
+static inline void trace_check(void* ptr, u32 slot)
+{
+    if (*(u32*)ptr != slot)
+    {
+        panic("trace: block of one slot was handed out to another");
+    }
+}
+
+static inline void trace_step_kmalloc(void)
+{
+    TraceOp op = trace.ops[trace.next_op];
+    trace.next_op = trace.next_op + 1 == trace.op_count ? 0 : trace.next_op + 1;
+
+    switch (op.kind)
+    {
+        case TraceOpKind_Alloc:
+            trace.slots[op.slot] = trace_tag(kmalloc(op.size), op.slot);
+            break;
+        case TraceOpKind_Free:
+            trace_check(trace.slots[op.slot], op.slot);
+            kfree(trace.slots[op.slot]);
+            break;
+        case TraceOpKind_Realloc:
+            trace.slots[op.slot] = trace_tag(krealloc(trace.slots[op.slot], op.size), op.slot);
+            break;
+    }
+}
+
+static inline void trace_step_malloc(void)
+{
+    TraceOp op = trace.ops[trace.next_op];
+    trace.next_op = trace.next_op + 1 == trace.op_count ? 0 : trace.next_op + 1;
+
+    switch (op.kind)
+    {
+        case TraceOpKind_Alloc:
+            trace.slots[op.slot] = trace_tag(malloc(op.size), op.slot);
+            break;
+        case TraceOpKind_Free:
+            trace_check(trace.slots[op.slot], op.slot);
+            free(trace.slots[op.slot]);
+            break;
+        case TraceOpKind_Realloc:
+            trace.slots[op.slot] = trace_tag(realloc(trace.slots[op.slot], op.size), op.slot);
+            break;
+    }
+}
+
+// One full pass first, which warms both allocators up and checks the trace, then the timed
+// replay. The replay may stop in the middle of the trace, so it is finished off afterwards and
+// the next benchmark starts with nothing allocated
+static void bench_trace(void)
+{
+    trace.next_op = 0;
+    for (u32 i = 0; i < trace.op_count; i++)
+    {
+        trace_step_kmalloc();
+    }
+    BENCH(trace.kmalloc_name, 0, trace_step_kmalloc());
+    while (trace.next_op)
+    {
+        trace_step_kmalloc();
+    }
+
+    for (u32 i = 0; i < trace.op_count; i++)
+    {
+        trace_step_malloc();
+    }
+    BENCH(trace.malloc_name, 0, trace_step_malloc());
+    while (trace.next_op)
+    {
+        trace_step_malloc();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    host_setup();
+    slab_setup();
+    kmalloc_setup();
+    bench_setup(argc, argv);
+
+    trace_make_random(32768);
+    bench_trace();
+    trace_make_lifo(32768);
+    bench_trace();
+    trace_make_fifo(32768);
+    bench_trace();
+    trace_make_churn("kmalloc churn 64", "malloc churn 64", 64, 4096);
+    bench_trace();
+    trace_make_churn("kmalloc churn 512", "malloc churn 512", 512, 4096);
+    bench_trace();
+    trace_make_realloc(32768);
+    bench_trace();
+    trace_make_large(4096);
+    bench_trace();
+
+    return 0;
+}
@@ -0,0 +1,327 @@
+#include "bench.h"
+#include "typed_print.h"
+#include "checksum.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include <pthread.h>
+
+// Microbenchmarks for the hot libk primitives: the memory and string routines at the sizes the
+// kernel uses them (struct copies, pixel rows, whole pages), formatting, the checksums and the
+// spinlock.h locks under contention
+
+static void bench_memory(void)
+{
+    usize large = 1024 * 1024;
+    u8* src = aligned_alloc(64, large + 64);
+    u8* dst = aligned_alloc(64, large + 64);
+    memset(src, 0x5a, large + 64);
+    memset(dst, 0, large + 64);
+
+    usize sizes[] = { 8, 16, 32, 64, 128, 256, 1024, 4096, 65536, 1024 * 1024 };
+    char name[64];
+
+    for (u32 i = 0; i < array_length(sizes); i++)
+    {
+        usize bytes = sizes[i];
+
+        snprintf(name, sizeof(name), "memcpy %64u", (u64)bytes);
+        BENCH(name, bytes, memcpy(dst, src, bytes));
+        snprintf(name, sizeof(name), "memcpy %64u misaligned", (u64)bytes);
+        BENCH(name, bytes, memcpy(dst + 1, src + 3, bytes));
+        snprintf(name, sizeof(name), "memmove %64u overlapping", (u64)bytes);
+        BENCH(name, bytes, memmove(dst + 8, dst, bytes));
+        snprintf(name, sizeof(name), "memset %64u", (u64)bytes);
+        BENCH(name, bytes, memset(dst, 0x11, bytes));
+        snprintf(name, sizeof(name), "memset32 %64u", (u64)bytes);
+        BENCH(name, bytes, memset32(dst, 0x11223344, bytes / 4));
+        snprintf(name, sizeof(name), "memequal %64u", (u64)bytes);
+        BENCH(name, bytes, bench_use(memequal(dst, dst + 32, bytes)));
+    }
+
+    BENCH("memcpy_nt 1048576", large, memcpy_nt(dst, src, large));
+    BENCH("memset_nt 1048576", large, memset_nt(dst, 0x22, large));
+    BENCH("memset32_nt 1048576", large, memset32_nt(dst, 0x11223344, large / 4));
+
+    free(src);
+    free(dst);
+}
+
+// memcpy and memset from 8 B to 8 MiB once per kernel set libk_setup can pick, to check where the
+// AVX2 loops and rep movsb/stosb start paying off. The CPU features are narrowed to each set in
+// turn; sets the host CPU lacks are skipped. With FSRM rep movsb/stosb take over from 256 bytes, so
+// the "erms" rows are the vector kernels below that. --quick stops at 64 KiB.
+static void bench_memory_kernels(void)
+{
+    usize largest = bench_config.quick ? 64 * 1024 : 8 * 1024 * 1024;
+    u8* src = aligned_alloc(64, largest);
+    u8* dst = aligned_alloc(64, largest);
+    memset(src, 0x5a, largest);
+    memset(dst, 0, largest);
+
+    CPUFeatures sse2 = { 0 };
+    CPUFeatures avx2 = { .AVX2 = true };
+    CPUFeatures erms = { .AVX2 = cpu_features.AVX2, .ERMS = true, .FSRM = cpu_features.FSRM };
+    struct
+    {
+        const char* name;
+        const CPUFeatures* features;
+        bool supported;
+    } kernels[] =
+    {
+        { "sse2", &sse2, true },
+        { "avx2", &avx2, cpu_features.AVX2 },
+        { "erms", &erms, cpu_features.ERMS },
+    };
+    char name[64];
+
+    for (u32 k = 0; k < array_length(kernels); k++)
+    {
+        if (!kernels[k].supported)
+        {
+            printf("%s kernels: not supported by this CPU\n", kernels[k].name);
+            continue;
+        }
+
+        libk_setup(kernels[k].features);
+        for (usize bytes = 8; bytes <= largest; bytes *= 2)
+        {
+            snprintf(name, sizeof(name), "memcpy %s %64u", kernels[k].name, (u64)bytes);
+            BENCH(name, bytes, memcpy(dst, src, bytes));
+            snprintf(name, sizeof(name), "memset %s %64u", kernels[k].name, (u64)bytes);
+            BENCH(name, bytes, memset(dst, 0x11, bytes));
+        }
+    }
+
+    libk_setup(&cpu_features);
+    free(src);
+    free(dst);
+}
+
+static void bench_strings(void)
+{
+    usize lengths[] = { 7, 32, 100, 1000 };
+    char* a = aligned_alloc(64, 1024 + 64);
+    char* b = aligned_alloc(64, 1024 + 64);
+    char name[64];
+
+    for (u32 i = 0; i < array_length(lengths); i++)
+    {
+        usize length = lengths[i];
+        memset(a, 'x', length);
+        a[length] = 0;
+        memset(b + 1, 'x', length);
+        b[length + 1] = 0;
+
+        snprintf(name, sizeof(name), "strlen %64u", (u64)length);
+        BENCH(name, length, bench_use(strlen(a)));
+        snprintf(name, sizeof(name), "strcmp %64u", (u64)length);
+        BENCH(name, length, bench_use((u64)strcmp(a, b + 1)));
+        snprintf(name, sizeof(name), "strncmp %64u", (u64)length);
+        BENCH(name, length, bench_use((u64)strncmp(a, b + 1, length)));
+        snprintf(name, sizeof(name), "strcpy %64u", (u64)length);
+        BENCH(name, length, strcpy(b, a));
+    }
+
+    BENCH("string_to_unsigned decimal", 0, bench_use(string_to_unsigned("18446744073709551615")));
+    BENCH("string_to_unsigned hexadecimal", 0, bench_use(string_to_unsigned("0xDEADBEEFCAFEBABE")));
+
+    free(a);
+    free(b);
+}
+
+static void bench_format(void)
+{
+    char buffer[256];
+    char sink_buffer[256];
+
+    BENCH("snprintf literal", 0, bench_use((u64)snprintf(buffer, sizeof(buffer), "Free RAM: KB")));
+    BENCH("snprintf %64u", 0, bench_use((u64)snprintf(buffer, sizeof(buffer), "%64u", 18446744073709551615ull)));
+    BENCH("snprintf %32u small", 0, bench_use((u64)snprintf(buffer, sizeof(buffer), "%32u", 42)));
+    BENCH("snprintf %64s", 0, bench_use((u64)snprintf(buffer, sizeof(buffer), "%64s", (s64)-1234567890123ll)));
+    BENCH("snprintf %64h", 0, bench_use((u64)snprintf(buffer, sizeof(buffer), "%64h", 0xdeadbeefcafebabeull)));
+    BENCH("snprintf %64b", 0, bench_use((u64)snprintf(buffer, sizeof(buffer), "%64b", 0xdeadbeefcafebabeull)));
+    BENCH("snprintf %f shortest", 0, bench_use((u64)snprintf(buffer, sizeof(buffer), "%f", 3.141592653589793)));
+    BENCH("snprintf %f precision 3", 0, bench_use((u64)snprintf(buffer, sizeof(buffer), "%[.3]f", 2.718281828)));
+    BENCH("snprintf mixed line", 0, bench_use((u64)snprintf(buffer, sizeof(buffer), "%s: %64u calls, %64u bytes, %64h", "slab", 123456ull, 987654321ull, 0xffff800000001000ull)));
+    BENCH("sink_tprint mixed line", 0,
+          BufferSink sink = buffer_sink_make(sink_buffer, sizeof(sink_buffer));
+          bench_use((u64)sink_tprint(&sink.sink, "slab", ": ", 123456ull, " calls, ", 987654321ull, " bytes, ", fmt_hex(0xffff800000001000ull))));
+}
+
+static void bench_checksums(void)
+{
+    usize bytes = 4096;
+    u8* data = aligned_alloc(64, bytes);
+    memset(data, 0xa5, bytes);
+
+    BENCH("crc32c 4096", bytes, bench_use(crc32c(0, data, bytes)));
+    BENCH("crc32c 64", 64, bench_use(crc32c(0, data, 64)));
+    BENCH("xxhash64 4096", bytes, bench_use(xxhash64(data, bytes, 0)));
+    BENCH("xxhash64 16", 16, bench_use(xxhash64(data, 16, 0)));
+    BENCH("byte_sum 4096", bytes, bench_use(byte_sum(data, bytes)));
+
+    free(data);
+}
+
+typedef enum BenchLockKind
+{
+    BenchLockKind_Spinlock,
+    BenchLockKind_TicketLock,
+    BenchLockKind_MCSLock,
+    BenchLockKind_RWLockWrite,
+    BenchLockKind_RWLockRead,
+    BenchLockKind_SeqLockRead,
+    BenchLockKind_Count,
+} BenchLockKind;
+
+static const char* bench_lock_names[BenchLockKind_Count] =
+{
+    [BenchLockKind_Spinlock] = "spin_lock",
+    [BenchLockKind_TicketLock] = "ticket_lock",
+    [BenchLockKind_MCSLock] = "mcs_lock",
+    [BenchLockKind_RWLockWrite] = "write_lock",
+    [BenchLockKind_RWLockRead] = "read_lock",
+    [BenchLockKind_SeqLockRead] = "read_seqbegin",
+};
+
+typedef struct BenchLocks
+{
+    Spinlock spinlock;
+    ALIGN(CACHE_LINE_SIZE) TicketLock ticket_lock;
+    ALIGN(CACHE_LINE_SIZE) MCSLock mcs_lock;
+    ALIGN(CACHE_LINE_SIZE) RWLock rw_lock;
+    ALIGN(CACHE_LINE_SIZE) SeqLock seq_lock;
+    // What the critical section touches, on its own line so only the lock word itself is shared
+    ALIGN(CACHE_LINE_SIZE) volatile u64 counter;
+} BenchLocks;
+
+static BenchLocks bench_locks;
+static pthread_barrier_t bench_lock_barrier;
+
+typedef struct BenchLockThread
+{
+    pthread_t thread;
+    BenchLockKind kind;
+    u32 count;
+    u64 begin;
+    u64 end;
+} BenchLockThread;
+
+static void* bench_lock_thread(void* argument)
+{
+    BenchLockThread* self = argument;
+    MCSNode node;
+
+    pthread_barrier_wait(&bench_lock_barrier);
+    self->begin = bench_start();
+    for (u32 i = 0; i < self->count; i++)
+    {
+        switch (self->kind)
+        {
+            case BenchLockKind_Spinlock:
+                spin_lock(&bench_locks.spinlock);
+                bench_locks.counter = bench_locks.counter + 1;
+                spin_unlock(&bench_locks.spinlock);
+                break;
+            case BenchLockKind_TicketLock:
+                ticket_lock(&bench_locks.ticket_lock);
+                bench_locks.counter = bench_locks.counter + 1;
+                ticket_unlock(&bench_locks.ticket_lock);
+                break;
+            case BenchLockKind_MCSLock:
+                mcs_lock(&bench_locks.mcs_lock, &node);
+                bench_locks.counter = bench_locks.counter + 1;
+                mcs_unlock(&bench_locks.mcs_lock, &node);
+                break;
+            case BenchLockKind_RWLockWrite:
+                write_lock(&bench_locks.rw_lock);
+                bench_locks.counter = bench_locks.counter + 1;
+                write_unlock(&bench_locks.rw_lock);
+                break;
+            case BenchLockKind_RWLockRead:
+                read_lock(&bench_locks.rw_lock);
+                bench_use(bench_locks.counter);
+                read_unlock(&bench_locks.rw_lock);
+                break;
+            case BenchLockKind_SeqLockRead:
+            {
+                u32 sequence;
+                u64 value;
+                do
+                {
+                    sequence = read_seqbegin(&bench_locks.seq_lock);
+                    value = bench_locks.counter;
+                } while (read_seqretry(&bench_locks.seq_lock, sequence));
+                bench_use(value);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    self->end = bench_stop();
+    return NULL;
+}
+
+// Every thread takes the lock, touches one shared counter and releases it, as fast as it can, so
+// the numbers are cycles per acquisition under maximum contention. A sample runs from the first
+// thread starting to the last one finishing, from TSC reads in the threads themselves (the TSC is
+// synchronized across cores). The host yields to other threads after spinning a while
+// (see host_relax) and threads beyond the CPU count take turns on time slices, so only the counts
+// up to the CPU count show the cost of handing the lock between cores.
+static void bench_lock_contention(void)
+{
+    u32 thread_counts[] = { 1, 2, 4, 8 };
+    u32 per_thread = bench_config.quick ? 1000 : 20000;
+    u32 sample_count = bench_config.sample_count < 11 ? bench_config.sample_count : 11;
+    u64 samples[BENCH_MAX_SAMPLES];
+    char name[64];
+
+    for (BenchLockKind kind = 0; kind < BenchLockKind_Count; kind++)
+    {
+        for (u32 t = 0; t < array_length(thread_counts); t++)
+        {
+            u32 thread_count = thread_counts[t];
+            BenchLockThread threads[8];
+
+            for (u32 sample = 0; sample < sample_count; sample++)
+            {
+                pthread_barrier_init(&bench_lock_barrier, NULL, thread_count);
+                for (u32 i = 0; i < thread_count; i++)
+                {
+                    threads[i] = (BenchLockThread) { .kind = kind, .count = per_thread };
+                    pthread_create(&threads[i].thread, NULL, bench_lock_thread, &threads[i]);
+                }
+
+                u64 begin = UINT64_MAX;
+                u64 end = 0;
+                for (u32 i = 0; i < thread_count; i++)
+                {
+                    pthread_join(threads[i].thread, NULL);
+                    begin = threads[i].begin < begin ? threads[i].begin : begin;
+                    end = threads[i].end > end ? threads[i].end : end;
+                }
+                samples[sample] = end - begin;
+                pthread_barrier_destroy(&bench_lock_barrier);
+            }
+
+            snprintf(name, sizeof(name), "%s %32u threads", bench_lock_names[kind], thread_count);
+            bench_report(name, samples, sample_count, thread_count * per_thread, 0);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    host_setup();
+    bench_setup(argc, argv);
+
+    bench_memory();
+    bench_memory_kernels();
+    bench_strings();
+    bench_format();
+    bench_checksums();
+    bench_lock_contention();
+
+    return 0;
+}
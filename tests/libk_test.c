@@ -0,0 +1,952 @@
+#include "host.h"
+#include "typed_print.h"
+#include "checksum.h"
+#include "buffer.h"
+#include "slab.h"
+#include "queue.h"
+#include "spinlock.h"
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+
+// Correctness tests for libk.c, checksum.c, the buffer.h and queue.h containers and the spinlock.h locks. The memory and string routines are compared against
+// byte-at-a-time reference loops over every small size and alignment, since their vector kernels
+// have separate head, body and tail paths. The queues and locks run with real threads, which yield
+// instead of spinning while they wait (see host_relax) so the tests also finish on a single CPU. The checks
+// themselves only run on the main thread, because host_check is not thread safe
+
+static char format_buffer[512];
+
+static const char* format(const char* format, ...)
+{
+    va_list list;
+    va_start(list, format);
+    vsnprintf(format_buffer, sizeof(format_buffer), format, list);
+    va_end(list);
+    return format_buffer;
+}
+
+static void test_format_integers(void)
+{
+    CHECK_STRING(format("%8u %16u %32u %64u", 255, 65535, 4294967295u, 18446744073709551615ull), "255 65535 4294967295 18446744073709551615");
+    CHECK_STRING(format("%8u", 256), "0");
+    CHECK_STRING(format("%32u", 0), "0");
+    CHECK_STRING(format("%8s %16s %32s %64s", -1, -300, -70000, (s64)-5000000000ll), "-1 -300 -70000 -5000000000");
+    CHECK_STRING(format("%64s", (s64)(-9223372036854775807ll - 1)), "-9223372036854775808");
+    CHECK_STRING(format("%32s", 2147483647), "2147483647");
+    CHECK_STRING(format("%8h %16h %32h %64h", 0xab, 0xabcd, 0xdeadbeef, 0x0123456789abcdefull), "0xAB 0xABCD 0xDEADBEEF 0x0123456789ABCDEF");
+    CHECK_STRING(format("%16h", 0xf), "0x000F");
+    CHECK_STRING(format("%8b", 0xa5), "0b10100101");
+    CHECK_STRING(format("%16b", 0x8001), "0b1000000000000001");
+    CHECK_STRING(format("%32b", 5), "0b00000000000000000000000000000101");
+
+    // Every digit count, including the boundaries of the two-digits-per-step conversion
+    u64 value = 1;
+    for (u32 digits = 1; digits <= 20; digits++, value *= 10)
+    {
+        char expected[24];
+        expected[0] = '1';
+        for (u32 i = 1; i < digits; i++)
+        {
+            expected[i] = '0';
+        }
+        expected[digits] = 0;
+        CHECK_STRING(format("%64u", value), expected);
+
+        if (digits > 1)
+        {
+            for (u32 i = 0; i < digits - 1; i++)
+            {
+                expected[i] = '9';
+            }
+            expected[digits - 1] = 0;
+            CHECK_STRING(format("%64u", value - 1), expected);
+        }
+    }
+}
+
+static void test_format_other_types(void)
+{
+    CHECK_STRING(format("%s, %s", "hello", ""), "hello, ");
+    CHECK_STRING(format("%c%c%c", 'a', 'b', 'c'), "abc");
+    CHECK_STRING(format("%b %b", 1, 0), "true false");
+    CHECK_STRING(format("plain text"), "plain text");
+    // Tabs advance to the next multiple of four columns
+    CHECK_STRING(format("a\tb"), "a   b");
+    CHECK_STRING(format("abcd\te"), "abcd    e");
+}
+
+static void test_format_spec(void)
+{
+    CHECK_STRING(format("%[8]32u|", 42), "      42|");
+    CHECK_STRING(format("%[-8]32u|", 42), "42      |");
+    CHECK_STRING(format("%[08]32u|", 42), "00000042|");
+    // Zero fill goes between the sign and the digits
+    CHECK_STRING(format("%[08]32s|", -42), "-0000042|");
+    CHECK_STRING(format("%['*6]s|", "ab"), "****ab|");
+    CHECK_STRING(format("%[2]s|", "abcdef"), "abcdef|");
+    CHECK_STRING(format("%[.3]s|", "abcdef"), "abc|");
+    CHECK_STRING(format("%[.10]s|", "abc"), "abc|");
+    // Width taken from the arguments
+    CHECK_STRING(format("%[*]32u|", 5, 7), "    7|");
+    CHECK_STRING(format("%[-*]s|", 4, "x"), "x   |");
+}
+
+static void test_format_float(void)
+{
+    CHECK_STRING(format("%f", 0.1), "0.1");
+    CHECK_STRING(format("%f", 1.5), "1.5");
+    CHECK_STRING(format("%f", 100.0), "100.0");
+    CHECK_STRING(format("%f", -2.5), "-2.5");
+    CHECK_STRING(format("%f", 0.0), "0.0");
+    CHECK_STRING(format("%f", -0.0), "-0.0");
+    CHECK_STRING(format("%f", 123456.789), "123456.789");
+    CHECK_STRING(format("%f", 1e21), "1e+21");
+    CHECK_STRING(format("%f", 1e-7), "1e-7");
+    CHECK_STRING(format("%f", 5e-324), "5e-324");
+    CHECK_STRING(format("%f", 1.7976931348623157e308), "1.7976931348623157e+308");
+    CHECK_STRING(format("%f", 1.0 / 0.0), "inf");
+    CHECK_STRING(format("%f", -1.0 / 0.0), "-inf");
+    CHECK_STRING(format("%[.2]f", 3.14159), "3.14");
+    CHECK_STRING(format("%[.0]f", 2.5), "3");
+    CHECK_STRING(format("%[.3]f", 0.0005), "0.001");
+    CHECK_STRING(format("%[.2]f", 9.999), "10.00");
+
+    // The shortest representation must read back as the same double
+    u64 state = 0x9e3779b97f4a7c15ull;
+    u32 mismatch_count = 0;
+    for (u32 i = 0; i < 100000; i++)
+    {
+        union { u64 u; f64 f; } bits = { .u = host_random(&state) };
+        u32 exponent = (bits.u >> 52) & 0x7ff;
+        if (exponent == 0x7ff)
+        {
+            continue;
+        }
+
+        const char* text = format("%f", bits.f);
+        if (strtod(text, NULL) != bits.f)
+        {
+            if (mismatch_count++ < 5)
+            {
+                printf("round trip failed: %s\n", text);
+            }
+        }
+    }
+    CHECK(mismatch_count == 0);
+}
+
+static void test_snprintf(void)
+{
+    char buffer[8];
+
+    // Truncates to capacity - 1 characters, returns the untruncated length
+    CHECK(snprintf(buffer, 5, "%s", "hello world") == 11);
+    CHECK_STRING(buffer, "hell");
+    CHECK(snprintf(buffer, sizeof(buffer), "%32u", 1234567) == 7);
+    CHECK_STRING(buffer, "1234567");
+    CHECK(snprintf(buffer, sizeof(buffer), "%32u", 12345678) == 8);
+    CHECK_STRING(buffer, "1234567");
+    CHECK(snprintf(buffer, 1, "abc") == 3);
+    CHECK_STRING(buffer, "");
+
+    buffer[0] = 'x';
+    CHECK(snprintf(buffer, 0, "abc") == 3);
+    CHECK(buffer[0] == 'x');
+
+    char sink_buffer[32];
+    BufferSink sink = buffer_sink_make(sink_buffer, sizeof(sink_buffer));
+    sink_print(&sink.sink, "%s=%32u", "answer", 42);
+    sink_print(&sink.sink, ";");
+    CHECK(sink.length == 10);
+}
+
+static void test_print(void)
+{
+    host_console_reset();
+    print("x%32uy", 3);
+    println("z");
+    CHECK_STRING(host_console, "x3yz\n");
+
+    host_console_reset();
+    tprintln("a", 1, " ", fmt_hex((u8)0xf), " ", 2.5, " ", fmt_width(7, 4), (char)'c');
+    CHECK_STRING(host_console, "a1 0x0F 2.5    7c\n");
+
+    host_console_reset();
+    tprint(fmt_bin((u8)5), " ", -3, " ", fmt_precision(1.0 / 3.0, 3), " ", "s");
+    CHECK_STRING(host_console, "0b00000101 -3 0.333 s");
+}
+
+static void test_string_to_unsigned(void)
+{
+    CHECK_U64(string_to_unsigned("0"), 0);
+    CHECK_U64(string_to_unsigned("7"), 7);
+    CHECK_U64(string_to_unsigned("1234567890"), 1234567890);
+    CHECK_U64(string_to_unsigned("18446744073709551615"), 18446744073709551615ull);
+    CHECK_U64(string_to_unsigned("0x0"), 0);
+    CHECK_U64(string_to_unsigned("0xff"), 0xff);
+    CHECK_U64(string_to_unsigned("0xDeadBeef"), 0xdeadbeef);
+    CHECK_U64(string_to_unsigned("0xFFFFFFFFFFFFFFFF"), 0xffffffffffffffffull);
+    CHECK_U64(string_to_unsigned("0b0"), 0);
+    CHECK_U64(string_to_unsigned("0b101"), 5);
+    CHECK_U64(string_to_unsigned("0b1111111111111111111111111111111111111111111111111111111111111111"), 0xffffffffffffffffull);
+
+    // Whatever the formatter writes reads back
+    u64 state = 12345;
+    for (u32 i = 0; i < 1000; i++)
+    {
+        u64 value = host_random(&state) >> (i % 64);
+        CHECK_U64(string_to_unsigned(format("%64u", value)), value);
+        CHECK_U64(string_to_unsigned(format("%64h", value)), value);
+        CHECK_U64(string_to_unsigned(format("%64b", value)), value);
+    }
+}
+
+static s32 reference_strcmp(const char* a, const char* b, usize count)
+{
+    for (usize i = 0; i < count; i++)
+    {
+        if (a[i] != b[i] || !a[i])
+        {
+            return (u8)a[i] - (u8)b[i];
+        }
+    }
+    return 0;
+}
+
+static s32 sign(s32 value)
+{
+    return (value > 0) - (value < 0);
+}
+
+static void test_strings(void)
+{
+    // The second page is inaccessible: strings end right before it, so any read past the
+    // terminator that crosses into the next page faults
+    u8* pages = mmap(NULL, 2 * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK(pages != MAP_FAILED && mprotect(pages + 4096, 4096, PROT_NONE) == 0);
+    char* other = aligned_alloc(64, 512);
+
+    for (usize length = 0; length < 300; length++)
+    {
+        for (usize slack = 0; slack < 32; slack++)
+        {
+            char* str = (char*)pages + 4096 - 1 - slack - length;
+            for (usize i = 0; i < length; i++)
+            {
+                str[i] = 'a' + (i % 26);
+            }
+            str[length] = 0;
+            CHECK(strlen(str) == length);
+
+            char* copy = other + (length + slack) % 64;
+            CHECK(strcpy(copy, str) == copy);
+            CHECK(memcmp(copy, str, length + 1) == 0);
+            CHECK(strcmp(copy, str) == 0);
+            CHECK(strncmp(copy, str, length + 10) == 0);
+            CHECK(string_eq(copy, str));
+
+            if (length)
+            {
+                usize position = (slack * 7 + length) % length;
+                copy[position]++;
+                CHECK(sign(strcmp(str, copy)) == sign(reference_strcmp(str, copy, length + 1)));
+                CHECK(sign(strcmp(copy, str)) == sign(reference_strcmp(copy, str, length + 1)));
+                CHECK(strncmp(str, copy, position) == 0);
+                CHECK(sign(strncmp(str, copy, position + 1)) == sign(reference_strcmp(str, copy, position + 1)));
+                CHECK(!string_eq(copy, str));
+                copy[position]--;
+
+                // A prefix compares lower
+                copy[length - 1] = 0;
+                CHECK(strcmp(copy, str) < 0);
+                CHECK(strcmp(str, copy) > 0);
+            }
+        }
+    }
+
+    // Bytes above 0x7f compare as unsigned
+    CHECK(strcmp("\x80", "\x7f") > 0);
+    CHECK(strncmp("abc", "abd", 2) == 0);
+    CHECK(strncmp("abc", "abd", 0) == 0);
+
+    munmap(pages, 2 * 4096);
+    free(other);
+}
+
+#define MEMORY_TEST_SIZE 1024
+#define MEMORY_GUARD 64
+
+// Fills both buffers with the same pattern, so everything outside the written range can be compared too
+static void memory_pattern(u8* a, u8* b, usize bytes, u64 seed)
+{
+    for (usize i = 0; i < bytes; i++)
+    {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        a[i] = b[i] = (u8)(seed >> 56);
+    }
+}
+
+static void test_memory(void)
+{
+    usize buffer_size = MEMORY_TEST_SIZE + 2 * MEMORY_GUARD + 64;
+    u8* actual = aligned_alloc(64, buffer_size);
+    u8* expected = aligned_alloc(64, buffer_size);
+    u8* source = aligned_alloc(64, buffer_size);
+
+    u32 sizes[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 48, 63, 64, 65, 100, 127, 128, 129, 255, 256, 257, 511, 512, 700, 1000, 1024 };
+
+    for (u32 s = 0; s < array_length(sizes); s++)
+    {
+        usize bytes = sizes[s];
+
+        for (usize dst_offset = 0; dst_offset < 64; dst_offset += 5)
+        {
+            for (usize src_offset = 0; src_offset < 64; src_offset += 11)
+            {
+                u8* dst = actual + MEMORY_GUARD + dst_offset;
+                u8* ref = expected + MEMORY_GUARD + dst_offset;
+                u8* src = source + MEMORY_GUARD + src_offset;
+                u64 seed = bytes * 131 + dst_offset * 7 + src_offset;
+
+                memory_pattern(source, source, buffer_size, seed ^ 0xabcdef);
+
+                memory_pattern(actual, expected, buffer_size, seed);
+                CHECK(memcpy(dst, src, bytes) == dst);
+                for (usize i = 0; i < bytes; i++)
+                {
+                    ref[i] = src[i];
+                }
+                CHECK(memcmp(actual, expected, buffer_size) == 0);
+
+                memory_pattern(actual, expected, buffer_size, seed);
+                CHECK(memcpy_nt(dst, src, bytes) == dst);
+                for (usize i = 0; i < bytes; i++)
+                {
+                    ref[i] = src[i];
+                }
+                CHECK(memcmp(actual, expected, buffer_size) == 0);
+
+                CHECK(memequal(dst, src, bytes));
+                if (bytes)
+                {
+                    dst[(seed >> 3) % bytes] ^= 0x10;
+                    CHECK(!memequal(dst, src, bytes));
+                }
+
+                // Overlapping moves in both directions, within the same buffer
+                usize distance = src_offset % 40 + 1;
+                for (u32 direction = 0; direction < 2; direction++)
+                {
+                    memory_pattern(actual, expected, buffer_size, seed);
+                    u8* from = direction ? dst + distance : dst;
+                    u8* to = direction ? dst : dst + distance;
+                    if (to + bytes > actual + buffer_size || from + bytes > actual + buffer_size)
+                    {
+                        continue;
+                    }
+
+                    u8* ref_from = expected + (from - actual);
+                    u8* ref_to = expected + (to - actual);
+                    CHECK(memmove(to, from, bytes) == to);
+                    if (ref_to < ref_from)
+                    {
+                        for (usize i = 0; i < bytes; i++)
+                        {
+                            ref_to[i] = ref_from[i];
+                        }
+                    }
+                    else
+                    {
+                        for (usize i = bytes; i--;)
+                        {
+                            ref_to[i] = ref_from[i];
+                        }
+                    }
+                    CHECK(memcmp(actual, expected, buffer_size) == 0);
+                }
+            }
+
+            u8 value = (u8)(bytes + dst_offset);
+            u8* dst = actual + MEMORY_GUARD + dst_offset;
+            u8* ref = expected + MEMORY_GUARD + dst_offset;
+
+            memory_pattern(actual, expected, buffer_size, bytes);
+            memset(dst, value, bytes);
+            for (usize i = 0; i < bytes; i++)
+            {
+                ref[i] = value;
+            }
+            CHECK(memcmp(actual, expected, buffer_size) == 0);
+
+            memory_pattern(actual, expected, buffer_size, bytes);
+            memset_nt(dst, value, bytes);
+            for (usize i = 0; i < bytes; i++)
+            {
+                ref[i] = value;
+            }
+            CHECK(memcmp(actual, expected, buffer_size) == 0);
+
+            // The 32-bit fills require 4-byte alignment
+            u32* dst32 = (u32*)(actual + MEMORY_GUARD + (dst_offset & ~3));
+            u32* ref32 = (u32*)(expected + MEMORY_GUARD + (dst_offset & ~3));
+            u32 value32 = 0x11223344u * (u32)(bytes + 1);
+            usize count = bytes / 4;
+
+            memory_pattern(actual, expected, buffer_size, bytes);
+            memset32(dst32, value32, count);
+            for (usize i = 0; i < count; i++)
+            {
+                ref32[i] = value32;
+            }
+            CHECK(memcmp(actual, expected, buffer_size) == 0);
+
+            memory_pattern(actual, expected, buffer_size, bytes);
+            memset32_nt(dst32, value32, count);
+            for (usize i = 0; i < count; i++)
+            {
+                ref32[i] = value32;
+            }
+            CHECK(memcmp(actual, expected, buffer_size) == 0);
+        }
+    }
+
+    // Large enough for the rep movsb/stosb and non-temporal paths
+    usize large = 256 * 1024 + 13;
+    u8* large_a = malloc(large + 64);
+    u8* large_b = malloc(large + 64);
+    memory_pattern(large_a, large_a, large + 64, 99);
+    memcpy(large_b + 3, large_a + 1, large);
+    CHECK(memcmp(large_b + 3, large_a + 1, large) == 0);
+    memcpy_nt(large_b + 1, large_a + 5, large);
+    CHECK(memcmp(large_b + 1, large_a + 5, large) == 0);
+
+    // Overlapping, forwards and backwards
+    memcpy(large_b, large_a, large + 64);
+    memmove(large_a + 17, large_a + 1, large);
+    CHECK(memcmp(large_a + 17, large_b + 1, large) == 0);
+    memcpy(large_b, large_a, large + 64);
+    memmove(large_a + 1, large_a + 17, large);
+    CHECK(memcmp(large_a + 1, large_b + 17, large) == 0);
+
+    memset(large_b, 0x5a, large);
+    memset_nt(large_a, 0x5a, large);
+    CHECK(memcmp(large_a, large_b, large) == 0);
+    free(large_a);
+    free(large_b);
+
+    free(actual);
+    free(expected);
+    free(source);
+}
+
+static void test_checksums(void)
+{
+    CHECK(crc32c(0, "123456789", 9) == 0xe3069283);
+    CHECK(crc32c(0, "", 0) == 0);
+    // Continuing over split data gives the same result
+    CHECK(crc32c(crc32c(0, "12345", 5), "6789", 4) == 0xe3069283);
+
+    CHECK_U64(xxhash64("", 0, 0), 0xef46db3751d8e999ull);
+    CHECK_U64(xxhash64("a", 1, 0), 0xd24ec4f1a98c6e5bull);
+
+    u8 table[] = { 1, 2, 3, (u8)-6 };
+    CHECK(byte_sum(table, sizeof(table)) == 0);
+}
+
+GEN_BUFFER_STRUCT(u64)
+GEN_BUFFER_FUNCTIONS(u64Buffer, u64)
+
+static void test_buffers(void)
+{
+    SB sb = { 0 };
+    CHECK(SB_append_string(&sb, "Hello"));
+    CHECK(SB_push(&sb, ','));
+    CHECK(SB_append(&sb, " world", 6));
+    CHECK_STRING(SB_c_str(&sb), "Hello, world");
+    CHECK(sb.len == 12);
+    CHECK(sb.cap == 16);
+
+    // Growth doubles from the minimum capacity and keeps the contents
+    u64Buffer numbers = { 0 };
+    for (u64 i = 0; i < 1000; i++)
+    {
+        CHECK(u64Buffer_push(&numbers, i * i));
+        CHECK(numbers.cap >= numbers.len);
+    }
+    CHECK(numbers.cap == 1024);
+    bool intact = true;
+    for (u64 i = 0; i < 1000; i++)
+    {
+        intact &= numbers.ptr[i] == i * i;
+    }
+    CHECK(intact);
+
+    // One bulk append past the doubled capacity reserves enough in one step
+    u64 block[3000];
+    for (u32 i = 0; i < array_length(block); i++)
+    {
+        block[i] = i;
+    }
+    CHECK(u64Buffer_append(&numbers, block, array_length(block)));
+    CHECK(numbers.len == 4000);
+    CHECK(numbers.cap == 4096);
+    CHECK(numbers.ptr[999] == 999 * 999 && numbers.ptr[3999] == 2999);
+
+    CHECK(u64Buffer_shrink(&numbers));
+    CHECK(numbers.cap == 4000);
+    CHECK(ksize(numbers.ptr) >= 4000 * sizeof(u64));
+    CHECK(numbers.ptr[3999] == 2999);
+
+    u64Buffer_clear(&numbers);
+    CHECK(numbers.len == 0 && numbers.cap == 4000);
+    CHECK(u64Buffer_shrink(&numbers));
+    CHECK(numbers.ptr == NULL && numbers.cap == 0);
+
+    // More elements than kmalloc can serve fails before anything is allocated
+    CHECK(!u64Buffer_reserve(&numbers, (u32)(KMALLOC_MAX_SIZE / sizeof(u64)) + 1));
+    CHECK(numbers.ptr == NULL && numbers.cap == 0);
+
+    // len cannot wrap. The buffers below claim to be full without owning that much memory, the
+    // guards have to reject them before touching ptr
+    u64 item = 7;
+    u64Buffer full = { .ptr = &item, .len = UINT32_MAX, .cap = UINT32_MAX };
+    CHECK(!u64Buffer_push(&full, 1));
+    CHECK(!u64Buffer_append(&full, block, 1));
+    CHECK(full.len == UINT32_MAX && item == 7);
+
+    u64Buffer nearly_full = { .ptr = &item, .len = UINT32_MAX - 2, .cap = UINT32_MAX - 2 };
+    CHECK(!u64Buffer_append(&nearly_full, block, 3));
+    CHECK(nearly_full.len == UINT32_MAX - 2);
+
+    char text = 'x';
+    SB full_sb = { .ptr = &text, .len = UINT32_MAX, .cap = UINT32_MAX };
+    CHECK(SB_c_str(&full_sb) == NULL);
+    CHECK(!SB_push(&full_sb, 'y'));
+    CHECK(text == 'x');
+
+    SB_free(&sb);
+    CHECK(sb.ptr == NULL && sb.len == 0 && sb.cap == 0);
+}
+
+GEN_SPSC_QUEUE(TestSPSCQueue, u64, 64)
+GEN_MPMC_QUEUE(TestMPMCQueue, u64, 64)
+
+#define QUEUE_TEST_COUNT 200000
+#define QUEUE_TEST_THREADS 4
+
+static TestSPSCQueue spsc_queue;
+static TestMPMCQueue mpmc_queue;
+
+// Values pushed by the MPMC producers: producer index in the high half, sequence number in the low half
+static _Atomic u8 mpmc_seen[QUEUE_TEST_THREADS][QUEUE_TEST_COUNT];
+static _Atomic u64 mpmc_popped;
+
+typedef struct QueueTestThread
+{
+    pthread_t thread;
+    u32 index;
+    // Values that arrived out of order or were not pushed by anyone
+    u64 errors;
+} QueueTestThread;
+
+static void* spsc_producer(void* argument)
+{
+    for (u64 i = 0; i < QUEUE_TEST_COUNT; i++)
+    {
+        while (!TestSPSCQueue_push(&spsc_queue, i))
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void* spsc_consumer(void* argument)
+{
+    QueueTestThread* self = argument;
+    for (u64 i = 0; i < QUEUE_TEST_COUNT; i++)
+    {
+        u64 value;
+        while (!TestSPSCQueue_pop(&spsc_queue, &value))
+        {
+            sched_yield();
+        }
+        self->errors += value != i;
+    }
+    return NULL;
+}
+
+static void* mpmc_producer(void* argument)
+{
+    QueueTestThread* self = argument;
+    for (u64 i = 0; i < QUEUE_TEST_COUNT; i++)
+    {
+        while (!TestMPMCQueue_push(&mpmc_queue, ((u64)self->index << 32) | i))
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void* mpmc_consumer(void* argument)
+{
+    QueueTestThread* self = argument;
+    // One producer's values must reach any single consumer in the order they were pushed
+    s64 last[QUEUE_TEST_THREADS];
+    for (u32 i = 0; i < QUEUE_TEST_THREADS; i++)
+    {
+        last[i] = -1;
+    }
+
+    while (atomic_load_explicit(&mpmc_popped, memory_order_relaxed) < (u64)QUEUE_TEST_THREADS * QUEUE_TEST_COUNT)
+    {
+        u64 value;
+        if (!TestMPMCQueue_pop(&mpmc_queue, &value))
+        {
+            sched_yield();
+            continue;
+        }
+        atomic_fetch_add_explicit(&mpmc_popped, 1, memory_order_relaxed);
+
+        u32 producer = (u32)(value >> 32);
+        u32 sequence = (u32)value;
+        if (producer >= QUEUE_TEST_THREADS || sequence >= QUEUE_TEST_COUNT || (s64)sequence <= last[producer])
+        {
+            self->errors++;
+            continue;
+        }
+        last[producer] = sequence;
+        atomic_fetch_add_explicit(&mpmc_seen[producer][sequence], 1, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+static void test_queues(void)
+{
+    // Single threaded: full and empty edges, FIFO order, and the u32 indices wrapping around
+    TestSPSCQueue_init(&spsc_queue);
+    atomic_store(&spsc_queue.head, UINT32_MAX - 20);
+    atomic_store(&spsc_queue.tail, UINT32_MAX - 20);
+    spsc_queue.cached_head = UINT32_MAX - 20;
+    spsc_queue.cached_tail = UINT32_MAX - 20;
+
+    u64 value = 0;
+    CHECK(!TestSPSCQueue_pop(&spsc_queue, &value));
+    bool ordered = true;
+    for (u32 round = 0; round < 3; round++)
+    {
+        for (u64 i = 0; i < 64; i++)
+        {
+            ordered &= TestSPSCQueue_push(&spsc_queue, round * 64 + i);
+        }
+        CHECK(!TestSPSCQueue_push(&spsc_queue, 1000));
+        CHECK(TestSPSCQueue_count(&spsc_queue) == 64);
+        for (u64 i = 0; i < 64; i++)
+        {
+            ordered &= TestSPSCQueue_pop(&spsc_queue, &value) && value == round * 64 + i;
+        }
+        CHECK(!TestSPSCQueue_pop(&spsc_queue, &value));
+    }
+    CHECK(ordered);
+    // The indices wrapped past zero on the way
+    CHECK(atomic_load(&spsc_queue.head) == (u32)(UINT32_MAX - 20 + 3 * 64));
+
+    TestMPMCQueue_init(&mpmc_queue);
+    CHECK(!TestMPMCQueue_pop(&mpmc_queue, &value));
+    ordered = true;
+    for (u32 round = 0; round < 3; round++)
+    {
+        for (u64 i = 0; i < 64; i++)
+        {
+            ordered &= TestMPMCQueue_push(&mpmc_queue, round * 64 + i);
+        }
+        CHECK(!TestMPMCQueue_push(&mpmc_queue, 1000));
+        for (u64 i = 0; i < 64; i++)
+        {
+            ordered &= TestMPMCQueue_pop(&mpmc_queue, &value) && value == round * 64 + i;
+        }
+        CHECK(!TestMPMCQueue_pop(&mpmc_queue, &value));
+        // Moves the start of the next round by one cell, so its cells straddle the end of the array
+        ordered &= TestMPMCQueue_push(&mpmc_queue, 7) && TestMPMCQueue_pop(&mpmc_queue, &value) && value == 7;
+    }
+    CHECK(ordered);
+
+    // One producer and one consumer thread, many laps through a small ring
+    TestSPSCQueue_init(&spsc_queue);
+    QueueTestThread producer = { 0 };
+    QueueTestThread consumer = { 0 };
+    pthread_create(&producer.thread, NULL, spsc_producer, &producer);
+    pthread_create(&consumer.thread, NULL, spsc_consumer, &consumer);
+    pthread_join(producer.thread, NULL);
+    pthread_join(consumer.thread, NULL);
+    CHECK_U64(consumer.errors, 0);
+    CHECK(!TestSPSCQueue_pop(&spsc_queue, &value));
+
+    // Several producers and consumers: every value arrives exactly once, in order per producer
+    TestMPMCQueue_init(&mpmc_queue);
+    QueueTestThread producers[QUEUE_TEST_THREADS] = { 0 };
+    QueueTestThread consumers[QUEUE_TEST_THREADS] = { 0 };
+    for (u32 i = 0; i < QUEUE_TEST_THREADS; i++)
+    {
+        producers[i].index = i;
+        consumers[i].index = i;
+        pthread_create(&producers[i].thread, NULL, mpmc_producer, &producers[i]);
+        pthread_create(&consumers[i].thread, NULL, mpmc_consumer, &consumers[i]);
+    }
+
+    u64 errors = 0;
+    for (u32 i = 0; i < QUEUE_TEST_THREADS; i++)
+    {
+        pthread_join(producers[i].thread, NULL);
+        pthread_join(consumers[i].thread, NULL);
+        errors += consumers[i].errors;
+    }
+    CHECK_U64(errors, 0);
+    CHECK_U64(atomic_load(&mpmc_popped), (u64)QUEUE_TEST_THREADS * QUEUE_TEST_COUNT);
+
+    u64 wrong_counts = 0;
+    for (u32 producer = 0; producer < QUEUE_TEST_THREADS; producer++)
+    {
+        for (u32 i = 0; i < QUEUE_TEST_COUNT; i++)
+        {
+            wrong_counts += atomic_load_explicit(&mpmc_seen[producer][i], memory_order_relaxed) != 1;
+        }
+    }
+    CHECK_U64(wrong_counts, 0);
+    CHECK(!TestMPMCQueue_pop(&mpmc_queue, &value));
+}
+
+typedef enum LockKind
+{
+    LockKind_Spinlock,
+    LockKind_TicketLock,
+    LockKind_MCSLock,
+    LockKind_RWLock,
+    LockKind_SeqLock,
+    LockKind_Count,
+} LockKind;
+
+static const char* lock_kind_names[LockKind_Count] =
+{
+    [LockKind_Spinlock] = "Spinlock",
+    [LockKind_TicketLock] = "TicketLock",
+    [LockKind_MCSLock] = "MCSLock",
+    [LockKind_RWLock] = "RWLock",
+    [LockKind_SeqLock] = "SeqLock",
+};
+
+#define LOCK_TEST_COUNT 50000
+#define LOCK_TEST_THREADS 4
+
+static Spinlock test_spinlock;
+static TicketLock test_ticket_lock;
+static MCSLock test_mcs_lock;
+static RWLock test_rw_lock;
+static SeqLock test_seq_lock;
+
+// Protected by the lock under test and deliberately not atomic: a lock that lets two holders in
+// loses increments or leaves the pair unequal
+static volatile u64 lock_counter;
+static volatile u32 lock_holders;
+static volatile u64 lock_pair[2];
+
+typedef struct LockTestThread
+{
+    pthread_t thread;
+    LockKind kind;
+    // Readers only look at lock_pair, through read_lock or the seqlock retry loop
+    bool reader;
+    u64 errors;
+} LockTestThread;
+
+// Every few iterations the holder yields halfway through, so other threads get to run against the
+// held lock even on a single CPU
+static void lock_test_write(LockTestThread* self, u32 iteration)
+{
+    MCSNode node;
+
+    switch (self->kind)
+    {
+        case LockKind_Spinlock: spin_lock(&test_spinlock); break;
+        case LockKind_TicketLock: ticket_lock(&test_ticket_lock); break;
+        case LockKind_MCSLock: mcs_lock(&test_mcs_lock, &node); break;
+        case LockKind_RWLock: write_lock(&test_rw_lock); break;
+        case LockKind_SeqLock: write_seqlock(&test_seq_lock); break;
+        default: break;
+    }
+
+    self->errors += ++lock_holders != 1;
+    lock_pair[0] = lock_counter + 1;
+    if (iteration % 16 == 0)
+    {
+        sched_yield();
+    }
+    lock_counter = lock_counter + 1;
+    lock_pair[1] = lock_counter;
+    lock_holders--;
+
+    switch (self->kind)
+    {
+        case LockKind_Spinlock: spin_unlock(&test_spinlock); break;
+        case LockKind_TicketLock: ticket_unlock(&test_ticket_lock); break;
+        case LockKind_MCSLock: mcs_unlock(&test_mcs_lock, &node); break;
+        case LockKind_RWLock: write_unlock(&test_rw_lock); break;
+        case LockKind_SeqLock: write_sequnlock(&test_seq_lock); break;
+        default: break;
+    }
+}
+
+static void lock_test_read(LockTestThread* self, u32 iteration)
+{
+    u64 first;
+    u64 second;
+
+    if (self->kind == LockKind_RWLock)
+    {
+        read_lock(&test_rw_lock);
+        first = lock_pair[0];
+        if (iteration % 16 == 0)
+        {
+            sched_yield();
+        }
+        second = lock_pair[1];
+        self->errors += lock_holders != 0;
+        read_unlock(&test_rw_lock);
+    }
+    else
+    {
+        u32 sequence;
+        do
+        {
+            sequence = read_seqbegin(&test_seq_lock);
+            first = lock_pair[0];
+            second = lock_pair[1];
+        } while (read_seqretry(&test_seq_lock, sequence));
+    }
+
+    self->errors += first != second;
+}
+
+static void* lock_test_thread(void* argument)
+{
+    LockTestThread* self = argument;
+    for (u32 i = 0; i < LOCK_TEST_COUNT; i++)
+    {
+        if (self->reader)
+        {
+            lock_test_read(self, i);
+        }
+        else
+        {
+            lock_test_write(self, i);
+        }
+    }
+    return NULL;
+}
+
+static void test_locks(void)
+{
+    // trylock against a free and a held lock
+    Spinlock spinlock = SPINLOCK_INIT;
+    CHECK(spin_trylock(&spinlock));
+    CHECK(spin_is_locked(&spinlock));
+    CHECK(!spin_trylock(&spinlock));
+    spin_unlock(&spinlock);
+    CHECK(!spin_is_locked(&spinlock));
+
+    TicketLock ticket_lock = TICKET_LOCK_INIT;
+    CHECK(ticket_trylock(&ticket_lock));
+    CHECK(!ticket_trylock(&ticket_lock));
+    ticket_unlock(&ticket_lock);
+    CHECK(ticket_trylock(&ticket_lock));
+    ticket_unlock(&ticket_lock);
+
+    MCSLock mcs_lock = MCS_LOCK_INIT;
+    MCSNode first_node;
+    MCSNode second_node;
+    CHECK(mcs_trylock(&mcs_lock, &first_node));
+    CHECK(!mcs_trylock(&mcs_lock, &second_node));
+    mcs_unlock(&mcs_lock, &first_node);
+    CHECK(mcs_lock.tail == NULL);
+
+    RWLock rw_lock = RW_LOCK_INIT;
+    CHECK(read_trylock(&rw_lock));
+    CHECK(read_trylock(&rw_lock));
+    CHECK(!write_trylock(&rw_lock));
+    read_unlock(&rw_lock);
+    read_unlock(&rw_lock);
+    CHECK(write_trylock(&rw_lock));
+    CHECK(!read_trylock(&rw_lock));
+    CHECK(!write_trylock(&rw_lock));
+    write_unlock(&rw_lock);
+    CHECK(atomic_load(&rw_lock.state) == 0);
+
+    SeqLock seq_lock = SEQ_LOCK_INIT;
+    u32 sequence = read_seqbegin(&seq_lock);
+    CHECK(!read_seqretry(&seq_lock, sequence));
+    write_seqlock(&seq_lock);
+    write_sequnlock(&seq_lock);
+    CHECK(read_seqretry(&seq_lock, sequence));
+
+    // Contended: every lock keeps its writers apart. RWLock and SeqLock run half the threads as
+    // readers, which must never see a writer inside or a half-written pair
+    for (LockKind kind = 0; kind < LockKind_Count; kind++)
+    {
+        spin_lock_init(&test_spinlock);
+        ticket_lock_init(&test_ticket_lock);
+        mcs_lock_init(&test_mcs_lock);
+        rw_lock_init(&test_rw_lock);
+        seq_lock_init(&test_seq_lock);
+        lock_counter = 0;
+        lock_pair[0] = 0;
+        lock_pair[1] = 0;
+
+        bool has_readers = kind == LockKind_RWLock || kind == LockKind_SeqLock;
+        u32 writer_count = has_readers ? LOCK_TEST_THREADS / 2 : LOCK_TEST_THREADS;
+        LockTestThread threads[LOCK_TEST_THREADS];
+        for (u32 i = 0; i < LOCK_TEST_THREADS; i++)
+        {
+            threads[i] = (LockTestThread) { .kind = kind, .reader = i >= writer_count };
+            pthread_create(&threads[i].thread, NULL, lock_test_thread, &threads[i]);
+        }
+
+        u64 errors = 0;
+        for (u32 i = 0; i < LOCK_TEST_THREADS; i++)
+        {
+            pthread_join(threads[i].thread, NULL);
+            errors += threads[i].errors;
+        }
+
+        bool exclusive = errors == 0 && lock_counter == (u64)writer_count * LOCK_TEST_COUNT;
+        if (!exclusive)
+        {
+            printf("%s: %lu errors, counter %lu\n", lock_kind_names[kind], errors, lock_counter);
+        }
+        CHECK(exclusive);
+    }
+}
+
+int main(void)
+{
+    host_setup();
+    slab_setup();
+    kmalloc_setup();
+
+    test_format_integers();
+    test_format_other_types();
+    test_format_spec();
+    test_format_float();
+    test_snprintf();
+    test_print();
+    test_string_to_unsigned();
+    test_strings();
+    test_memory();
+    test_checksums();
+    test_buffers();
+    test_queues();
+    test_locks();
+
+    return host_test_finish("libk_test");
+}
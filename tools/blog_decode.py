@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+"""Decodes the binary kernel log written by the blogdump command.
+
+Usage: blog_decode.py kernel.elf [serial.log]
+
+Reads "@blog <cpu> <tsc> <format offset> [arguments...]" lines from the captured COM1 output (stdin if
+no file is given), looks the format strings up in the .blog_formats section of kernel.elf and prints
+them with the same directive syntax as the kernel's vformat(). Other lines are ignored.
+"""
+
+import struct
+import sys
+
+SHT_NOBITS = 8
+SHF_ALLOC = 2
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 2:
+            raise ValueError(f"{path} is not a 64-bit ELF file")
+
+        (shoff,) = struct.unpack_from("<Q", self.data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", self.data, 0x3A)
+
+        headers = []
+        for i in range(shnum):
+            name, kind, flags, addr, offset, size = struct.unpack_from("<IIQQQQ", self.data, shoff + i * shentsize)
+            headers.append((name, kind, flags, addr, offset, size))
+
+        names_offset = headers[shstrndx][4]
+        self.sections = {}
+        for name, kind, flags, addr, offset, size in headers:
+            end = self.data.index(b"\0", names_offset + name)
+            section_name = self.data[names_offset + name:end].decode()
+            self.sections[section_name] = (kind, flags, addr, offset, size)
+
+    def section_bytes(self, name):
+        kind, flags, addr, offset, size = self.sections[name]
+        return self.data[offset:offset + size]
+
+    def string_at(self, address):
+        """C string at a link-time address, or None if no loaded section holds it."""
+        for kind, flags, addr, offset, size in self.sections.values():
+            if kind != SHT_NOBITS and flags & SHF_ALLOC and addr <= address < addr + size:
+                start = offset + address - addr
+                end = self.data.find(b"\0", start, offset + size)
+                return self.data[start:end if end >= 0 else offset + size].decode(errors="replace")
+        return None
+
+
+def to_signed(value, bits):
+    value &= (1 << bits) - 1
+    return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def format_float(value, precision):
+    if precision is not None:
+        return f"{value:.{precision}f}"
+    text = repr(value)
+    return text[:-2] if text.endswith(".0") else text
+
+
+class Formatter:
+    """Mirrors the directives of vformat(): %[flags width .precision]<type>, with types %s, %f, %c,
+    %b (bool) and %<8|16|32|64><s|u|h|b> (signed, unsigned, hexadecimal, binary)."""
+
+    def __init__(self, elf):
+        self.elf = elf
+
+    def format(self, text, args):
+        args = iter(args)
+        out = []
+        i = 0
+        while i < len(text):
+            c = text[i]
+            if c == "\t":
+                column = len("".join(out))
+                out.append(" " * (4 - column % 4))
+                i += 1
+                continue
+            if c != "%":
+                out.append(c)
+                i += 1
+                continue
+
+            i += 1
+            width, precision, fill, left = 0, None, " ", False
+            if text.startswith("[", i):
+                i += 1
+                while i < len(text) and text[i] in "-0'":
+                    if text[i] == "-":
+                        left = True
+                    elif text[i] == "0":
+                        fill = "0"
+                    else:
+                        i += 1
+                        fill = text[i]
+                    i += 1
+                width, i = self.number(text, i, args)
+                if text.startswith(".", i):
+                    precision, i = self.number(text, i + 1, args)
+                i += 1  # ']'
+
+            field, i = self.directive(text, i, args, precision)
+            if field is None:
+                out.append("%")
+                continue
+
+            padding = max(width - len(field), 0)
+            if left:
+                field = field + " " * padding
+            elif fill == "0" and field.startswith("-"):
+                field = "-" + "0" * padding + field[1:]
+            else:
+                field = fill * padding + field
+            out.append(field)
+        return "".join(out)
+
+    @staticmethod
+    def number(text, i, args):
+        if text.startswith("*", i):
+            return next(args, 0) & 0xFFFFFFFF, i + 1
+        start = i
+        while i < len(text) and text[i].isdigit():
+            i += 1
+        return int(text[start:i] or 0), i
+
+    def directive(self, text, i, args, precision):
+        for size in ("64", "32", "16", "8"):
+            if text.startswith(size, i) and i + len(size) < len(text) and text[i + len(size)] in "suhb":
+                kind = text[i + len(size)]
+                bits = int(size)
+                value = next(args, 0) & ((1 << bits) - 1)
+                i += len(size) + 1
+                if kind == "s":
+                    return str(to_signed(value, bits)), i
+                if kind == "u":
+                    return str(value), i
+                if kind == "h":
+                    return f"0x{value:0{bits // 4}X}", i
+                return f"0b{value:0{bits}b}", i
+
+        kind = text[i] if i < len(text) else ""
+        if kind == "s":
+            address = next(args, 0)
+            string = self.elf.string_at(address)
+            if string is None:
+                string = f"<string at 0x{address:X}>"
+            return string if precision is None else string[:precision], i + 1
+        if kind == "f":
+            (value,) = struct.unpack("<d", struct.pack("<Q", next(args, 0)))
+            return format_float(value, precision), i + 1
+        if kind == "c":
+            return chr(next(args, 0) & 0xFF), i + 1
+        if kind == "b":
+            return ("true" if next(args, 0) & 0xFF else "false"), i + 1
+        return None, i
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        print(__doc__.strip(), file=sys.stderr)
+        return 1
+
+    elf = Elf(sys.argv[1])
+    formats = elf.section_bytes(".blog_formats")
+    formatter = Formatter(elf)
+
+    source = open(sys.argv[2], errors="replace") if len(sys.argv) == 3 else sys.stdin
+    with source:
+        for line in source:
+            fields = line.split()
+            if len(fields) < 4 or fields[0] != "@blog":
+                continue
+
+            cpu = int(fields[1])
+            tsc, offset, *args = (int(field, 0) for field in fields[2:])
+            end = formats.find(b"\0", offset)
+            if offset >= len(formats) or end < 0:
+                print(f"[{tsc:16} {cpu}] <unknown format offset 0x{offset:X}>")
+                continue
+
+            text = formats[offset:end].decode(errors="replace")
+            print(f"[{tsc:16} {cpu}] {formatter.format(text, args)}")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())